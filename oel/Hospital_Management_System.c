@@ -1,8 +1,38 @@
+#ifdef _WIN32
+#define _CRT_RAND_S            // rand_s() for the replication key (must come before stdlib.h)
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#ifdef _WIN32
+#include <io.h>                // _isatty() / _fileno() to detect a real console
+#else
+#include <unistd.h>            // isatty() / fileno()
+#endif
+#ifdef _WIN32
+#include <winsock2.h>          // Sockets for the read replicas (must come before windows.h)
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <pthread.h>           // Worker threads for the parallel shard queries
+#include <sys/socket.h>        // Sockets for the read replicas
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <signal.h>            // SIGPIPE is ignored while replicas are served
+#include <fcntl.h>             // open() of the replication key with owner-only permissions
+#include <sys/stat.h>
+#endif
 #include <windows.h>
 #include <conio.h>
+#ifdef __linux__
+#include <linux/perf_event.h>  // Hardware cache-miss counters for the layout benchmark
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 // ===== COLOR CODES =====
 // These ANSI escape codes are used to display colored text in the terminal
@@ -23,6 +53,11 @@
 #define HOSPITAL_FILE "hospitals.txt"  // File to store hospital records
 #define PATIENT_FILE "patients.txt"    // File to store patient records
 #define USER_FILE "users.txt"          // File to store user login credentials
+#define HOSPITAL_TEMP_FILE "hospitals.tmp"  // Temporary copy while a hospital line is rewritten
+#define WAITING_FILE "waiting.txt"     // Patients waiting for a bed: id|name|age|disease|city|urgency
+#define RANKING_FILE "ranking.txt"     // Quality score settings: prior_mean|prior_weight|price_weight|price_reference
+#define SORTED_HOSPITAL_FILE "sorted_hospitals.txt"  // Output of the external sort of hospitals
+#define SORTED_PATIENT_FILE "sorted_patients.txt"    // Output of the external sort of patients
 
 // ===== SIZE CONSTANTS =====
 // These constants define the maximum length of various text fields
@@ -33,28 +68,188 @@
 #define USERNAME_SIZE 30           // Maximum characters for usernames
 #define PASSWORD_SIZE 30           // Maximum characters for passwords
 
+// ===== ID REGISTRY CONSTANTS =====
+// Settings for the in-memory uniqueness check used when adding records
+#define REGISTRY_INITIAL_CAPACITY 1024  // Starting number of hash table slots (always a power of two)
+#define BLOOM_BITS_PER_ID 16            // Bloom filter bits reserved for every ID slot
+#define BLOOM_HASHES 6                  // Number of bit positions set/tested per ID
+
+// ===== MEMORY CONSTANTS =====
+// Settings for the query arena and the shared string heap
+#define ARENA_BLOCK_SIZE (64 * 1024)     // Minimum bytes requested from malloc per arena block
+#define STRING_POOL_INITIAL_SIZE 4096    // Starting size of the string heap in bytes
+#define STRING_TABLE_INITIAL_SIZE 256    // Starting number of intern hash table slots (power of two)
+
+// ===== ANALYTICS CONSTANTS =====
+#define AGE_BUCKET_WIDTH 10              // Years per age group in the age histogram
+#define AGE_BUCKETS 10                   // Number of age groups (the last one is "90+")
+
+// ===== RENDERER CONSTANTS =====
+#define RENDER_BUFFER_SIZE (64 * 1024)   // Bytes of table output collected before one write
+#define PAGE_ROWS 20                     // Rows shown per page in the interactive pager
+
+// ===== STATISTICS CONSTANTS =====
+#define STATS_FILE "stats.txt"           // File the statistics are dumped to
+#define STATS_DUMP_INTERVAL 60           // Seconds between automatic dumps
+#define HISTOGRAM_SUB_BUCKETS 8          // Linear steps inside each power of two (about 12% precision)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS) // Enough buckets for any 64-bit nanosecond value
+#define PARSE_SAMPLE_RATE 64             // Time 1 out of every N record parses
+
+// ===== INDEX CONSTANTS =====
+#define PATIENT_INDEX_FILE "patients_id.idx"                // B+ tree on patient_id
+#define PATIENT_HOSPITAL_INDEX_FILE "patients_hospital.idx" // B+ tree on (hospital_id, patient_id)
+#define INDEX_MAGIC 0x48494458u                             // Marks a valid index file
+#define INDEX_PAGE_SIZE 4096                                // Bytes per B+ tree page
+#define INDEX_NODE_CAPACITY ((INDEX_PAGE_SIZE - 16) / 16)   // Keys per page (255)
+#define INDEX_CACHE_PAGES 1024                              // Pages kept in memory per index (4 MB)
+
+// ===== RANKING CONSTANTS =====
+// Defaults of the quality score (see QUALITY RANKING), changed from the Sorting menu
+#define DEFAULT_PRIOR_MEAN 3.0           // Rating assumed before any reviews
+#define DEFAULT_PRIOR_WEIGHT 25.0        // The prior counts as this many reviews
+#define DEFAULT_PRICE_WEIGHT 0.0         // Share of the score given to a low bed price (0 = off)
+#define DEFAULT_PRICE_REFERENCE 10000.0  // Bed price that gets half the price score
+
+// ===== SPATIAL CONSTANTS =====
+#define NO_LOCATION 1000.0f              // Latitude stored for hospitals without a location
+#define NEAREST_LIMIT 20                 // Most hospitals returned by a nearest query
+#define EARTH_RADIUS_KM 6371.0           // Mean Earth radius for distances
+#define PI 3.14159265358979323846
+
+// ===== ADMISSION CONSTANTS =====
+#define RATING_PRICE_PENALTY 0.10        // Each star below 5 makes a bed count 10% dearer when placing patients
+
+// ===== SHARD CONSTANTS =====
+#define HOSPITAL_SHARDS 16                          // Number of city shards of hospitals.txt
+#define HOSPITAL_SHARD_FORMAT "hospitals_%02d.shard" // Shard file names: hospitals_00.shard ...
+#define SHARD_MANIFEST_FILE "hospitals.shards"      // hospitals.txt size and rows the shards match
+
+// ===== REPLICATION CONSTANTS =====
+#define REPLICATION_PORT 47017           // Default local port of the primary
+#define REPLICATION_MAX_REPLICAS 8       // Most replicas one primary serves
+#define REPLICATION_POLL_MS 50           // How often the shipper checks for new records
+#define REPLICATION_HEARTBEAT_MS 1000    // Heartbeat interval (lets replicas see they are current)
+#define REPLICATION_RETRY_MS 1000        // Wait before a replica reconnects
+#define REPLICATION_BUFFER_SIZE (64 * 1024) // Receive buffer of a replica
+#define REPLICATION_KEY_FILE "replication.key" // Secret a replica must present (readable by the owner only)
+#define REPLICATION_KEY_SIZE 32          // Hex digits in the secret
+#define REPLICATION_AUTH_MS 2000         // How long the primary waits for a new replica's key
+
+// ===== EXTERNAL SORT CONSTANTS =====
+#define SORT_MEMORY_BUDGET_MB 64          // Default memory for one sort (change with --sort-memory MB)
+#define SORT_MIN_BUDGET (1024 * 1024)     // Smallest budget accepted (1 MB)
+#define SORT_MAX_FAN_IN 64                // Most run files merged at once
+#define SORT_RUN_FORMAT "sortrun_%04d.tmp" // Temporary run files of the external sort
+
+// ===== VIEW CACHE CONSTANTS =====
+#define VIEW_CACHE_BUDGET (32 * 1024 * 1024) // Most memory used by cached listing results
+#define VIEW_CACHE_ENTRIES 32                // Most results kept at once
+
+// ===== PERSISTENCE CONSTANTS =====
+#define PERSIST_QUEUE_SIZE 1024          // Lines that can wait for the writer thread (back-pressure beyond)
+#define PERSIST_BATCH_MAX 256            // Most lines written and synced together
+
+// ===== EVENT LOG CONSTANTS =====
+#define EVENT_SEGMENT_FORMAT "events_%05d.seg" // Segment files of the admission event log
+#define EVENT_ZONE_FILE "events.zones"   // Time and hospital range of every segment
+#define EVENT_SEGMENT_EVENTS 65536       // Events per segment before a new one is started
+#define EVENT_MAX_BYTES 32               // Longest encoded event
+#define EVENT_LIST_LIMIT 1000            // Most events listed by the admission history
+#define EVENT_REPORT_DAYS 3660           // Most days in one census report (about 10 years)
+
+// ===== SEARCH CONSTANTS =====
+#define SEARCH_RESULT_LIMIT 20           // Most results shown by a name search
+#define SCORE_EXACT 100                  // Whole name equals the search text
+#define SCORE_PREFIX 80                  // Name starts with the search text
+#define SCORE_WORD 60                    // A later word starts with the search text
+#define SCORE_SUBSTRING 40               // Search text appears inside a word
+#define SCORE_TYPO 20                    // Close spelling (minus the number of edits)
+
+// 64-bit file positions so data and index files can grow past 2 GB
+#ifdef _WIN32
+#define file_seek _fseeki64
+#define file_tell _ftelli64
+#else
+#define file_seek fseeko
+#define file_tell ftello
+#endif
+
+// Socket handles differ between Winsock and POSIX
+#ifdef _WIN32
+typedef SOCKET ReplicaSocket;
+#define close_socket closesocket
+#else
+typedef int ReplicaSocket;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0                   // Missing on Windows, macOS and BSD: network_init() ignores SIGPIPE instead
+#endif
+
+// Counters shared between the front desk and the persistence writer thread,
+// read and written without a lock (every value has a single writer)
+#ifdef _WIN32
+#define shared_load(p) InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0)
+#define shared_store(p, v) InterlockedExchange64((volatile LONG64 *)(p), (v))
+#define shared_add(p, v) InterlockedExchangeAdd64((volatile LONG64 *)(p), (v))
+#else
+#define shared_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define shared_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define shared_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#endif
+
 // ===== DATA STRUCTURES =====
 // A struct (structure) is a collection of variables of different types grouped together
 
-// Hospital structure: stores information about a single hospital
+// StrRef: offset of a zero-terminated string inside the shared string heap
+// Records store these 4-byte offsets instead of fixed-size char arrays, and
+// equal strings share one copy (interning), so "Lahore" is stored only once
+typedef uint32_t StrRef;
+
+// Hospital structure: the "hot" part of a hospital record (24 bytes)
+// Holds only the fields that sorting and filtering look at, so more records
+// fit in each cache line. The display text lives in the HospitalText table.
 typedef struct
 {
     int hospital_id;          // Unique identifier for the hospital
-    char hospital_name[NAME_SIZE];      // Name of the hospital
-    char city[CITY_SIZE];              // City where hospital is located
     int available_beds;       // Number of beds available for patients
     float bed_price;          // Cost per bed per day (uses decimal numbers)
     float rating;            // Hospital rating from 0-5 stars
     int reviews;             // Total number of reviews received
+    StrRef city;              // City where hospital is located (interned, so it doubles as a city code)
 } Hospital;
 
+// HospitalText structure: the "cold" part of a hospital record
+// Stored in a parallel table (row i of the text table belongs to row i of the
+// Hospital table) and only read when rows are printed or sorted by name
+typedef struct
+{
+    StrRef hospital_name;     // Name of the hospital (string heap offset)
+    float latitude;           // Location in degrees (NO_LOCATION if not given)
+    float longitude;          // Location in degrees
+} HospitalText;
+
+// LegacyHospital structure: the original fixed-size record layout (104 bytes)
+// Only used by the layout benchmark to compare against the hot/cold split
+typedef struct
+{
+    int hospital_id;
+    char hospital_name[NAME_SIZE];
+    char city[CITY_SIZE];
+    int available_beds;
+    float bed_price;
+    float rating;
+    int reviews;
+} LegacyHospital;
+
 // Patient structure: stores information about a single patient
 typedef struct
 {
     int patient_id;           // Unique identifier for the patient
-    char patient_name[NAME_SIZE];       // Name of the patient
+    StrRef patient_name;      // Name of the patient (string heap offset)
     int age;                 // Age of the patient
-    char disease[DISEASE_SIZE];        // Disease or medical condition
+    uint32_t disease;         // Disease or medical condition (code in disease_dictionary)
     int hospital_id;          // ID of the hospital where patient is admitted
 } Patient;
 
@@ -65,6 +260,676 @@ typedef struct
     char password[PASSWORD_SIZE];      // Password for login
 } User;
 
+// ===== RECORD SCHEMAS =====
+// Every data file line is described once here, field by field, in file order
+// (these are "X-macros": each list is expanded with a different X to generate code).
+// X(record, member, kind, decimals, title, width, left)
+//   record   - variable holding the field: h (Hospital) or t (HospitalText), p (Patient), u (User)
+//   kind     - INT, FLOAT, TEXT (interned StrRef), DISEASE (disease_dictionary code) or CHARS (char array)
+//   decimals - digits written after the point for a FLOAT
+//   title, width, left - table column (width 0 = not shown in the generated table)
+// The parsers, line formatters, table columns and field comparators are all
+// generated from these lists, so a new field is added in one place only.
+#define HOSPITAL_FIELDS(X) \
+    X(h, hospital_id,    INT,   0, "ID",            5,  0) \
+    X(t, hospital_name,  TEXT,  0, "Hospital Name", 50, 1) \
+    X(h, city,           TEXT,  0, "City",          12, 1) \
+    X(h, available_beds, INT,   0, "Beds",          5,  0) \
+    X(h, bed_price,      FLOAT, 2, "Price",         10, 0) \
+    X(h, rating,         FLOAT, 1, "Ratings",       7,  0) \
+    X(h, reviews,        INT,   0, "Reviews",       7,  0)
+
+// Optional fields at the end of a hospital line (written only when a location is known)
+#define HOSPITAL_LOCATION_FIELDS(X) \
+    X(t, latitude,       FLOAT, 5, "Latitude",      0,  0) \
+    X(t, longitude,      FLOAT, 5, "Longitude",     0,  0)
+
+// The hospital name column of the patient table is added by render_patient_row()
+#define PATIENT_FIELDS(X) \
+    X(p, patient_id,     INT,     0, "ID",          5,  0) \
+    X(p, patient_name,   TEXT,    0, "Name",        20, 1) \
+    X(p, age,            INT,     0, "Age",         3,  1) \
+    X(p, disease,        DISEASE, 0, "Disease",     25, 1) \
+    X(p, hospital_id,    INT,     0, "Hospital",    0,  0)
+
+#define USER_FIELDS(X) \
+    X(u, username,       CHARS,   0, "Username",    0,  1) \
+    X(u, password,       CHARS,   0, "Password",    0,  1)
+
+// Field numbers (position in the line), e.g. HOSPITAL_FIELD_bed_price = 4
+#define HOSPITAL_FIELD_NUMBER(record, member, kind, decimals, title, width, left) HOSPITAL_FIELD_##member,
+#define PATIENT_FIELD_NUMBER(record, member, kind, decimals, title, width, left) PATIENT_FIELD_##member,
+#define USER_FIELD_NUMBER(record, member, kind, decimals, title, width, left) USER_FIELD_##member,
+typedef enum { HOSPITAL_FIELDS(HOSPITAL_FIELD_NUMBER) HOSPITAL_LOCATION_FIELDS(HOSPITAL_FIELD_NUMBER) HOSPITAL_FIELD_MAX } HospitalField;
+typedef enum { PATIENT_FIELDS(PATIENT_FIELD_NUMBER) PATIENT_FIELD_COUNT } PatientField;
+typedef enum { USER_FIELDS(USER_FIELD_NUMBER) USER_FIELD_COUNT } UserField;
+#define HOSPITAL_FIELD_COUNT HOSPITAL_FIELD_latitude  // Fields every hospital line has
+
+// IdRegistry structure: remembers every ID already used in a data file
+// A Bloom filter answers "definitely new" in O(1) without touching the hash table,
+// and the exact hash set confirms the rare "maybe seen" answers so no false rejections happen
+typedef struct
+{
+    uint64_t *bloom;          // Bloom filter bit array (64 bits per word)
+    uint32_t bloom_bits;      // Number of bits in the Bloom filter (power of two)
+    int *slots;               // Open-addressing hash table holding the exact IDs
+    unsigned char *used;      // used[i] is 1 when slots[i] holds an ID
+    uint32_t capacity;        // Number of hash table slots (power of two)
+    uint32_t count;           // Number of distinct IDs stored
+    int loaded;               // 1 once the registry has been filled from its file
+} IdRegistry;
+
+// ArenaBlock structure: one malloc'd chunk of an arena
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;  // Next block in the chain (kept across resets)
+    size_t size;              // Usable bytes in data[]
+    size_t used;              // Bytes handed out since the last reset
+    unsigned char *data;      // Start of the usable bytes
+} ArenaBlock;
+
+// Arena structure: bump allocator for per-query temporaries
+// Allocation just moves a pointer forward; arena_reset() makes every block
+// reusable again, so after the first few queries no more malloc calls happen
+typedef struct
+{
+    ArenaBlock *head;         // First block in the chain
+    ArenaBlock *current;      // Block currently being filled
+} Arena;
+
+// StringPool structure: the shared string heap with an intern table
+typedef struct
+{
+    char *data;               // All strings, each followed by '\0'
+    uint32_t size;            // Bytes in use
+    uint32_t capacity;        // Bytes allocated
+    uint32_t *table;          // Hash table of offsets (0 = empty slot)
+    uint32_t table_size;      // Number of slots (power of two)
+    uint32_t count;           // Number of distinct strings stored
+} StringPool;
+
+// IntMap structure: hash table from an integer key to an integer value
+typedef struct
+{
+    int *keys;                // Stored keys
+    int *values;              // Value for each stored key
+    unsigned char *used;      // used[i] is 1 when slot i holds a key
+    uint32_t capacity;        // Number of slots (power of two)
+    uint32_t count;           // Number of keys stored
+} IntMap;
+
+// Dictionary structure: gives every distinct string a small dense code (0, 1, 2, ...)
+// Columns store the code, so grouping and counting index straight into arrays
+// instead of comparing strings
+typedef struct
+{
+    IntMap codes;             // Interned string offset -> code
+    StrRef *values;           // Code -> interned string offset
+    uint32_t count;           // Number of codes handed out
+    uint32_t capacity;        // Room in values[]
+} Dictionary;
+
+// OutputBuffer structure: collects formatted table text so it can be written in big chunks
+typedef struct
+{
+    char data[RENDER_BUFFER_SIZE];  // Formatted text waiting to be written
+    size_t size;                    // Bytes currently in data[]
+    int color;                      // 1 when colour escape codes should be written
+} OutputBuffer;
+
+// RowRenderer: function that appends row number index of a table to the output buffer
+typedef void (*RowRenderer)(int index, const void *table);
+
+// Operation codes: every timed operation has its own latency histogram
+enum
+{
+    OP_LOAD,      // Loading a whole data file into memory
+    OP_PARSE,     // Parsing one record line (sampled)
+    OP_SORT,      // Sorting rows for a listing
+    OP_FILTER,    // Filtering rows (e.g. by city)
+    OP_LOOKUP,    // Finding one record by ID
+    OP_INSERT,    // Writing a new record
+    OP_LOGIN,     // Checking login credentials
+    OP_SCAN,      // Reading a key range from an index
+    OP_SEARCH,    // Searching names
+    OP_UPDATE,    // Changing an existing record
+    OP_NEAREST,   // Nearest hospitals with free beds
+    OP_SCHEDULE,  // Placing the waiting queue
+    OP_HISTORY,   // Event log range queries and census reports
+    OP_COUNT      // Number of operation codes
+};
+
+// LatencyHistogram structure: HDR-style log-linear histogram of nanosecond timings
+// Each power of two is split into HISTOGRAM_SUB_BUCKETS equal steps, so recording
+// is a couple of bit operations and percentiles stay within about 12%
+typedef struct
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS];  // Number of timings that fell in each bucket
+    uint64_t count;                       // Total timings recorded
+    uint64_t total_ns;                    // Sum of all timings (for the mean)
+    uint64_t max_ns;                      // Slowest timing seen
+} LatencyHistogram;
+
+// Stats structure: all counters collected while the program runs
+typedef struct
+{
+    LatencyHistogram latency[OP_COUNT];   // One histogram per operation
+    uint64_t bytes_read;                  // Bytes read from data files
+    uint64_t records_parsed;              // Record lines parsed
+    uint64_t file_opens;                  // Number of fopen calls on data files
+    uint64_t heap_allocations;            // malloc/calloc/realloc calls
+    uint64_t arena_allocations;           // arena_alloc calls (no malloc needed)
+    double started_at;                    // When the program started (seconds)
+    double last_dump;                     // When stats were last written to STATS_FILE
+} Stats;
+
+// IndexPage structure: one 4 KB page of a B+ tree
+// Leaf pages hold sorted keys with their values and link to the next leaf.
+// Branch pages hold separator keys: next is the child for keys below keys[0],
+// values[i] is the child for keys from keys[i] up to keys[i + 1].
+typedef struct
+{
+    uint16_t is_leaf;                       // 1 for a leaf page, 0 for a branch page
+    uint16_t count;                         // Number of keys in use
+    uint32_t reserved;                      // Padding so the arrays stay 8-byte aligned
+    int64_t next;                           // Leaf: next leaf page (0 = last); branch: leftmost child
+    int64_t keys[INDEX_NODE_CAPACITY];      // Sorted keys
+    int64_t values[INDEX_NODE_CAPACITY];    // Leaf: record offsets; branch: child pages
+} IndexPage;
+
+// IndexMeta structure: header stored in page 0 of every index file
+typedef struct
+{
+    uint32_t magic;           // INDEX_MAGIC
+    uint32_t page_size;       // INDEX_PAGE_SIZE the file was written with
+    int64_t root;             // Page number of the root
+    int64_t page_count;       // Pages in the file (including this header)
+    int64_t entries;          // Keys stored
+    int64_t source_size;      // Size of the data file the index describes
+} IndexMeta;
+
+// BPlusTree structure: an open index file with its page cache
+typedef struct
+{
+    FILE *fp;                 // Index file
+    const char *filename;     // Name of the index file
+    IndexMeta meta;           // Copy of the header page
+    IndexPage *cache;         // INDEX_CACHE_PAGES cached pages
+    int64_t *cached;          // Page number held in each cache slot (-1 = empty)
+    int write_failed;         // 1 once a page or header could not be written (the file is unusable)
+} BPlusTree;
+
+// IndexCursor structure: position inside the leaf chain during a range scan
+typedef struct
+{
+    BPlusTree *tree;          // Tree being scanned
+    int64_t page;             // Current leaf page (0 = finished)
+    int index;                // Next key inside that leaf
+} IndexCursor;
+
+// IndexEntry structure: one key/value pair used when building an index
+typedef struct
+{
+    int64_t key;              // Index key
+    int64_t value;            // Record offset (or child page while building)
+} IndexEntry;
+
+// NameDoc structure: one searchable name
+typedef struct
+{
+    int id;                   // Hospital or patient ID
+    StrRef name;              // Name as typed
+    StrRef lowered;           // Lower-case copy used for matching
+    StrRef detail;            // Extra column shown in results (city or disease)
+    int length;               // Length of the name (shorter names rank first)
+} NameDoc;
+
+// PostingList structure: sorted document numbers of every name containing one trigram
+typedef struct
+{
+    int *docs;                // Document numbers in increasing order
+    int count;                // Number of documents
+    int capacity;             // Room in docs[]
+} PostingList;
+
+// NameIndex structure: in-memory search index over hospital or patient names
+typedef struct
+{
+    NameDoc *docs;            // Every name, in insertion order
+    int *by_name;             // Document numbers sorted by lower-case name (prefix search)
+    uint32_t *seen;           // Query number that last scored each document
+    int count;                // Number of documents
+    int capacity;             // Room in docs[], by_name[] and seen[]
+    IntMap trigram_lists;     // Trigram -> position in lists[]
+    PostingList *lists;       // One posting list per distinct trigram
+    int list_count;           // Number of posting lists
+    int list_capacity;        // Room in lists[]
+    uint32_t query_number;    // Increases with every search
+    int built;                // 1 once loaded from the data file
+} NameIndex;
+
+// SearchResult structure: one ranked search hit
+typedef struct
+{
+    int doc;                  // Document number in the index
+    int score;                // SCORE_* value, higher is better
+} SearchResult;
+
+// RankingSettings structure: priors of the quality score (stored in RANKING_FILE)
+typedef struct
+{
+    double prior_mean;        // Rating assumed before any reviews
+    double prior_weight;      // How many reviews the prior counts as
+    double price_weight;      // Share of the score given to a low bed price (0 to 1)
+    double price_reference;   // Bed price that gets half the price score
+} RankingSettings;
+
+// Ranking structure: materialised quality score of every hospital row and the ranked order
+typedef struct
+{
+    RankingSettings settings; // Settings the scores were computed with
+    float *score;             // Quality score per row (rows in file order)
+    int *order;               // Row numbers, best score first
+    int count;                // Rows with a score
+    int ranked;               // Rows currently in order[]
+    int capacity;             // Room in score[] and order[]
+    int64_t source_size;      // Size of hospitals.txt the ranking belongs to
+    int built;                // 1 once computed (0 = recompute on the next listing)
+} Ranking;
+
+// SpatialPoint structure: one hospital location, which is also a node of the k-d tree
+typedef struct
+{
+    float xyz[3];             // Location as a point on the unit sphere
+    int left;                 // Child with smaller coordinate on axis (-1 = none)
+    int right;                // Child with larger or equal coordinate (-1 = none)
+    int parent;               // Parent node (-1 = root)
+    int free_count;           // Hospitals with free beds in this subtree
+    int available_beds;       // Free beds of this hospital
+    int hospital_id;          // Hospital ID
+    StrRef name;              // Hospital name
+    StrRef city;              // City
+    float latitude;           // Location in degrees
+    float longitude;          // Location in degrees
+    unsigned char axis;       // Coordinate (0 = x, 1 = y, 2 = z) this node splits on
+} SpatialPoint;
+
+// SpatialIndex structure: k-d tree over the hospitals that have a location
+typedef struct
+{
+    SpatialPoint *points;     // All points; tree links are indexes into this array
+    int count;                // Number of points
+    int capacity;             // Room in points[]
+    int root;                 // Root node (-1 = empty tree)
+    int rebalance_at;         // Point count at which the tree is rebuilt balanced
+    IntMap by_id;             // Hospital ID -> point (for bed updates)
+    int64_t source_size;      // Size of hospitals.txt the tree belongs to
+    int built;                // 1 once loaded from the file
+} SpatialIndex;
+
+// NearestResult structure: one hit of a nearest query
+typedef struct
+{
+    int point;                // Point in the spatial index
+    float distance2;          // Squared distance on the unit sphere
+} NearestResult;
+
+// WaitingPatient structure: one entry of the waiting queue
+typedef struct
+{
+    int patient_id;           // ID the patient gets when admitted
+    StrRef patient_name;      // Name (string heap offset)
+    int age;                  // Age in years
+    uint32_t disease;         // Disease code (see disease_dictionary)
+    StrRef city;              // City the patient is in
+    int urgency;              // 1 = can wait to 5 = critical
+    int line;                 // Line of the entry in WAITING_FILE
+} WaitingPatient;
+
+// ShardRow structure: one hospital read by a shard worker thread
+// The text fields point into the thread's own copy of the shard file, so the
+// workers never touch the shared string heap (which is not thread-safe)
+typedef struct
+{
+    int row;                  // Row of the hospital in hospitals.txt (breaks ties like the file order)
+    int hospital_id;
+    int available_beds;
+    float bed_price;
+    float rating;
+    int reviews;
+    float latitude;
+    float longitude;
+    const char *name;         // Hospital name inside the shard buffer
+    const char *city;         // City inside the shard buffer
+} ShardRow;
+
+// ShardTask structure: the work and the result of one shard worker
+typedef struct
+{
+    int shard;                                   // Shard number to read
+    int (*compare)(const void *, const void *);  // ShardRow order to sort in
+    char *buffer;                                // Whole shard file (rows point into it)
+    int64_t bytes;                               // Bytes read
+    ShardRow *rows;                              // Parsed rows, sorted
+    int count;                                   // Number of rows
+} ShardTask;
+
+// WorkerStart structure: what a worker thread runs
+typedef struct
+{
+    void (*task)(void *);     // Function the thread calls
+    void *arg;                // Its argument
+} WorkerStart;
+
+#ifdef _WIN32
+typedef HANDLE WorkerThread;
+typedef CRITICAL_SECTION WorkerLock;
+typedef CONDITION_VARIABLE WorkerSignal;  // Threads sleep on it until another thread wakes them
+#else
+typedef pthread_t WorkerThread;
+typedef pthread_mutex_t WorkerLock;
+typedef pthread_cond_t WorkerSignal;
+#endif
+
+// TextBuffer structure: a growing block of text (messages for the replicas)
+typedef struct
+{
+    char *data;
+    size_t length;            // Bytes used
+    size_t capacity;          // Bytes allocated
+} TextBuffer;
+
+// ReplicationRecord structure: one change in the primary's replication log
+typedef struct
+{
+    int64_t seq;              // Record number (1, 2, 3, ...)
+    int64_t time_ms;          // Wall clock time the change was written
+    char *text;               // The whole "R|..." message line
+} ReplicationRecord;
+
+// ReplicaLink structure: one connected read replica (primary side)
+typedef struct
+{
+    ReplicaSocket socket;
+    int64_t next_seq;         // Next record to send
+    int64_t acked_seq;        // Newest record the replica has applied
+    int64_t connected_ms;     // When it connected
+    char inbox[64];           // Unfinished acknowledgement line
+    int inbox_used;
+} ReplicaLink;
+
+// ReplicationPrimary structure: the replication log and the connected replicas
+typedef struct
+{
+    int enabled;              // 1 when started with --primary
+    int port;
+    char key[REPLICATION_KEY_SIZE + 1]; // Secret written to REPLICATION_KEY_FILE at start
+    ReplicaSocket listener;
+    WorkerLock lock;          // Guards the log and the replica list, and the data files while they change
+    ReplicationRecord *records; // Records some replica has not applied yet
+    int count;
+    int capacity;
+    int64_t first_seq;        // Record number of records[0]
+    int64_t head_seq;         // Newest record number
+    ReplicaLink replicas[REPLICATION_MAX_REPLICAS];
+    int replica_count;
+    int resync;               // 1 asks the shipper to drop every replica (they reconnect for a new snapshot)
+    WorkerStart shipper;      // Thread that sends the records
+} ReplicationPrimary;
+
+// ReplicaStore structure: the in-memory tables of a read replica
+typedef struct
+{
+    int active;               // 1 when started with --replica
+    int port;
+    WorkerLock lock;          // Guards the tables, the string heap, the query arena and the statistics
+    Hospital *hot;
+    HospitalText *text;
+    int hospital_count;
+    int hospital_capacity;
+    Patient *patients;
+    int patient_count;
+    int patient_capacity;
+    IntMap hospital_rows;     // Hospital ID -> first row with that ID
+    int ready;                // 1 once a whole snapshot has arrived
+    int connected;            // 1 while connected to the primary
+    int key_missing;          // 1 if REPLICATION_KEY_FILE could not be read
+    int snapshots;            // Snapshots received (one per connection)
+    int64_t snapshot_seq;     // Record the snapshot being received was taken at
+    int64_t applied_seq;      // Newest record applied
+    int64_t primary_seq;      // Newest record the primary has announced
+    int64_t records_applied;  // Records applied since the last snapshot
+    int64_t last_commit_ms;   // When the primary wrote the last applied record
+    int64_t last_apply_ms;    // When this replica applied it
+    int64_t last_heard_ms;    // Last message from the primary
+    WorkerStart receiver;     // Thread that receives the records
+} ReplicaStore;
+
+// SortOrder: every order the external sort supports
+typedef enum
+{
+    SORT_HOSPITAL_PRICE,
+    SORT_HOSPITAL_BEDS,
+    SORT_HOSPITAL_NAME,
+    SORT_HOSPITAL_RATING,
+    SORT_PATIENT_ID,
+    SORT_PATIENT_NAME,
+    SORT_PATIENT_AGE,
+    SORT_PATIENT_HOSPITAL,
+    SORT_ORDER_COUNT
+} SortOrder;
+
+// KeyKind: how a sort key field is compared
+typedef enum
+{
+    KEY_INT,
+    KEY_FLOAT,
+    KEY_TEXT
+} KeyKind;
+
+// SortKey structure: one key field of a sort order
+typedef struct
+{
+    int field;                // Field number in the line (-1 = no key)
+    KeyKind kind;
+    int descending;           // 1 = highest first
+} SortKey;
+
+// SortOrderInfo structure: what an external sort order sorts and by which fields
+typedef struct
+{
+    const char *label;        // Shown in the menu
+    const char *file;         // Data file to sort
+    int patients;             // 1 for patients.txt lines, 0 for hospitals.txt lines
+    SortKey keys[2];          // Main key, then the tie breaker (rows decide after that)
+} SortOrderInfo;
+
+// SortItem structure: the keys of one line while it is being sorted
+typedef struct
+{
+    double key[2];            // Numeric keys
+    const char *text;         // Text key (points into the line)
+    int text_length;
+    int line_length;
+    int64_t row;              // Position among the records of the file (keeps ties in file order)
+    const char *line;         // The whole line, without its line ending
+} SortItem;
+
+// RunReader structure: one run file being merged, with its current line
+typedef struct
+{
+    FILE *fp;
+    char line[LINE_SIZE + 24];  // "row|line"
+    SortItem item;
+} RunReader;
+
+// SortEmit: receives the sorted lines, one at a time
+typedef void (*SortEmit)(const char *line, void *context);
+
+// ExternalSortResult structure: what one external sort did
+typedef struct
+{
+    int64_t rows;             // Records sorted
+    int runs;                 // Run files written (0 = sorted in memory)
+    int merge_passes;         // Merges needed, including the final one
+    int64_t bytes_spilled;    // Bytes written to run files
+    double seconds;
+} ExternalSortResult;
+
+// DataTable: the data files whose changes the view cache follows
+typedef enum
+{
+    TABLE_HOSPITALS,
+    TABLE_PATIENTS,
+    TABLE_COUNT
+} DataTable;
+
+// ViewKind: the listings the view cache can hold
+typedef enum
+{
+    VIEW_HOSPITALS,           // All hospitals in file order
+    VIEW_HOSPITALS_BY_PRICE,
+    VIEW_HOSPITALS_BY_BEDS,
+    VIEW_HOSPITALS_BY_NAME,
+    VIEW_HOSPITALS_IN_CITY,   // One city, by name
+    VIEW_HOSPITALS_BY_QUALITY, // Ranked by the stored quality score
+    VIEW_PATIENTS,            // All patients with their hospital names
+    VIEW_COUNT
+} ViewKind;
+
+// CachedView structure: one stored listing result, rows already in display order
+typedef struct
+{
+    int used;                 // 1 if this slot holds a result
+    ViewKind kind;            // Query: which listing ...
+    StrRef city;              // ... for which city (0 = all)
+    uint64_t version[TABLE_COUNT];    // Table versions the result was built from
+    int64_t source_size[TABLE_COUNT]; // Data file sizes at that time
+    int64_t source_time[TABLE_COUNT]; // and modification times (-1 = lines were still queued)
+    Hospital *hot;            // Hospital rows (hospital views)
+    HospitalText *text;
+    int *order;               // 0, 1, 2, ... (for callers that expect a row order)
+    float *score;             // Quality score of every row (ranked view only, otherwise NULL)
+    Patient *patients;        // Patient rows (patient view)
+    StrRef *hospital_names;   // Hospital name of every patient
+    int count;                // Number of rows
+    size_t bytes;             // Memory used by the rows
+    uint64_t last_used;       // For least-recently-used eviction
+    void *memory;             // The single allocation holding the rows
+} CachedView;
+
+// ViewCache structure: all cached results and the table versions
+typedef struct
+{
+    CachedView views[VIEW_CACHE_ENTRIES];
+    int count;                // Slots in use
+    size_t bytes;             // Memory used by all results
+    uint64_t version[TABLE_COUNT]; // Bumped by every change of a table
+    uint64_t clock;           // Use counter for the LRU order
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;   // Results dropped because their table changed
+    uint64_t evictions;       // Results dropped to stay in the memory budget
+} ViewCache;
+
+// PersistCallback: called by the writer thread once a queued line is on the disk (ok = 0 if writing failed)
+typedef void (*PersistCallback)(int64_t seq, int ok, void *context);
+
+// PersistRequest structure: one line waiting for the writer thread
+typedef struct
+{
+    DataTable table;          // File the line goes to
+    int length;               // Bytes in line
+    char line[LINE_SIZE];     // The line with its line ending
+    double queued_at;         // When the front desk queued it
+    PersistCallback done;     // Durable acknowledgement (may be NULL)
+    void *context;            // Passed to done
+} PersistRequest;
+
+// DurableAck structure: lets the front desk wait for the durable acknowledgement of one line
+// (int64_t fields so the shared_load/shared_store macros can be used on them)
+typedef struct
+{
+    DataTable table;          // File the line goes to
+    volatile int64_t ok;      // 1 if the line is on the disk (valid once done is set)
+    volatile int64_t done;    // Set by the writer thread after the line was written or failed
+} DurableAck;
+
+// Persistence structure: the submission ring and the writer thread's counters
+typedef struct
+{
+    int started;              // 1 when the writer thread runs (otherwise lines are written at once)
+    PersistRequest queue[PERSIST_QUEUE_SIZE]; // Ring of requests, slot = seq % PERSIST_QUEUE_SIZE
+    volatile int64_t head;    // Next request number (written by the front desk only)
+    volatile int64_t tail;    // Oldest request not written yet (written by the writer thread only)
+    volatile int64_t durable_seq; // Newest request written and synced
+    volatile int64_t pending[TABLE_COUNT]; // Queued lines per file that are not written yet
+    int64_t queued_size[TABLE_COUNT]; // File size once those lines are written (front desk only)
+    TextBuffer batch;         // Lines of one file collected for one write (writer thread)
+    volatile int64_t batches; // Batches written
+    volatile int64_t bytes_written;
+    volatile int64_t acked[TABLE_COUNT];  // Durable acknowledgements per file
+    volatile int64_t failed[TABLE_COUNT]; // Lines that could not be written
+    int64_t failures_reported[TABLE_COUNT]; // Failures already shown to the user
+    volatile int64_t failed_batches[TABLE_COUNT]; // Batches of a file that could not be written (writer thread)
+    int64_t failures_handled[TABLE_COUNT]; // Failed batches already recovered from (front desk only)
+    double sync_seconds;      // Time spent writing and syncing
+    double ack_seconds;       // Sum of queue-to-disk times
+    double ack_seconds_max;
+    int64_t stalls;           // Times the front desk waited for a free slot
+    double stall_seconds;
+    WorkerLock lock;          // Only for sleeping on the two signals below
+    WorkerSignal queued;      // Woken when a request is added (the writer thread sleeps on it)
+    WorkerSignal written;     // Woken when a batch is done (readers, flush and a full ring sleep on it)
+    WorkerStart writer;       // The writer thread
+} Persistence;
+
+// EventType: what happened to a patient (stored as one byte in the event log)
+typedef enum
+{
+    EVENT_ADMIT = 1,          // Admitted to hospital_id
+    EVENT_DISCHARGE,          // Left hospital_id
+    EVENT_TRANSFER            // Moved from hospital_id to to_hospital_id
+} EventType;
+
+// PatientEvent structure: one decoded entry of the event log
+typedef struct
+{
+    int64_t time;             // Seconds since 1970 (time())
+    EventType type;
+    int patient_id;
+    int hospital_id;
+    int to_hospital_id;       // Transfers only
+} PatientEvent;
+
+// EventZone structure: zone map of one segment, used to skip segments a query cannot match
+typedef struct
+{
+    int count;                // Events in the segment
+    int64_t bytes;            // Segment file size this summary was made from
+    int64_t min_time, max_time;
+    int min_hospital, max_hospital; // Includes the target hospitals of transfers
+    int64_t net_census;       // Admissions minus discharges in the segment
+} EventZone;
+
+// EventLog structure: the segment summaries and the open newest segment
+typedef struct
+{
+    int loaded;               // 1 once event_log_open() has run
+    EventZone *zones;         // One summary per segment
+    int segment_count;
+    int capacity;
+    int64_t last_time;        // Previous event of the newest segment (delta base)
+    int last_patient;
+    FILE *active;             // Newest segment, opened for appending
+    int torn;                 // 1 if a failed append could not be cut off (next event starts a new segment)
+    IntMap location;          // Patient ID -> current hospital (0 = discharged)
+    int locations_ready;      // 1 once location has been built from the log
+} EventLog;
+
+// HospitalEdit: a change applied to one hospital record by update_hospital_record()
+typedef void (*HospitalEdit)(Hospital *h, int value);
+
 // ===== FUNCTION PROTOTYPES =====
 // These are declarations that tell the compiler about functions we'll define later
 // Format: returnType functionName(parameters);
@@ -72,8 +937,11 @@ typedef struct
 void clear_input_buffer();                    // Clears leftover characters from input
 void clear_screen();                         // Clears the terminal/console screen
 void print_welcome_banner();                  // Displays welcome message
+int replace_file(const char *temp_name, const char *filename); // Atomically puts a rewritten file in place
+int sync_file(FILE *fp);                     // Flushes a file all the way to the disk
+int truncate_file(FILE *fp, int64_t size);   // Cuts a file back to size bytes
 int count_records(const char *filename);     // Counts total records in a file
-void load_hospitals(Hospital *hospitals, int *n);  // Reads all hospitals from file into memory
+void load_hospitals(Hospital *hospitals, HospitalText *text, int *n);  // Reads all hospitals from file into memory
 void load_patients(Patient *patients, int *n);     // Reads all patients from file into memory
 char *get_hospital_name_by_id(int hospital_id); // Finds hospital name using its ID
 void signup();                              // Handles new user registration
@@ -84,16 +952,215 @@ void display_hospitals_by_city();              // Filters and shows hospitals by
 void sort_hospitals_by_bed_price();             // Sorts hospitals by price
 void sort_hospitals_by_available_beds();        // Sorts hospitals by available beds
 void sort_hospitals_by_name();                 // Sorts hospitals alphabetically
-void sort_hospitals_by_rating_and_reviews();     // Sorts hospitals by rating
+void rank_hospitals_by_quality();             // Lists hospitals by their stored quality score
+void rate_hospital();                          // Adds a star rating to a hospital
+void find_nearest_hospitals();                 // Closest hospitals with free beds
+void update_available_beds();                  // Changes the free beds of a hospital
+void save_patient(const Patient *p, DurableAck *ack); // Appends a patient to the file and the indexes
+void add_to_waiting_queue();                   // Queues a patient for batch admission
+void assign_waiting_patients();                // Places the waiting queue in hospitals
+int schedule_admissions(Hospital *hot, const HospitalText *text, int hospital_count,
+                        const WaitingPatient *queue, int waiting_count, int *assigned_row); // Greedy bed assignment
+int update_hospital_record(int hospital_id, HospitalEdit edit, int value, Hospital *h, HospitalText *t); // Rewrites one hospital line
+void format_hospital_line(char *line, int size, const Hospital *h, const HospitalText *t); // Formats one hospitals.txt line
+void write_hospital_line(FILE *fp, const Hospital *h, const HospitalText *t); // Writes one hospitals.txt line
+void ranking_settings();                       // Changes the priors of the quality score
 void add_patient();                          // Adds new patient to file
 void display_patients();                     // Shows all patients on screen
 void press_any_key_to_continue(void);
+void run_layout_benchmark();                 // Compares the hot/cold layout with the original one
+void registry_init(IdRegistry *r, uint32_t capacity);   // Allocates an empty ID registry
+void registry_free(IdRegistry *r);                      // Releases registry memory
+int registry_contains(const IdRegistry *r, int id);     // Returns 1 if the ID is already used
+int registry_insert(IdRegistry *r, int id);             // Adds an ID, returns 0 if it was a duplicate
+int registry_load_file(IdRegistry *r, const char *filename, const char *label); // Bulk loads IDs from a file
+IdRegistry *hospital_id_registry();                     // Registry of hospital IDs (loaded on first use)
+IdRegistry *patient_id_registry();                      // Registry of patient IDs (loaded on first use)
+void forget_id_registry(DataTable table);               // Reloads a registry from its file on next use
+void *arena_alloc(Arena *a, size_t bytes);              // Allocates temporary memory from an arena
+void arena_reset(Arena *a);                             // Makes all arena memory reusable again
+StrRef intern_string(const char *text);                 // Stores a string once and returns its offset
+StrRef find_interned_string(const char *text);          // Looks up a string without adding it (0 if missing)
+const char *str_of(StrRef ref);                         // Returns the text stored at an offset
+void intmap_init(IntMap *m, uint32_t capacity);         // Allocates an empty integer hash map
+void intmap_free(IntMap *m);                            // Releases integer hash map memory
+int intmap_get(const IntMap *m, int key, int *value);   // Looks up a key, returns 1 if found
+void intmap_put(IntMap *m, int key, int value);         // Adds or replaces a key
+uint32_t dictionary_encode(Dictionary *d, StrRef value); // Returns the code of a string, adding it if new
+StrRef dictionary_value(const Dictionary *d, uint32_t code); // Returns the string for a code
+const char *disease_name(uint32_t code);                // Text of a disease code
+void patient_analytics();                               // Group-by reports over the patient file
+void render_table(void (*header)(void), RowRenderer row, const void *table, int count); // Prints a table (pages it on a console)
+void render_hospital_table(const Hospital *hot, const HospitalText *text, const int *order, int count); // Prints hospital rows
+void render_scored_hospital_table(const Hospital *hot, const HospitalText *text, const int *order, const float *score, int count); // Hospital rows with a score column
+void render_patient_table(const Patient *patients, int count); // Prints patient rows
+double now_seconds();                                   // High resolution timestamp in seconds
+uint64_t stats_start();                                 // Starts timing an operation
+void stats_record(int operation, uint64_t started);     // Stops timing and adds it to the histogram
+FILE *stats_fopen(const char *filename, const char *mode); // fopen that counts file opens
+char *read_line(char *line, int size, FILE *fp);        // fgets that counts bytes read
+void *stats_malloc(size_t bytes);                       // malloc that counts allocations
+void *stats_calloc(size_t count, size_t bytes);         // calloc that counts allocations
+void *stats_realloc(void *ptr, size_t bytes);           // realloc that counts allocations
+void show_stats();                                      // Prints the statistics table
+void dump_stats();                                      // Writes the statistics to STATS_FILE
+int btree_search(BPlusTree *t, int64_t key, int64_t *value); // Point lookup in a B+ tree index
+void btree_seek(BPlusTree *t, int64_t key, IndexCursor *cursor); // Starts a range scan at the first key >= key
+int btree_next(IndexCursor *cursor, int64_t *key, int64_t *value); // Returns the next entry of a range scan
+int btree_insert(BPlusTree *t, int64_t key, int64_t value); // Adds a key to a B+ tree index
+int btree_build(BPlusTree *t, IndexEntry *entries, int64_t count, int64_t source_size); // Bulk builds an index file
+int btree_open(BPlusTree *t, const char *filename, int64_t source_size); // Opens an index if it is current
+int64_t hospital_patient_key(int hospital_id, int patient_id); // Key of the hospital secondary index
+int open_patient_indexes();                             // Opens (or rebuilds) the patient indexes
+void invalidate_patient_indexes();                      // Forces a rebuild of the patient indexes on the next use
+void index_patient(const Patient *p, int64_t offset, int64_t new_size); // Adds a new patient to the indexes
+int read_patient_at(int64_t offset, Patient *p);        // Reads one patient line by file offset
+void find_patient_by_id();                              // Point lookup by patient ID
+void display_patients_by_id_range();                    // Range scan by patient ID
+void display_patients_by_hospital();                    // All patients of one hospital
+NameIndex *hospital_name_index();                       // Search index over hospital names (built on first use)
+NameIndex *patient_name_index();                        // Search index over patient names (built on first use)
+void name_index_reset(NameIndex *index);                // Empties a name index so it is built again
+void name_index_add(NameIndex *index, int id, const char *name, StrRef detail); // Adds a new name to an index
+int search_name_index(NameIndex *index, const char *query, int allow_typos, SearchResult *results, int limit); // Ranked name search
+void search_hospitals_by_name();                        // Search screen for hospital names
+void search_patients_by_name();                         // Search screen for patient names
+void load_ranking_settings(RankingSettings *s);         // Reads the quality score settings
+float stored_rating(float rating);                      // Rating rounded the way the file stores it
+float quality_score(const Hospital *h, const RankingSettings *s); // Bayesian quality score of one hospital
+void refresh_ranking(const Hospital *hot, int count);   // Computes the ranking if it is out of date
+void ranking_add(const Hospital *h, int64_t old_size, int64_t new_size); // Ranks a newly added hospital
+void ranking_update(int row, const Hospital *h, int64_t old_size, int64_t new_size); // Re-ranks a changed hospital
+SpatialIndex *spatial_index();                          // k-d tree of hospital locations (built on first use)
+void spatial_add(const Hospital *h, const HospitalText *t, int64_t old_size, int64_t new_size); // Adds a new hospital to the tree
+void spatial_update_beds(int hospital_id, int available_beds, int64_t old_size, int64_t new_size); // Updates free beds in the tree
+int nearest_with_free_beds(SpatialIndex *s, double latitude, double longitude, int k, NearestResult *best); // k nearest with free beds
+int parse_hospital_line(char *line, Hospital *h, HospitalText *t); // Parses one hospitals.txt line in place
+int parse_patient_line(char *line, Patient *p);         // Parses one patients.txt line in place
+void format_patient_line(char *line, int size, const Patient *p); // Formats one patients.txt line
+int parse_user_line(char *line, User *u);               // Parses one users.txt line in place
+void format_user_line(char *line, int size, const User *u); // Formats one users.txt line
+void run_parallel(void (*task)(void *), void *args, size_t arg_size, int count); // Runs tasks in worker threads
+int shard_of_city(const char *city);                    // City shard a city belongs to
+void shard_filename(int shard, char *filename, int size); // File name of a city shard
+int hospital_shards_ready();                            // 1 if city shards are on (rebuilt if stale)
+void shard_add_hospital(const Hospital *h, const HospitalText *t, int64_t old_size, int64_t new_size); // Appends a new hospital to its shard
+void load_hospital_shard(int shard, Hospital *hospitals, HospitalText *text, int *n); // Reads one city shard
+int load_sorted_hospital_shards(Hospital **hot, HospitalText **text, int **order, int (*compare)(const void *, const void *)); // Parallel sort + merge of all shards
+void invalidate_hospital_shards();                      // Marks the city shards out of date after a rewrite
+void toggle_hospital_shards();                          // Switches the city shards on or off
+void lock_init(WorkerLock *lock);                       // Prepares a mutex
+void lock_acquire(WorkerLock *lock);                    // Takes a mutex
+void lock_release(WorkerLock *lock);                    // Gives a mutex back
+void signal_init(WorkerSignal *signal);                 // Prepares a condition variable
+void signal_wait(WorkerSignal *signal, WorkerLock *lock); // Sleeps until woken (lock held, released while asleep)
+void signal_wake_all(WorkerSignal *signal);             // Wakes every thread sleeping on a condition variable
+int start_worker(WorkerStart *start);                   // Starts a thread that runs until exit
+int64_t wall_clock_ms();                                // Wall clock time in milliseconds
+void replication_lock();                                // Taken around changes of the data files
+void replication_unlock();                              // Ends a change of the data files
+void replication_resync();                              // Makes every replica reload a snapshot
+void replication_append_hospital(const Hospital *h, const HospitalText *t); // Logs a new hospital
+void replication_update_hospital(int row, const Hospital *h, const HospitalText *t); // Logs a rewritten hospital
+void replication_append_patient(const Patient *p);     // Logs a new patient
+int start_replication_primary(int port);                // Starts shipping the log to read replicas
+void replication_status();                              // Shows the replicas and their lag
+char *replica_hospital_name(int hospital_id);           // Hospital name from the replica tables
+void run_replica(int port);                             // Read-only menu of a replica process
+int external_sort(SortOrder order, size_t budget, SortEmit emit, void *context, ExternalSortResult *result); // Sorts a data file within budget bytes
+int external_sort_needed(const char *filename);         // 1 if a file is too big to sort in memory
+void stream_sorted_hospitals(SortOrder order, const char *title); // Sorted listing through the external sort
+void external_sort_to_file();                           // Writes a sorted copy of a data file
+void bump_table_version(DataTable table);               // Marks a table as changed for the view cache
+CachedView *view_cache_find(ViewKind kind, StrRef city); // Cached result of a query (NULL = miss)
+CachedView *view_cache_store_hospitals(ViewKind kind, StrRef city, const Hospital *hot,
+                                       const HospitalText *text, const int *order, const float *score, int count); // Caches a hospital listing
+void view_cache_invalidate(ViewKind kind);              // Drops the cached results of one listing
+CachedView *view_cache_store_patients(const Patient *patients, const StrRef *hospital_names, int count); // Caches the patient listing
+ViewKind sorted_view_kind(int (*compare)(const void *, const void *)); // View of a sorted listing (VIEW_COUNT = none)
+void resolve_hospital_names(const Patient *patients, int count, StrRef *names); // Hospital name of every patient in one pass
+void render_named_patient_table(const Patient *patients, const StrRef *hospital_names, int count); // Patient rows with known hospital names
+void start_persistence();                               // Starts the background writer thread
+int64_t persist_append(DataTable table, const char *line, PersistCallback done, void *context); // Queues a line for a data file
+int64_t persist_queued_size(const char *filename);      // File size including queued lines (-1 if none queued)
+void persist_wait_for_file(const char *filename);       // Waits until a file's queued lines are written
+void persist_flush();                                   // Waits until every queued line is on the disk
+void count_durable_write(int64_t seq, int ok, void *context); // Durable acknowledgement of a data file line
+void ack_durable_write(int64_t seq, int ok, void *context); // Durable acknowledgement someone waits for
+int persist_wait_ack(DurableAck *ack);                  // Waits for one line's acknowledgement (1 = on the disk)
+void persistence_warnings();                            // Reports lines that could not be written
+void persist_recover_failures();                        // Resets offsets and indexes after a failed write
+void persistence_status();                              // Shows the persistence queue and its counters
+void event_log_open();                                  // Loads the event log's segment summaries
+int event_log_append(const PatientEvent *e);            // Appends one event to the event log
+int log_patient_event(EventType type, int patient_id, int hospital_id, int to_hospital_id); // Logs an event that happens now
+int patient_location(int patient_id);                   // Hospital a patient is in now (0 = discharged)
+void record_discharge_or_transfer();                    // Logs a discharge or a transfer
+void admission_history();                               // Lists events in a time range
+void daily_census();                                    // Daily census and throughput report
+
+// ===== GLOBAL MEMORY =====
+// query_arena holds the temporary arrays built by one listing/sort/filter,
+// string_pool holds every name, city and disease text read from the files
+Arena query_arena;
+StringPool string_pool;
+
+// disease_dictionary gives every distinct disease/condition text a dense code
+Dictionary disease_dictionary;
+
+// stats collects operation timings and I/O counters (see the STATISTICS section)
+Stats stats;
+
+// Name search indexes (see NAME SEARCH), empty until the first search
+NameIndex hospital_names;
+NameIndex patient_names;
+
+// Materialised quality ranking of the hospitals (see QUALITY RANKING)
+Ranking hospital_ranking;
+
+// k-d tree of hospital locations (see NEAREST HOSPITALS), empty until the first query
+SpatialIndex hospital_locations;
+
+// Log shipping to read replicas (see READ REPLICAS): the primary side, and the
+// tables of this process when it runs as a replica
+ReplicationPrimary replication;
+ReplicaStore replica;
+
+// Memory one sort may use; bigger files are sorted on disk (see EXTERNAL SORT)
+size_t sort_memory_budget = (size_t)SORT_MEMORY_BUDGET_MB * 1024 * 1024;
+
+// Cached listing results and table versions (see VIEW CACHE)
+ViewCache view_cache;
+
+// Queue of lines for the background writer thread (see BACKGROUND PERSISTENCE)
+Persistence persistence;
+
+// Segment summaries of the admission event log (see ADMISSION EVENT LOG)
+EventLog event_log;
 
 // ===== MAIN PROGRAM =====
 // The main() function is where the program starts executing
-int main()
+int main(int argc, char *argv[])
 {
     int choice;  // Variable to store user's menu choice
+    int primary_port = 0, replica_port = 0;  // Set by --primary [port] / --replica [port]
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--sort-memory") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            sort_memory_budget = (size_t)atoi(argv[++i]) * 1024 * 1024;  // Megabytes
+            continue;
+        }
+        int *port = strcmp(argv[i], "--primary") == 0 ? &primary_port :
+                    strcmp(argv[i], "--replica") == 0 ? &replica_port : NULL;
+        if (!port)
+            continue;
+        *port = REPLICATION_PORT;
+        if (i + 1 < argc && atoi(argv[i + 1]) > 0)  // Optional port number
+            *port = atoi(argv[++i]);
+    }
+    stats.started_at = stats.last_dump = now_seconds();  // Start the statistics clock
+    start_persistence();  // New hospital and patient lines are written by a background thread
     // Clear the screen and show welcome banner at program start
     clear_screen();
     print_welcome_banner();
@@ -129,6 +1196,7 @@ int main()
         } else if (auth == 3) {
             printf(YELLOW "Exiting...\n" RESET);
             printf(GREEN "Thank you for using the Hospital Management System!\n" RESET);
+            dump_stats();  // Save final statistics
             exit(0);  // Terminate the program
             break;  // Exit program
         } else {
@@ -141,20 +1209,38 @@ int main()
         }
     }
 
+    // Start shipping changes to read replicas
+    if (primary_port)
+    {
+        if (start_replication_primary(primary_port))
+            printf(GREEN "Read replicas can connect on port %d (start them with --replica %d).\n" RESET, primary_port, primary_port);
+        else
+            printf(RED "Could not listen on port %d, running without read replicas.\n" RESET, primary_port);
+    }
+
     press_any_key_to_continue();
 
+    // A replica only serves the read-only reports
+    if (replica_port)
+    {
+        run_replica(replica_port);
+        return 0;
+    }
+
     // Main menu loop - continues until user chooses to exit
     while (1)
     {
         // clear_input_buffer();
         clear_screen();
         print_welcome_banner();
+        persistence_warnings();  // Lines the background writer could not save
         printf(MAGENTA BOLD "\n--- Main Menu ---\n" RESET);
         printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
         printf(YELLOW "1. Hospital Management\n");
         printf("2. Patient Management\n");
         printf("3. Sorting Features\n");
-        printf("4. Exit\n" RESET);
+        printf("4. System Tools\n");
+        printf("5. Exit\n" RESET);
         printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
         printf(GREEN "Enter your choice: " RESET);
         
@@ -163,7 +1249,7 @@ int main()
         {
             printf(RED "Invalid input!\n" RESET);
             clear_input_buffer();  // Clear invalid input
-            printf("Enter the valid option(1, 2, 3, or 4): ");
+            printf("Enter the valid option(1, 2, 3, 4, or 5): ");
         }
         clear_input_buffer();  // Clear newline from input buffer
 
@@ -180,7 +1266,11 @@ int main()
             printf(YELLOW "1. Add Hospital Data\n");
             printf("2. Display Hospital Data\n");
             printf("3. Display Hospitals by City\n");
-            printf("4. Return to the main menu\n" RESET);
+            printf("4. Search Hospitals by Name\n");
+            printf("5. Rate a Hospital\n");
+            printf("6. Nearest Hospitals with Free Beds\n");
+            printf("7. Update Available Beds\n");
+            printf("8. Return to the main menu\n" RESET);
              printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
             printf(GREEN "Enter your choice: " RESET);
             
@@ -189,7 +1279,7 @@ int main()
             {
                 printf(RED "Invalid input!\n" RESET);
                 clear_input_buffer();
-                printf(GREEN "Enter the valid option(1, 2, 3 or 4): " RESET);
+                printf(GREEN "Enter the valid option(1 to 8): " RESET);
             }
             clear_input_buffer();
             
@@ -209,6 +1299,18 @@ int main()
                 display_hospitals_by_city();  // Show hospitals in specific city
                 break;
             case 4:
+                search_hospitals_by_name();  // Prefix/substring search over names
+                break;
+            case 5:
+                rate_hospital();  // Add a star rating and re-rank the hospital
+                break;
+            case 6:
+                find_nearest_hospitals();  // k-d tree search around a location
+                break;
+            case 7:
+                update_available_beds();  // Change free beds in the file and the indexes
+                break;
+            case 8:
                 continue;
                 break;
             default:
@@ -225,7 +1327,17 @@ int main()
             printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
             printf(YELLOW "1. Add Patient Data\n");
             printf("2. Display Patient Data\n");
-            printf("3. Return to the main menu\n" RESET);
+            printf("3. Patient Analytics\n");
+            printf("4. Find Patient by ID\n");
+            printf("5. Display Patients by ID Range\n");
+            printf("6. Display Patients in a Hospital\n");
+            printf("7. Search Patients by Name\n");
+            printf("8. Add Patient to Waiting Queue\n");
+            printf("9. Assign Waiting Patients to Hospitals\n");
+            printf("10. Record Discharge or Transfer\n");
+            printf("11. Admission History (time range)\n");
+            printf("12. Daily Census & Throughput\n");
+            printf("13. Return to the main menu\n" RESET);
             printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
             printf(GREEN "Enter your choice: " RESET);
             
@@ -234,7 +1346,7 @@ int main()
             {
                 printf(RED "Invalid input!\n" RESET);
                 clear_input_buffer();
-                printf("Enter the valid option(1, 2, or 3): ");
+                printf("Enter the valid option(1 to 13): ");
             }
             clear_input_buffer();
             
@@ -251,6 +1363,36 @@ int main()
                 display_patients();  // Show all patients
                 break;
             case 3:
+                patient_analytics();  // Counts per disease, hospital, age group and city
+                break;
+            case 4:
+                find_patient_by_id();  // Point lookup through the primary index
+                break;
+            case 5:
+                display_patients_by_id_range();  // Range scan through the primary index
+                break;
+            case 6:
+                display_patients_by_hospital();  // Range scan through the hospital index
+                break;
+            case 7:
+                search_patients_by_name();  // Prefix/substring search over names
+                break;
+            case 8:
+                add_to_waiting_queue();  // Queue a patient for the next batch
+                break;
+            case 9:
+                assign_waiting_patients();  // Place the whole queue at once
+                break;
+            case 10:
+                record_discharge_or_transfer();  // Patient leaves or changes hospital
+                break;
+            case 11:
+                admission_history();  // Events in a time range (segments skipped by zone maps)
+                break;
+            case 12:
+                daily_census();  // Patients in hospital per day
+                break;
+            case 13:
                 continue;
                 break;
             default:
@@ -268,8 +1410,10 @@ int main()
             printf(YELLOW "1. Sort by Bed Price\n");
             printf("2. Sort by Available Beds\n");
             printf("3. Sort by Hospital Name\n");
-            printf("4. Sort by Rating and Reviews\n");
-            printf("5. Return to the main menu\n" RESET);
+            printf("4. Rank by Quality Score (rating weighted by reviews)\n");
+            printf("5. Quality Score Settings\n");
+            printf("6. External Sort to File (fixed memory budget)\n");
+            printf("7. Return to the main menu\n" RESET);
             printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
             printf(GREEN "Enter your choice: " RESET);
             
@@ -278,7 +1422,7 @@ int main()
             {
                 printf(RED "Invalid input!\n" RESET);
                 clear_input_buffer();
-                printf("Enter the valid option(1, 2, 3, or 4): ");
+                printf("Enter the valid option(1 to 7): ");
             }
             clear_input_buffer();
             
@@ -298,9 +1442,15 @@ int main()
                 sort_hospitals_by_name();  // Sort alphabetically by name
                 break;
             case 4:
-                sort_hospitals_by_rating_and_reviews();  // Sort by rating and reviews
+                rank_hospitals_by_quality();  // Read the stored quality ranking
                 break;
             case 5:
+                ranking_settings();  // Change the priors of the quality score
+                break;
+            case 6:
+                external_sort_to_file();  // Sort a whole data file on disk
+                break;
+            case 7:
                 continue;
                 break;
             default:
@@ -308,24 +1458,81 @@ int main()
             }
             break;
         }
-        case 4:  // Exit option
-            printf(GREEN "Thank you for using the Hospital Management System!\n" RESET);
+        case 4:  // System Tools submenu
+        {
+            int tools_choice;  // Variable for tools submenu choice
+            clear_screen();
+            print_welcome_banner();
+            printf(MAGENTA BOLD "\n--- System Tools ---\n" RESET);
             printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
-            printf(YELLOW "Exiting...\n" RESET);
+            printf(YELLOW "1. Record Layout Benchmark\n");
+            printf("2. Performance Statistics\n");
+            printf("3. Partition Hospital Data by City (on/off)\n");
+            printf("4. Replication Status\n");
+            printf("5. Background Persistence Status\n");
+            printf("6. Return to the main menu\n" RESET);
             printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
-            exit(0);  // Terminate the program
-        default:
-            printf(RED "Invalid choice! Try again.\n" RESET);
-        }
-    
-        // printf(GREEN "\nPress Enter to continue..." RESET);
-        // getchar();  // Wait for user to press Enter
-        press_any_key_to_continue();   
-    }
-
-    return 0;  // Program ends successfully
-}
-
+            printf(GREEN "Enter your choice: " RESET);
+            
+            // Read tools submenu choice with error checking
+            while (scanf("%d", &tools_choice) != 1)
+            {
+                printf(RED "Invalid input!\n" RESET);
+                clear_input_buffer();
+                printf("Enter the valid option(1 to 6): ");
+            }
+            clear_input_buffer();
+            
+            clear_screen();
+            print_welcome_banner();
+            
+            // Execute tool based on submenu choice
+            switch (tools_choice)
+            {
+            case 1:
+                run_layout_benchmark();  // Compare hot/cold layout with the original layout
+                break;
+            case 2:
+                show_stats();  // Show latency histograms and I/O counters
+                break;
+            case 3:
+                toggle_hospital_shards();  // Split hospitals.txt into city shards, or stop using them
+                break;
+            case 4:
+                replication_status();  // Connected read replicas and their lag
+                break;
+            case 5:
+                persistence_status();  // Queue depth and durable acknowledgements
+                break;
+            case 6:
+                continue;
+                break;
+            default:
+                printf(RED "Invalid choice! Try again.\n" RESET);
+            }
+            break;
+        }
+        case 5:  // Exit option
+            printf(GREEN "Thank you for using the Hospital Management System!\n" RESET);
+            printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+            printf(YELLOW "Exiting...\n" RESET);
+            printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+            persist_flush();  // Every queued line must be on the disk before the program ends
+            persistence_warnings();
+            dump_stats();  // Save final statistics
+            exit(0);  // Terminate the program
+        default:
+            printf(RED "Invalid choice! Try again.\n" RESET);
+        }
+    
+        // printf(GREEN "\nPress Enter to continue..." RESET);
+        // getchar();  // Wait for user to press Enter
+        press_any_key_to_continue();   
+    }
+
+    return 0;  // Program ends successfully
+}
+
 void press_any_key_to_continue(void)
 {
     printf(GREEN "\nPress any key to continue..." RESET);
@@ -341,7 +1548,7 @@ void signup()
     User u;  // Create a User variable to store signup information
     
     // Open the users file in "append" mode (a+) to add new users without deleting existing ones a+ means to open the file in both mode i.e read and write
-    FILE *fp = fopen(USER_FILE, "a+");
+    FILE *fp = stats_fopen(USER_FILE, "a+");
     if (!fp)  // Check if file opened successfully
     {
         printf(RED "Error opening users file\n" RESET);
@@ -355,12 +1562,12 @@ void signup()
 
     // Check if username already exists in file
     char line[LINE_SIZE];  // Buffer to store each line from file
-    while (fgets(line, LINE_SIZE, fp))  // Loop through each line in file
+    while (read_line(line, LINE_SIZE, fp))  // Loop through each line in file
     {
-        char existing_user[USERNAME_SIZE];  // Buffer for existing username
-        // %*s means Assignment suppression it means read the input but not store it anywhere
-        sscanf(line, "%[^|]|%*s", existing_user);  // Extract username from line (before |)
-        if (strcmp(existing_user, u.username) == 0)  // Compare with entered username
+        User existing;  // Account stored on this line
+        if (!parse_user_line(line, &existing))
+            continue;  // Skip blank or malformed lines
+        if (strcmp(existing.username, u.username) == 0)  // Compare with entered username
         {
             printf(RED "Username already exists!\n" RESET);
             printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
@@ -375,7 +1582,8 @@ void signup()
     u.password[strcspn(u.password, "\n")] = 0;  // Remove newline character from end
 
     // Write the new username and password to file in format: username|password
-    fprintf(fp, "%s|%s\n", u.username, u.password);
+    format_user_line(line, LINE_SIZE, &u);
+    fputs(line, fp);
     fclose(fp);  // Close the file
     printf(GREEN BOLD "Sign-up successful! You can now login.\n" RESET);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
@@ -388,7 +1596,7 @@ int login()
     char username[USERNAME_SIZE], password[PASSWORD_SIZE];  // Variables to store entered credentials
     
     // Open the users file in read mode to check credentials
-    FILE *fp = fopen(USER_FILE, "r");
+    FILE *fp = stats_fopen(USER_FILE, "r");
     if (!fp)  // Check if file opened successfully
     {
         printf(RED "Error opening users file\n" RESET);
@@ -407,17 +1615,19 @@ int login()
     password[strcspn(password, "\n")] = 0;  // Remove newline character
 
     // Loop through each line in file to find matching credentials
+    uint64_t started = stats_start();  // Time the credential check
     char line[LINE_SIZE];  // Buffer for each line from file
-    while (fgets(line, LINE_SIZE, fp))  // Read line by line
+    while (read_line(line, LINE_SIZE, fp))  // Read line by line
     {
-        char file_user[USERNAME_SIZE], file_pass[PASSWORD_SIZE];  // Variables to store file credentials
-        // %[^|]| is called negated scanset
-        sscanf(line, "%[^|]|%s", file_user, file_pass);  // Extract username and password from line
+        User stored;  // Credentials stored on this line
+        if (!parse_user_line(line, &stored))
+            continue;  // Skip blank or malformed lines
         
         // Check if entered credentials match file credentials
-        if (strcmp(file_user, username) == 0 && strcmp(file_pass, password) == 0)
+        if (strcmp(stored.username, username) == 0 && strcmp(stored.password, password) == 0)
         {
             fclose(fp);  // Close file
+            stats_record(OP_LOGIN, started);
             printf(GREEN BOLD "Login successful!\n" RESET);
             return 1;  // Return 1 (login successful)
         }
@@ -425,6 +1635,7 @@ int login()
 
     // If we reach here, no matching credentials were found
     fclose(fp);  // Close file
+    stats_record(OP_LOGIN, started);
     printf(RED "Invalid username or password!\n" RESET);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
     return 0;  // Return 0 (login failed)
@@ -454,6 +1665,44 @@ void clear_screen()
 #endif
 }
 
+// replace_file() - Puts a finished temporary file in place of filename in one step
+// There is never a moment without filename: readers see either the old or the new file.
+// On failure both files are left alone. Returns 1 on success.
+int replace_file(const char *temp_name, const char *filename)
+{
+#ifdef _WIN32
+    // rename() on Windows refuses to overwrite, MoveFileEx can replace the file directly
+    return MoveFileExA(temp_name, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(temp_name, filename) == 0;  // POSIX rename() replaces atomically
+#endif
+}
+
+// sync_file() - Flushes the C buffer and then the system cache of a file to the disk
+// Returns 1 once the data is stored
+int sync_file(FILE *fp)
+{
+    if (fflush(fp) != 0)
+        return 0;
+#ifdef _WIN32
+    return _commit(_fileno(fp)) == 0;  // FlushFileBuffers on the file handle
+#else
+    return fsync(fileno(fp)) == 0;
+#endif
+}
+
+// truncate_file() - Cuts a file back to size bytes (drops a half-written append)
+// Returns 1 on success
+int truncate_file(FILE *fp, int64_t size)
+{
+    fflush(fp);  // Whatever is still buffered would land after the cut
+#ifdef _WIN32
+    return _chsize_s(_fileno(fp), size) == 0;
+#else
+    return ftruncate(fileno(fp), (off_t)size) == 0;
+#endif
+}
+
 // print_welcome_banner() - Displays a decorative welcome message at top of screen
 void print_welcome_banner()
 {
@@ -469,23 +1718,29 @@ void print_welcome_banner()
 void add_hospital()
 {
     Hospital h;  // Create a Hospital variable to store new hospital data
-    
-    // Open hospital file in append mode (a) to add new data
-    FILE *fp = fopen(HOSPITAL_FILE, "a");
-    if (!fp)  // Check if file opened successfully
-    {
-        printf(RED "Error opening hospital file\n" RESET);
-        return;  // Exit function if file can't be opened
-    }
+    HospitalText t;  // Display text of the new hospital
+    char name[NAME_SIZE], city[CITY_SIZE];  // Buffers for the text typed by the user
 
     printf("\n\nPlease enter the following details to add a new hospital:\n");
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
 
     // Get Hospital ID from user
+    IdRegistry *ids = hospital_id_registry();  // Registry of IDs already in use
     printf(GREEN "Enter Hospital ID: " RESET);
-    while (scanf("%d", &h.hospital_id) != 1)  // Check if valid integer was entered
+    while (1)
     {
-        printf(RED "Invalid input!\n" RESET);
+        if (scanf("%d", &h.hospital_id) != 1)  // Check if valid integer was entered
+        {
+            printf(RED "Invalid input!\n" RESET);
+        }
+        else if (registry_contains(ids, h.hospital_id))  // Check if ID is already taken
+        {
+            printf(RED "Hospital ID %d already exists! Please enter a unique ID.\n" RESET, h.hospital_id);
+        }
+        else
+        {
+            break;  // Valid and unique ID
+        }
         clear_input_buffer();  // Clear invalid input
         printf(GREEN "Enter Hospital ID: " RESET);
     }
@@ -493,13 +1748,15 @@ void add_hospital()
 
     // Get Hospital Name from user
     printf(GREEN "Enter Hospital Name: " RESET);
-    fgets(h.hospital_name, NAME_SIZE, stdin);  // Read hospital name
-    h.hospital_name[strcspn(h.hospital_name, "\n")] = 0;  // Remove newline
+    fgets(name, NAME_SIZE, stdin);  // Read hospital name
+    name[strcspn(name, "\n")] = 0;  // Remove newline
+    t.hospital_name = intern_string(name);
 
     // Get City from user
     printf(GREEN "Enter City: " RESET);
-    fgets(h.city, CITY_SIZE, stdin);  // Read city name
-    h.city[strcspn(h.city, "\n")] = 0;  // Remove newline
+    fgets(city, CITY_SIZE, stdin);  // Read city name
+    city[strcspn(city, "\n")] = 0;  // Remove newline
+    h.city = intern_string(city);
 
     // Get Number of Available Beds from user
     printf(GREEN "Enter Number of Available Beds: " RESET);
@@ -541,19 +1798,114 @@ void add_hospital()
     }
     clear_input_buffer();
 
-    // Write hospital data to file in pipe-separated format: id|name|city|beds|price|rating|reviews
-    fprintf(fp, "%d|%s|%s|%d|%.2f|%.1f|%d\n",
-            h.hospital_id, h.hospital_name, h.city, h.available_beds, h.bed_price, h.rating, h.reviews);
-    fclose(fp);  // Close file
+    // Get the optional location (used by the nearest hospital search)
+    char location[LINE_SIZE];
+    t.latitude = NO_LOCATION;
+    t.longitude = 0;
+    while (1)
+    {
+        printf(GREEN "Enter Latitude and Longitude (e.g. 31.5204 74.3587) or leave empty: " RESET);
+        if (!fgets(location, LINE_SIZE, stdin) || location[strspn(location, " \t\r\n")] == '\0')
+            break;  // No location
+        if (sscanf(location, "%f %f", &t.latitude, &t.longitude) == 2 &&
+            t.latitude >= -90 && t.latitude <= 90 && t.longitude >= -180 && t.longitude <= 180)
+            break;
+        printf(RED "Invalid location!\n" RESET);
+        t.latitude = NO_LOCATION;
+    }
+
+    // Hand the line to the background writer in pipe-separated format: id|name|city|beds|price|rating|reviews[|lat|lon]
+    uint64_t started = stats_start();  // Time the insert (the disk write happens in the background)
+    char line[LINE_SIZE];
+    format_hospital_line(line, LINE_SIZE, &h, &t);
+    DurableAck ack = {TABLE_HOSPITALS, 0, 0};
+    replication_lock();  // Read replicas see the new line and its log record together
+    int64_t old_size = persist_append(TABLE_HOSPITALS, line, ack_durable_write, &ack);  // File size before the new line
+    int64_t new_size = old_size + strlen(line);  // File size after the new line
+    replication_append_hospital(&h, &t);  // Ship the new line to read replicas
+    replication_unlock();
+    bump_table_version(TABLE_HOSPITALS);  // Cached hospital views are out of date
+    registry_insert(hospital_id_registry(), h.hospital_id);  // Remember the new ID (ids may have been reloaded since)
+    h.rating = stored_rating(h.rating);  // Rank by the rating as it was saved
+    ranking_add(&h, old_size, new_size);  // Put the new hospital in the quality ranking
+    spatial_add(&h, &t, old_size, new_size);  // Make it findable by location
+    name_index_add(&hospital_names, h.hospital_id, str_of(t.hospital_name), h.city);  // Make the name searchable
+    shard_add_hospital(&h, &t, old_size, new_size);  // Keep the city shards in step
+    stats_record(OP_INSERT, started);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    if (!persist_wait_ack(&ack))  // Only report success once the line is on the disk
+    {
+        printf(RED "Error: the hospital could not be saved to %s!\n" RESET, HOSPITAL_FILE);
+        return;
+    }
     printf(GREEN BOLD "\nHospital added successfully!\n" RESET);
 }
 
+// update_hospital_record() - Changes one hospital in hospitals.txt
+// The file is copied line by line to a temporary file with the changed line, which
+// then replaces the original. Only the first hospital with the ID is changed.
+// Returns the row of the hospital (its position among the parsed lines) and fills
+// h/t with the record as it now reads back from the file, or -1 on failure.
+int update_hospital_record(int hospital_id, HospitalEdit edit, int value, Hospital *h, HospitalText *t)
+{
+    FILE *in = stats_fopen(HOSPITAL_FILE, "r");
+    if (!in)
+        return -1;
+    FILE *out = stats_fopen(HOSPITAL_TEMP_FILE, "w");
+    if (!out)
+    {
+        fclose(in);
+        return -1;
+    }
+
+    char line[LINE_SIZE], copy[LINE_SIZE];
+    int row = 0, found = -1;
+    while (read_line(line, LINE_SIZE, in))
+    {
+        Hospital current;
+        HospitalText current_text;
+        strcpy(copy, line);  // parse_hospital_line() cuts the line into pieces
+        if (!parse_hospital_line(copy, &current, &current_text))
+        {
+            fputs(line, out);  // Keep lines that are not hospitals as they are
+            continue;
+        }
+        if (found < 0 && current.hospital_id == hospital_id)
+        {
+            edit(&current, value);
+            format_hospital_line(line, LINE_SIZE, &current, &current_text);
+            fputs(line, out);
+            parse_hospital_line(line, h, t);  // Values exactly as they read back from the file
+            found = row;
+        }
+        else
+            fputs(line, out);
+        row++;
+    }
+    fclose(in);
+    int write_error = ferror(out);
+    if (fclose(out) != 0 || write_error)  // Disk full: keep the old file
+        found = -1;
+
+    replication_lock();  // A replica snapshot must never see the file half replaced
+    if (found < 0 || !replace_file(HOSPITAL_TEMP_FILE, HOSPITAL_FILE))
+    {
+        replication_unlock();
+        remove(HOSPITAL_TEMP_FILE);  // Leave hospitals.txt unchanged
+        return -1;
+    }
+    replication_update_hospital(found, h, t);  // Ship the changed line to read replicas
+    replication_unlock();
+    bump_table_version(TABLE_HOSPITALS);  // Cached hospital views are out of date
+    invalidate_hospital_shards();  // The line may keep its length, so the size check cannot see it
+    return found;
+}
+
 // count_records() - Counts the number of lines (records) in a file
 // Takes filename as parameter and returns the count
 int count_records(const char *filename)
 {
-    FILE *fp = fopen(filename, "r");  // Open file in read mode
+    FILE *fp = stats_fopen(filename, "r");  // Open file in read mode
     if (!fp){  // If file doesn't exist or can't be opened
         return 0;  // Return 0 records
     }
@@ -562,18 +1914,19 @@ int count_records(const char *filename)
     char line[LINE_SIZE];  // Buffer to read each line
     
     // Loop through file and count each line
-    while (fgets(line, LINE_SIZE, fp))
+    while (read_line(line, LINE_SIZE, fp))
         count++;  // Increment counter for each line
     
     fclose(fp);  // Close file
     return count;  // Return total count
 }
 
-// load_hospitals() - Reads all hospital records from file into an array in memory
-// Parameters: pointer to Hospital array, pointer to variable storing count
-void load_hospitals(Hospital *hospitals, int *n)
+// load_hospitals() - Reads all hospital records from file into arrays in memory
+// Parameters: hot Hospital array, parallel HospitalText array, pointer to variable storing count
+void load_hospitals(Hospital *hospitals, HospitalText *text, int *n)
 {
-    FILE *fp = fopen(HOSPITAL_FILE, "r");  // Open hospital file in read mode
+    uint64_t started = stats_start();  // Time the whole load
+    FILE *fp = stats_fopen(HOSPITAL_FILE, "r");  // Open hospital file in read mode
     if (!fp)  // If file doesn't exist
     {
         *n = 0;  // Set count to 0
@@ -584,18 +1937,16 @@ void load_hospitals(Hospital *hospitals, int *n)
     char line[LINE_SIZE];  // Buffer to read each line
     
     // Loop through each line in file
-    while (fgets(line, LINE_SIZE, fp))
+    while (read_line(line, LINE_SIZE, fp))
     {
         // Extract data from pipe-separated line and store in array
-        sscanf(line, "%d|%[^|]|%[^|]|%d|%f|%f|%d",
-               &hospitals[i].hospital_id, hospitals[i].hospital_name, hospitals[i].city,
-               &hospitals[i].available_beds, &hospitals[i].bed_price,
-               &hospitals[i].rating, &hospitals[i].reviews);
-        i++;  // Move to next array position
+        if (parse_hospital_line(line, &hospitals[i], &text[i]))
+            i++;  // Move to next array position
     }
     
     *n = i;  // Set count to number of records read
     fclose(fp);  // Close file
+    stats_record(OP_LOAD, started);
 }
 
 // get_hospital_name_by_id() - Searches for a hospital by ID and returns its name
@@ -604,8 +1955,11 @@ void load_hospitals(Hospital *hospitals, int *n)
 char *get_hospital_name_by_id(int hospital_id)
 {
     static char name[NAME_SIZE];  // Static variable to store result (persists after function returns)
+    if (replica.active)  // A read replica answers from its own tables
+        return replica_hospital_name(hospital_id);
+    uint64_t started = stats_start();  // Time the lookup
     
-    FILE *fp = fopen(HOSPITAL_FILE, "r");  // Open hospital file in read mode
+    FILE *fp = stats_fopen(HOSPITAL_FILE, "r");  // Open hospital file in read mode
     if (!fp)  // If file can't be opened
     {
         strcpy(name, "Unknown");  // Copy "Unknown" to name
@@ -615,20 +1969,21 @@ char *get_hospital_name_by_id(int hospital_id)
     char line[LINE_SIZE];  // Buffer to read each line
     
     // Loop through each line searching for matching ID
-    while (fgets(line, LINE_SIZE, fp))
+    while (read_line(line, LINE_SIZE, fp))
     {
         Hospital h;  // Temporary Hospital variable
+        HospitalText t;  // Temporary display text
         
         // Extract data from pipe-separated line
-        sscanf(line, "%d|%[^|]|%[^|]|%d|%f|%f|%d",
-               &h.hospital_id, h.hospital_name, h.city,
-               &h.available_beds, &h.bed_price, &h.rating, &h.reviews);
+        if (!parse_hospital_line(line, &h, &t))
+            continue;  // Skip blank or malformed lines
         
         // Check if this is the hospital we're looking for
         if (h.hospital_id == hospital_id)
         {
-            strcpy(name, h.hospital_name);  // Copy hospital name
+            snprintf(name, NAME_SIZE, "%s", str_of(t.hospital_name));  // Copy hospital name
             fclose(fp);  // Close file
+            stats_record(OP_LOOKUP, started);
             return name;  // Return the name
         }
     }
@@ -636,45 +1991,50 @@ char *get_hospital_name_by_id(int hospital_id)
     // If hospital not found
     fclose(fp);  // Close file
     strcpy(name, "Unknown");  // Set name to "Unknown"
+    stats_record(OP_LOOKUP, started);
     return name;  // Return "Unknown"
 }
 
 // display_hospitals() - Reads and displays all hospitals from file
 void display_hospitals()
 {
-    FILE *fp = fopen(HOSPITAL_FILE, "r");  // Open hospital file in read mode
-    if (!fp)  // If file doesn't exist
+    Hospital *hospitals;
+    HospitalText *text;
+    int n;
+    CachedView *view = view_cache_find(VIEW_HOSPITALS, 0);  // Unchanged since the last time?
+    if (view)
     {
-        printf(RED "Error opening hospital file, file not found.\n" RESET);
-        return;  // Exit function
+        hospitals = view->hot;
+        text = view->text;
+        n = view->count;
+    }
+    else
+    {
+        n = count_records(HOSPITAL_FILE);  // Count records so we know how much memory to take
+        if (n == 0)  // If file doesn't exist or is empty
+        {
+            printf(RED "Error opening hospital file, file not found.\n" RESET);
+            return;  // Exit function
+        }
+
+        // Load the hot and cold tables into the query arena
+        arena_reset(&query_arena);  // Reuse the memory of the previous query
+        hospitals = (Hospital *)arena_alloc(&query_arena, n * sizeof(Hospital));
+        text = (HospitalText *)arena_alloc(&query_arena, n * sizeof(HospitalText));
+        load_hospitals(hospitals, text, &n);
+        view_cache_store_hospitals(VIEW_HOSPITALS, 0, hospitals, text, NULL, NULL, n);
     }
 
-    char line[LINE_SIZE];  // Buffer to read each line
     printf(MAGENTA BOLD "\n--- Hospital Records ---\n" RESET);  // Display header
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
-    printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");
-    // Loop through each line in file
-    printf("%5s | %-50s | %-12s | %5s | %-10s | %7s | %7s\n", "ID", "Hospital Name", "City", "Beds", "Price", "Ratings", "Reviews");
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    while (fgets(line, LINE_SIZE, fp))
-    {
-        Hospital h;  // Temporary Hospital variable
-        
-        // Extract data from pipe-separated line
-        sscanf(line, "%d|%[^|]|%[^|]|%d|%f|%f|%d", &h.hospital_id, h.hospital_name, h.city,
-               &h.available_beds, &h.bed_price, &h.rating, &h.reviews);
-        
-        // Display hospital information in formatted way
-        printf(CYAN "%5d | %-50s | %-12s | %5d | %10.2f | %7.1f | %7d\n" RESET,
-               h.hospital_id, h.hospital_name, h.city, h.available_beds, h.bed_price, h.rating, h.reviews);
-    }
-    fclose(fp);  // Close file
+    render_hospital_table(hospitals, text, NULL, n);  // NULL order means file order
 }
 
 // load_patients() - Reads all patient records from file into an array in memory
 void load_patients(Patient *patients, int *n)
 {
-    FILE *fp = fopen(PATIENT_FILE, "r");  // Open patient file in read mode
+    uint64_t started = stats_start();  // Time the whole load
+    FILE *fp = stats_fopen(PATIENT_FILE, "r");  // Open patient file in read mode
     if (!fp)  // If file doesn't exist
     {
         *n = 0;  // Set count to 0
@@ -685,17 +2045,16 @@ void load_patients(Patient *patients, int *n)
     char line[LINE_SIZE];  // Buffer to read each line
     
     // Loop through each line in file
-    while (fgets(line, LINE_SIZE, fp))
+    while (read_line(line, LINE_SIZE, fp))
     {
         // Extract data from pipe-separated line and store in array
-        sscanf(line, "%d|%[^|]|%d|%[^|]|%d",
-               &patients[i].patient_id, patients[i].patient_name, &patients[i].age,
-               patients[i].disease, &patients[i].hospital_id);
-        i++;  // Move to next array position
+        if (parse_patient_line(line, &patients[i]))
+            i++;  // Move to next array position
     }
     
     *n = i;  // Set count to number of records read
     fclose(fp);  // Close file
+    stats_record(OP_LOAD, started);
 }
 
 // ===== PATIENT MANAGEMENT FUNCTIONS =====
@@ -705,23 +2064,30 @@ void load_patients(Patient *patients, int *n)
 void add_patient()
 {
     Patient p;  // Create a Patient variable to store new patient data
+    char name[NAME_SIZE], disease[DISEASE_SIZE];  // Buffers for the text typed by the user
     
-    // Open patient file in append mode (a) to add new data
-    FILE *fp = fopen(PATIENT_FILE, "a");
-    if (!fp)  // Check if file opened successfully
-    {
-        printf(RED "Error opening patient file, file not found.\n" RESET);
-        return;  // Exit function
-    }
+    open_patient_indexes();  // Bring the indexes up to date before the file grows
 
     printf(MAGENTA "\n\nPlease enter the following details to add a new patient:\n" RESET);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
 
     // Get Patient ID from user
+    IdRegistry *ids = patient_id_registry();  // Registry of IDs already in use
     printf(GREEN "Enter Patient ID: " RESET);
-    while (scanf("%d", &p.patient_id) != 1)  // Check if valid integer
+    while (1)
     {
-        printf(RED "Invalid input!\n" RESET);
+        if (scanf("%d", &p.patient_id) != 1)  // Check if valid integer
+        {
+            printf(RED "Invalid input!\n" RESET);
+        }
+        else if (registry_contains(ids, p.patient_id))  // Check if ID is already taken
+        {
+            printf(RED "Patient ID %d already exists! Please enter a unique ID.\n" RESET, p.patient_id);
+        }
+        else
+        {
+            break;  // Valid and unique ID
+        }
         clear_input_buffer();  // Clear invalid input
         printf(GREEN "Enter Patient ID: " RESET);
     }
@@ -729,8 +2095,9 @@ void add_patient()
 
     // Get Patient Name from user
     printf(GREEN "Enter Patient Name: " RESET);
-    fgets(p.patient_name, NAME_SIZE, stdin);  // Read patient name
-    p.patient_name[strcspn(p.patient_name, "\n")] = 0;  // Remove newline
+    fgets(name, NAME_SIZE, stdin);  // Read patient name
+    name[strcspn(name, "\n")] = 0;  // Remove newline
+    p.patient_name = intern_string(name);
 
     // Get Patient Age from user
     printf(GREEN "Enter Patient Age: " RESET);
@@ -744,8 +2111,9 @@ void add_patient()
 
     // Get Disease/Condition from user
     printf(GREEN "Enter Disease/Condition: " RESET);
-    fgets(p.disease, DISEASE_SIZE, stdin);  // Read disease
-    p.disease[strcspn(p.disease, "\n")] = 0;  // Remove newline
+    fgets(disease, DISEASE_SIZE, stdin);  // Read disease
+    disease[strcspn(disease, "\n")] = 0;  // Remove newline
+    p.disease = dictionary_encode(&disease_dictionary, intern_string(disease));
 
     // Get Hospital ID where patient is admitted
     printf(GREEN "Enter Hospital ID (where patient is admitted): " RESET);
@@ -757,53 +2125,188 @@ void add_patient()
     }
     clear_input_buffer();
 
-    // Write patient data to file in pipe-separated format
-    fprintf(fp, "%d|%s|%d|%s|%d\n", p.patient_id, p.patient_name, p.age, p.disease, p.hospital_id);
-    fclose(fp);  // Close file
+    // Hand the patient line to the background writer (pipe-separated format)
+    uint64_t started = stats_start();  // Time the insert (the disk write happens in the background)
+    DurableAck ack = {TABLE_PATIENTS, 0, 0};
+    save_patient(&p, &ack);
+    stats_record(OP_INSERT, started);
+    if (!persist_wait_ack(&ack))  // Only report success once the line is on the disk
+    {
+        printf(RED "Error: the patient could not be saved to %s!\n" RESET, PATIENT_FILE);
+        return;
+    }
+    log_patient_event(EVENT_ADMIT, p.patient_id, p.hospital_id, 0);  // Timestamped admission for the history reports
     printf(GREEN BOLD "Patient added successfully!\n" RESET);
 }
 
+// save_patient() - Queues one patient for the end of the patient file and adds it to every in-memory index
+// (call open_patient_indexes() first). ack (may be NULL) receives the durable
+// acknowledgement; wait for it with persist_wait_ack() before telling the user.
+void save_patient(const Patient *p, DurableAck *ack)
+{
+    char line[LINE_SIZE];
+    format_patient_line(line, LINE_SIZE, p);
+    replication_lock();  // Read replicas see the new line and its log record together
+    int64_t offset = ack ? persist_append(TABLE_PATIENTS, line, ack_durable_write, ack)  // Where the new line starts
+                         : persist_append(TABLE_PATIENTS, line, count_durable_write, (void *)(intptr_t)TABLE_PATIENTS);
+    int64_t new_size = offset + strlen(line);  // File size after the new line
+    replication_append_patient(p);  // Ship the new line to read replicas
+    replication_unlock();
+    bump_table_version(TABLE_PATIENTS);  // Cached patient views are out of date
+    registry_insert(patient_id_registry(), p->patient_id);  // Remember the new ID
+    index_patient(p, offset, new_size);  // Add the new line to both indexes
+    name_index_add(&patient_names, p->patient_id, str_of(p->patient_name), dictionary_value(&disease_dictionary, p->disease));  // Make the name searchable
+}
+
 // display_patients() - Reads and displays all patients from file
 void display_patients()
 {
-    FILE *fp = fopen(PATIENT_FILE, "r");  // Open patient file in read mode
-    if (!fp)  // If file doesn't exist
+    Patient *patients;
+    StrRef *hospital_names;  // Hospital name of every patient
+    int n;
+    CachedView *view = view_cache_find(VIEW_PATIENTS, 0);  // Unchanged since the last time?
+    if (view)
     {
-        printf(RED "Error opening patient file, file not found.\n" RESET);
-        return;  // Exit function
+        patients = view->patients;
+        hospital_names = view->hospital_names;
+        n = view->count;
+    }
+    else
+    {
+        n = count_records(PATIENT_FILE);  // Count records so we know how much memory to take
+        if (n == 0)  // If file doesn't exist or is empty
+        {
+            printf(RED "Error opening patient file, file not found.\n" RESET);
+            return;  // Exit function
+        }
+
+        // Load all patients into the query arena and look up their hospital names in one pass
+        arena_reset(&query_arena);  // Reuse the memory of the previous query
+        patients = (Patient *)arena_alloc(&query_arena, n * sizeof(Patient));
+        load_patients(patients, &n);
+        hospital_names = (StrRef *)arena_alloc(&query_arena, (n + 1) * sizeof(StrRef));
+        resolve_hospital_names(patients, n, hospital_names);
+        view_cache_store_patients(patients, hospital_names, n);
     }
 
-    char line[LINE_SIZE];  // Buffer to read each line
     printf(MAGENTA BOLD "\n--- Patient Records ---\n" RESET);  // Display header
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
-
-    printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");    
-    printf(" %4s | %-20s | %-3s | %-25s | %-s\n", "ID", "Name", "Age", "Disease", "Hospital");
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    // Loop through each line in file
-    while (fgets(line, LINE_SIZE, fp))
-    {
-        Patient p;  // Temporary Patient variable
-        
-        // Extract data from pipe-separated line
-        sscanf(line, "%d|%[^|]|%d|%[^|]|%d",
-               &p.patient_id, p.patient_name, &p.age, p.disease, &p.hospital_id);
-        
-        // Get hospital name for this patient
-        char *h_name = get_hospital_name_by_id(p.hospital_id);
-        
-        // Display patient information in formatted way
-        printf(CYAN "%5d | %-20s | %-3d | %-25s | %-s\n" RESET,
-               p.patient_id, p.patient_name, p.age, p.disease, h_name);
-    }
-    printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");
+    render_named_patient_table(patients, hospital_names, n);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
     printf("\n");
-    fclose(fp);  // Close file
 }
 
 // ===== HOSPITAL FILTER & SORT FUNCTIONS =====
-// These functions filter and sort hospitals based on different criteria
+// These functions filter and sort hospitals based on different criteria.
+// They never move the records themselves: they sort an array of row numbers
+// ("order") and only look at the hot numeric fields, except the name sort
+// which reads the cold text table.
+
+// The comparison functions below are called by qsort(), which cannot pass
+// extra arguments, so the tables being sorted are shared through these pointers
+static const Hospital *sort_hot;         // Hot table currently being sorted
+static const HospitalText *sort_text;    // Cold table currently being sorted
+
+// Field comparators generated from HOSPITAL_FIELDS: compare_hospital_<field>(x, y)
+// orders rows x and y by one field, smallest first (-1, 0 or 1, no branches for numbers)
+#define SORT_ROW_h(row) sort_hot[row]
+#define SORT_ROW_t(row) sort_text[row]
+#define COMPARE_INT(a, b) (((a) > (b)) - ((a) < (b)))
+#define COMPARE_FLOAT(a, b) (((a) > (b)) - ((a) < (b)))
+#define COMPARE_TEXT(a, b) strcmp(str_of(a), str_of(b))
+#define HOSPITAL_FIELD_COMPARATOR(record, member, kind, decimals, title, width, left) \
+    static inline int compare_hospital_##member(int x, int y)                        \
+    {                                                                               \
+        return COMPARE_##kind(SORT_ROW_##record(x).member, SORT_ROW_##record(y).member); \
+    }
+HOSPITAL_FIELDS(HOSPITAL_FIELD_COMPARATOR)
+HOSPITAL_LOCATION_FIELDS(HOSPITAL_FIELD_COMPARATOR)
+
+// compare_by_bed_price() - Orders rows by bed price, highest first
+int compare_by_bed_price(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    int result = compare_hospital_bed_price(y, x);
+    return result != 0 ? result : x - y;  // Equal keys keep file order (same result as the old bubble sort)
+}
+
+// compare_by_available_beds() - Orders rows by available beds, most first
+int compare_by_available_beds(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    int result = compare_hospital_available_beds(y, x);
+    return result != 0 ? result : x - y;
+}
+
+// compare_by_name() - Orders rows alphabetically by hospital name (A to Z)
+int compare_by_name(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    int result = compare_hospital_hospital_name(x, y);
+    return result != 0 ? result : x - y;
+}
+
+// compare_by_rating_and_reviews() - Orders rows by rating, then reviews, highest first
+int compare_by_rating_and_reviews(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    int result = compare_hospital_rating(y, x);
+    if (result == 0)
+        result = compare_hospital_reviews(y, x);
+    return result != 0 ? result : x - y;
+}
+
+// sort_hospital_rows() - Sorts count row numbers in order using compare
+void sort_hospital_rows(const Hospital *hot, const HospitalText *text, int *order, int count,
+                        int (*compare)(const void *, const void *))
+{
+    uint64_t started = stats_start();
+    sort_hot = hot;
+    sort_text = text;
+    qsort(order, count, sizeof(int), compare);
+    stats_record(OP_SORT, started);
+}
+
+// load_sorted_hospitals() - Loads all hospitals into the query arena and sorts them
+// Returns the number of rows (0 if there are none); the tables and order are returned through pointers
+int load_sorted_hospitals(Hospital **hot, HospitalText **text, int **order,
+                          int (*compare)(const void *, const void *))
+{
+    // A repeat of an unchanged listing comes straight from the view cache
+    ViewKind kind = sorted_view_kind(compare);
+    CachedView *view = kind != VIEW_COUNT ? view_cache_find(kind, 0) : NULL;
+    if (view)
+    {
+        *hot = view->hot;
+        *text = view->text;
+        *order = view->order;
+        return view->count;
+    }
+
+    // With city shards switched on, sort every shard in parallel and merge them
+    int n = hospital_shards_ready() ? load_sorted_hospital_shards(hot, text, order, compare) : -1;
+    if (n < 0)
+    {
+        // Count total hospitals and check if any exist
+        n = count_records(HOSPITAL_FILE);
+        if (n == 0)
+            return 0;
+
+        // Take memory for the hot table, the cold table and the row order from the query arena
+        arena_reset(&query_arena);  // Reuse the memory of the previous query
+        *hot = (Hospital *)arena_alloc(&query_arena, n * sizeof(Hospital));
+        *text = (HospitalText *)arena_alloc(&query_arena, n * sizeof(HospitalText));
+        load_hospitals(*hot, *text, &n);  // Load hospitals from file
+
+        *order = (int *)arena_alloc(&query_arena, n * sizeof(int));
+        for (int i = 0; i < n; i++)  // Start with the rows in file order
+            (*order)[i] = i;
+        sort_hospital_rows(*hot, *text, *order, n, compare);
+    }
+    if (kind != VIEW_COUNT && n > 0)
+        view_cache_store_hospitals(kind, 0, *hot, *text, *order, NULL, n);  // Keep the result for next time
+    return n;
+}
 
 // display_hospitals_by_city() - Filters hospitals by city and displays them alphabetically
 void display_hospitals_by_city()
@@ -816,266 +2319,7035 @@ void display_hospitals_by_city()
     fgets(city, CITY_SIZE, stdin);  // Read city name
     city[strcspn(city, "\n")] = 0;  // Remove newline
 
+    // A repeat of an unchanged city view comes straight from the view cache
+    StrRef city_key = intern_string(city);
+    CachedView *view = view_cache_find(VIEW_HOSPITALS_IN_CITY, city_key);
+    if (view)
+    {
+        if (view->count == 0)
+        {
+            printf(RED "No hospitals found in this city.\n" RESET);
+            return;
+        }
+        printf(MAGENTA BOLD "\n--- Hospitals in %s (Alphabetically Sorted) ---\n" RESET, city);
+        printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+        render_hospital_table(view->hot, view->text, NULL, view->count);
+        return;
+    }
+
+    // With city shards switched on only the shard holding this city is read
+    int shard = hospital_shards_ready() ? shard_of_city(city) : -1;
+    char filename[64];
+    if (shard >= 0)
+        shard_filename(shard, filename, sizeof(filename));
+
     // Count total number of hospital records
-    int n = count_records(HOSPITAL_FILE);
+    int n = count_records(shard >= 0 ? filename : HOSPITAL_FILE);
     if (n == 0)  // If no hospitals exist
     {
-        printf(RED "No hospitals found!\n" RESET);
+        printf(RED "%s\n" RESET, shard >= 0 ? "No hospitals found in this city." : "No hospitals found!");
         return;
     }
 
-    // Allocate memory for array to store all hospitals
-    Hospital *hospitals = (Hospital *)malloc(n * sizeof(Hospital));
-    load_hospitals(hospitals, &n);  // Load all hospitals from file
+    // Take memory for the hot and cold tables from the query arena
+    arena_reset(&query_arena);  // Reuse the memory of the previous query
+    Hospital *hospitals = (Hospital *)arena_alloc(&query_arena, n * sizeof(Hospital));
+    HospitalText *text = (HospitalText *)arena_alloc(&query_arena, n * sizeof(HospitalText));
+    if (shard >= 0)
+        load_hospital_shard(shard, hospitals, text, &n);  // Load the city's shard
+    else
+        load_hospitals(hospitals, text, &n);  // Load all hospitals from file
 
-    // Allocate memory for array to store hospitals matching the city
-    Hospital *city_hospitals = (Hospital *)malloc(n * sizeof(Hospital));
+    // Take memory for the row numbers of hospitals matching the city
+    int *city_rows = (int *)arena_alloc(&query_arena, n * sizeof(int));
     int city_count = 0;  // Counter for hospitals in selected city
-    
+    StrRef wanted = find_interned_string(city);  // Cities are interned, so compare offsets not text
 
-    // Loop through all hospitals and copy matching ones to city_hospitals array
-    for (int i = 0; i < n; i++)
+    // Loop through the hot table only and remember the matching rows
+    uint64_t started = stats_start();  // Time the filter
+    for (int i = 0; i < n && wanted != 0; i++)
     {
-        if (strcmp(hospitals[i].city, city) == 0)  // If city matches
+        if (hospitals[i].city == wanted)  // If city matches
         {
-            city_hospitals[city_count++] = hospitals[i];  // Copy to new array
+            city_rows[city_count++] = i;
         }
     }
+    stats_record(OP_FILTER, started);
+
+    // Sort hospitals in the city alphabetically by name, and keep the result for next time
+    sort_hospital_rows(hospitals, text, city_rows, city_count, compare_by_name);
+    view_cache_store_hospitals(VIEW_HOSPITALS_IN_CITY, city_key, hospitals, text, city_rows, NULL, city_count);
 
     // If no hospitals found in this city
     if (city_count == 0)
     {
         printf(RED "No hospitals found in this city.\n" RESET);
-        free(hospitals);  // Free allocated memory
-        free(city_hospitals);
         return;
     }
 
-    
-    // Sort hospitals in the city alphabetically by name using Bubble Sort algorithm
-    // Bubble Sort: repeatedly swap adjacent elements if they're in wrong order
-    for (int i = 0; i < city_count - 1; i++)  // Outer loop
-    {
-        for (int j = 0; j < city_count - 1 - i; j++)  // Inner loop
-        {
-            // If current hospital name comes after next hospital name alphabetically
-            if (strcmp(city_hospitals[j].hospital_name, city_hospitals[j + 1].hospital_name) > 0)
-            {
-                // Swap the two hospitals
-                Hospital temp = city_hospitals[j];
-                city_hospitals[j] = city_hospitals[j + 1];
-                city_hospitals[j + 1] = temp;
-            }
-        }
-    }
-
     // Display sorted hospitals
     printf(MAGENTA BOLD "\n--- Hospitals in %s (Alphabetically Sorted) ---\n" RESET, city);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
 
-    printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");
-    printf("%5s | %-50s | %-12s | %5s | %-10s | %7s | %7s\n", "ID", "Hospital Name", "City", "Beds", "Price", "Ratings", "Reviews");
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    for (int i = 0; i < city_count; i++)
-    {
-        Hospital h = city_hospitals[i];
-        printf(CYAN "%5d | %-50s | %-12s | %5d | %10.2f | %7.1f | %7d\n" RESET,
-               h.hospital_id, h.hospital_name, h.city, h.available_beds, h.bed_price, h.rating, h.reviews);
-    }
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    // Free allocated memory to prevent memory leaks
-    free(hospitals);
-    free(city_hospitals);
+    render_hospital_table(hospitals, text, city_rows, city_count);
 }
 
-// ===== BUBBLE SORT IMPLEMENTATIONS =====
-// Bubble Sort is a simple sorting algorithm that repeatedly compares adjacent elements
+// ===== SORTED LISTINGS =====
+// Each listing sorts the row order with qsort (O(n log n)) and prints the rows in that order.
+// Files bigger than sort_memory_budget go through the external sort instead.
 
 // sort_hospitals_by_bed_price() - Sorts hospitals by bed price from highest to lowest
 void sort_hospitals_by_bed_price()
 {
-    // Count total hospitals and check if any exist
-    int n = count_records(HOSPITAL_FILE);
-    if (n == 0)
+    if (external_sort_needed(HOSPITAL_FILE))  // Too big for the memory budget: sort on disk
     {
-        printf(RED "No hospitals found!\n" RESET);
+        stream_sorted_hospitals(SORT_HOSPITAL_PRICE, "Hospitals Sorted by Bed Price (Highest to Lowest)");
         return;
     }
-
-    // Allocate memory for array to store all hospitals
-    Hospital *h = (Hospital *)malloc(n * sizeof(Hospital));
-    load_hospitals(h, &n);  // Load hospitals from file
-
-    // Bubble Sort: sort by bed price in descending order (highest to lowest)
-    for (int i = 0; i < n - 1; i++)  // Outer loop
+    Hospital *h;
+    HospitalText *text;
+    int *order;
+    int n = load_sorted_hospitals(&h, &text, &order, compare_by_bed_price);
+    if (n == 0)
     {
-        for (int j = 0; j < n - 1 - i; j++)  // Inner loop
-        {
-            // If current price is less than next price, swap (to get descending order)
-            if (h[j].bed_price < h[j + 1].bed_price)
-            {
-                Hospital temp = h[j];
-                h[j] = h[j + 1];
-                h[j + 1] = temp;
-            }
-        }
+        printf(RED "No hospitals found!\n" RESET);
+        return;
     }
 
     // Display sorted hospitals
     printf(MAGENTA BOLD "\n--- Hospitals Sorted by Bed Price (Highest to Lowest) ---\n" RESET);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
 
-    printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");
-    printf("%5s | %-50s | %-12s | %5s | %-10s | %7s | %7s\n", "ID", "Hospital Name", "City", "Beds", "Price", "Ratings", "Reviews");
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    for (int i = 0; i < n; i++)
-    {
-        Hospital x = h[i];
-        printf(CYAN "%5d | %-50s | %-12s | %5d | %10.2f | %7.1f | %7d\n" RESET,
-               x.hospital_id, x.hospital_name, x.city, x.available_beds, x.bed_price, x.rating, x.reviews);
-    }
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    printf("\n\n");
-    free(h);  // Free allocated memory
+    render_hospital_table(h, text, order, n);
 }
 
 // sort_hospitals_by_available_beds() - Sorts hospitals by available beds from most to least
 void sort_hospitals_by_available_beds()
 {
-    // Count total hospitals and check if any exist
-    int n = count_records(HOSPITAL_FILE);
-    if (n == 0)
+    if (external_sort_needed(HOSPITAL_FILE))  // Too big for the memory budget: sort on disk
     {
-        printf(RED "No hospitals found!\n" RESET);
+        stream_sorted_hospitals(SORT_HOSPITAL_BEDS, "Hospitals Sorted by Available Beds (Highest to Lowest)");
         return;
     }
-
-    // Allocate memory for array to store all hospitals
-    Hospital *h = (Hospital *)malloc(n * sizeof(Hospital));
-    load_hospitals(h, &n);  // Load hospitals from file
-
-    // Bubble Sort: sort by available beds in descending order (most to least)
-    for (int i = 0; i < n - 1; i++)  // Outer loop
+    Hospital *h;
+    HospitalText *text;
+    int *order;
+    int n = load_sorted_hospitals(&h, &text, &order, compare_by_available_beds);
+    if (n == 0)
     {
-        for (int j = 0; j < n - 1 - i; j++)  // Inner loop
-        {
-            // If current beds less than next beds, swap (to get descending order)
-            if (h[j].available_beds < h[j + 1].available_beds)
-            {
-                Hospital temp = h[j];
-                h[j] = h[j + 1];
-                h[j + 1] = temp;
-            }
-        }
+        printf(RED "No hospitals found!\n" RESET);
+        return;
     }
 
     // Display sorted hospitals
     printf(MAGENTA BOLD "\n--- Hospitals Sorted by Available Beds (Highest to Lowest) ---\n" RESET);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
-    printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");
-    printf("%5s | %-50s | %-12s | %5s | %-10s | %7s | %7s\n", "ID", "Hospital Name", "City", "Beds", "Price", "Ratings", "Reviews");
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    for (int i = 0; i < n; i++)
-    {
-        Hospital x = h[i];
-        printf(CYAN "%5d | %-50s | %-12s | %5d | %10.2f | %7.1f | %7d\n" RESET,
-               x.hospital_id, x.hospital_name, x.city, x.available_beds, x.bed_price, x.rating, x.reviews);
-    }
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    
-    free(h);  // Free allocated memory
+    render_hospital_table(h, text, order, n);
 }
 
 // sort_hospitals_by_name() - Sorts hospitals alphabetically by name (A to Z)
 void sort_hospitals_by_name()
 {
-    // Count total hospitals and check if any exist
-    int n = count_records(HOSPITAL_FILE);
+    if (external_sort_needed(HOSPITAL_FILE))  // Too big for the memory budget: sort on disk
+    {
+        stream_sorted_hospitals(SORT_HOSPITAL_NAME, "Hospitals Sorted by Name (A to Z)");
+        return;
+    }
+    Hospital *h;
+    HospitalText *text;
+    int *order;
+    int n = load_sorted_hospitals(&h, &text, &order, compare_by_name);
     if (n == 0)
     {
         printf(RED "No hospitals found!\n" RESET);
         return;
     }
 
-    // Allocate memory for array to store all hospitals
-    Hospital *h = (Hospital *)malloc(n * sizeof(Hospital));
-    load_hospitals(h, &n);  // Load hospitals from file
+    // Display sorted hospitals
+    printf(MAGENTA BOLD "\n--- Hospitals Sorted by Name (A to Z) ---\n" RESET);
+   printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    render_hospital_table(h, text, order, n);
+}
 
-    // Bubble Sort: sort by hospital name alphabetically (A to Z)
-    for (int i = 0; i < n - 1; i++)  // Outer loop
+// ===== ID REGISTRY (BLOOM FILTER + HASH SET) =====
+// These functions keep every used hospital/patient ID in memory so inserts can
+// reject duplicates in O(1) instead of scanning the whole data file
+
+// hash_id() - Mixes an ID into a well spread 64-bit hash (splitmix64 finaliser)
+static uint64_t hash_id(int id)
+{
+    uint64_t x = (uint64_t)(uint32_t)id + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// bloom_set() / bloom_test() - Set or test the BLOOM_HASHES bits for one hash
+// Double hashing: bit i = h1 + i*h2, so a single 64-bit hash gives every position
+static void bloom_set(IdRegistry *r, uint64_t hash)
+{
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;  // h2 odd so positions differ
+    for (int i = 0; i < BLOOM_HASHES; i++)
+    {
+        uint32_t bit = (h1 + i * h2) & (r->bloom_bits - 1);
+        r->bloom[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+static int bloom_test(const IdRegistry *r, uint64_t hash)
+{
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++)
+    {
+        uint32_t bit = (h1 + i * h2) & (r->bloom_bits - 1);
+        if (!(r->bloom[bit >> 6] & (1ULL << (bit & 63))))
+            return 0;  // One bit missing means the ID was never inserted
+    }
+    return 1;  // Maybe present, the hash set gives the exact answer
+}
+
+// registry_init() - Allocates an empty registry with room for capacity slots
+void registry_init(IdRegistry *r, uint32_t capacity)
+{
+    uint32_t cap = REGISTRY_INITIAL_CAPACITY;
+    while (cap < capacity)  // Round up to a power of two so we can mask instead of modulo
+        cap <<= 1;
+    r->capacity = cap;
+    r->count = 0;
+    r->slots = (int *)stats_malloc(cap * sizeof(int));
+    r->used = (unsigned char *)stats_calloc(cap, 1);
+    r->bloom_bits = cap * BLOOM_BITS_PER_ID;
+    r->bloom = (uint64_t *)stats_calloc(r->bloom_bits / 64, sizeof(uint64_t));
+    r->loaded = 0;
+}
+
+// registry_free() - Releases all memory owned by the registry
+void registry_free(IdRegistry *r)
+{
+    free(r->slots);
+    free(r->used);
+    free(r->bloom);
+    r->slots = NULL;
+    r->used = NULL;
+    r->bloom = NULL;
+    r->capacity = r->count = r->bloom_bits = 0;
+}
+
+// registry_grow() - Doubles the hash table and rebuilds the Bloom filter
+// Keeps the load factor under 1/2 so probes stay short
+static void registry_grow(IdRegistry *r)
+{
+    IdRegistry bigger;
+    registry_init(&bigger, r->capacity * 2);
+    for (uint32_t i = 0; i < r->capacity; i++)  // Re-insert every stored ID
+    {
+        if (r->used[i])
+            registry_insert(&bigger, r->slots[i]);
+    }
+    bigger.loaded = r->loaded;
+    registry_free(r);
+    *r = bigger;
+}
+
+// registry_contains() - Returns 1 if the ID has already been used, 0 otherwise
+int registry_contains(const IdRegistry *r, int id)
+{
+    uint64_t hash = hash_id(id);
+    if (!bloom_test(r, hash))  // Fast path: most new IDs are accepted here without touching the hash set
+        return 0;
+
+    uint32_t i = (uint32_t)(hash >> 32) & (r->capacity - 1);
+    while (r->used[i])  // Linear probing until an empty slot
+    {
+        if (r->slots[i] == id)
+            return 1;
+        i = (i + 1) & (r->capacity - 1);
+    }
+    return 0;  // Bloom filter false positive
+}
+
+// registry_insert() - Stores an ID, returns 1 if it was new and 0 if it was a duplicate
+int registry_insert(IdRegistry *r, int id)
+{
+    if (registry_contains(r, id))
+        return 0;
+    if ((r->count + 1) * 2 > r->capacity)  // Keep the table at most half full
+        registry_grow(r);
+
+    uint64_t hash = hash_id(id);
+    uint32_t i = (uint32_t)(hash >> 32) & (r->capacity - 1);
+    while (r->used[i])
+        i = (i + 1) & (r->capacity - 1);
+    r->slots[i] = id;
+    r->used[i] = 1;
+    r->count++;
+    bloom_set(r, hash);
+    return 1;
+}
+
+// registry_load_file() - Bulk loads the leading ID of every line in a data file
+// Only the ID column is parsed (strtol instead of a full sscanf) so millions of
+// lines validate cheaply. Duplicates are reported and the number found is returned.
+int registry_load_file(IdRegistry *r, const char *filename, const char *label)
+{
+    registry_init(r, (uint32_t)count_records(filename) * 2);  // Pre-size to avoid regrowing
+    r->loaded = 1;
+
+    FILE *fp = stats_fopen(filename, "r");
+    if (!fp)  // No file yet means no IDs in use
+        return 0;
+
+    int duplicates = 0;  // Number of repeated IDs found
+    char line[LINE_SIZE];
+    while (read_line(line, LINE_SIZE, fp))
+    {
+        char *end;
+        long id = strtol(line, &end, 10);  // Read the ID column only
+        if (end == line || *end != '|')  // Skip blank or malformed lines
+            continue;
+        if (!registry_insert(r, (int)id))
+        {
+            if (duplicates == 0)
+                printf(YELLOW "Warning: duplicate %s IDs found in %s:" RESET, label, filename);
+            printf(YELLOW " %ld" RESET, id);
+            duplicates++;
+        }
+    }
+    if (duplicates > 0)
+        printf(YELLOW "\nOnly the first record with each ID will be used for lookups.\n" RESET);
+
+    fclose(fp);
+    return duplicates;
+}
+
+static IdRegistry hospital_ids;  // Static so they live for the whole program
+static IdRegistry patient_ids;
+
+// hospital_id_registry() - Returns the hospital ID registry, loading it on first use
+IdRegistry *hospital_id_registry()
+{
+    if (!hospital_ids.loaded)
+        registry_load_file(&hospital_ids, HOSPITAL_FILE, "hospital");
+    return &hospital_ids;
+}
+
+// patient_id_registry() - Returns the patient ID registry, loading it on first use
+IdRegistry *patient_id_registry()
+{
+    if (!patient_ids.loaded)
+        registry_load_file(&patient_ids, PATIENT_FILE, "patient");
+    return &patient_ids;
+}
+
+// forget_id_registry() - Drops the registry of a table; the next use loads it from the file
+// Used when IDs were inserted for lines that never reached the file
+void forget_id_registry(DataTable table)
+{
+    IdRegistry *r = table == TABLE_HOSPITALS ? &hospital_ids : &patient_ids;
+    registry_free(r);
+    r->loaded = 0;
+}
+
+// ===== ARENA ALLOCATOR =====
+// An arena hands out memory by bumping a pointer inside big blocks. Nothing is
+// freed one by one: arena_reset() rewinds every block at the start of a query.
+
+// arena_alloc() - Returns bytes of memory (8-byte aligned) from the arena
+void *arena_alloc(Arena *a, size_t bytes)
+{
+    stats.arena_allocations++;
+    bytes = (bytes + 7) & ~(size_t)7;  // Round up so every allocation stays aligned
+
+    // Walk forward through blocks kept from earlier queries before asking malloc
+    while (a->current && a->current->used + bytes > a->current->size)
+    {
+        if (!a->current->next)
+            break;
+        a->current = a->current->next;
+        a->current->used = 0;  // Blocks after current are untouched since the reset
+    }
+
+    if (!a->current || a->current->used + bytes > a->current->size)
+    {
+        size_t size = bytes > ARENA_BLOCK_SIZE ? bytes : ARENA_BLOCK_SIZE;
+        ArenaBlock *block = (ArenaBlock *)stats_malloc(sizeof(ArenaBlock) + size);
+        if (!block)
+        {
+            printf(RED "Out of memory!\n" RESET);
+            exit(1);
+        }
+        block->next = NULL;
+        block->size = size;
+        block->used = 0;
+        block->data = (unsigned char *)(block + 1);  // Usable bytes start right after the header
+        if (a->current)
+            a->current->next = block;  // Append after the last block
+        else
+            a->head = block;
+        a->current = block;
+    }
+
+    void *ptr = a->current->data + a->current->used;
+    a->current->used += bytes;
+    return ptr;
+}
+
+// arena_reset() - Makes all memory in the arena available again without freeing it
+void arena_reset(Arena *a)
+{
+    a->current = a->head;
+    if (a->current)
+        a->current->used = 0;
+}
+
+// ===== STRING INTERNING =====
+// Every text field read from the files goes into one shared string heap.
+// Records keep only the 4-byte offset, and repeated values (cities,
+// diseases, and names seen again on the next reload) are stored once.
+
+// hash_string() - FNV-1a hash of a zero-terminated string
+static uint32_t hash_string(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    while (*text)
+    {
+        hash ^= (unsigned char)*text++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// string_pool_init() - Creates the heap; offset 0 is reserved for the empty string
+static void string_pool_init(StringPool *pool)
+{
+    pool->capacity = STRING_POOL_INITIAL_SIZE;
+    pool->data = (char *)stats_malloc(pool->capacity);
+    pool->data[0] = '\0';
+    pool->size = 1;
+    pool->table_size = STRING_TABLE_INITIAL_SIZE;
+    pool->table = (uint32_t *)stats_calloc(pool->table_size, sizeof(uint32_t));
+    pool->count = 0;
+}
+
+// string_pool_slot() - Finds the table slot holding text, or the empty slot where it belongs
+static uint32_t string_pool_slot(const StringPool *pool, const char *text, uint32_t hash)
+{
+    uint32_t i = hash & (pool->table_size - 1);
+    while (pool->table[i] != 0 && strcmp(pool->data + pool->table[i], text) != 0)
+        i = (i + 1) & (pool->table_size - 1);  // Linear probing
+    return i;
+}
+
+// string_pool_grow_table() - Doubles the intern table when it gets half full
+static void string_pool_grow_table(StringPool *pool)
+{
+    uint32_t old_size = pool->table_size;
+    uint32_t *old_table = pool->table;
+    pool->table_size = old_size * 2;
+    pool->table = (uint32_t *)stats_calloc(pool->table_size, sizeof(uint32_t));
+    for (uint32_t i = 0; i < old_size; i++)
+    {
+        if (old_table[i] != 0)
+        {
+            const char *text = pool->data + old_table[i];
+            pool->table[string_pool_slot(pool, text, hash_string(text))] = old_table[i];
+        }
+    }
+    free(old_table);
+}
+
+// intern_string() - Returns the offset of text in the string heap, adding it if new
+StrRef intern_string(const char *text)
+{
+    if (!string_pool.data)
+        string_pool_init(&string_pool);
+    if (text[0] == '\0')
+        return 0;  // All empty strings share offset 0
+
+    uint32_t hash = hash_string(text);
+    uint32_t slot = string_pool_slot(&string_pool, text, hash);
+    if (string_pool.table[slot] != 0)
+        return string_pool.table[slot];  // Already stored
+
+    uint32_t length = (uint32_t)strlen(text) + 1;
+    while (string_pool.size + length > string_pool.capacity)  // Make room in the heap
+    {
+        string_pool.capacity *= 2;
+        string_pool.data = (char *)stats_realloc(string_pool.data, string_pool.capacity);
+    }
+    StrRef ref = string_pool.size;
+    memcpy(string_pool.data + ref, text, length);
+    string_pool.size += length;
+    string_pool.count++;
+
+    if (string_pool.count * 2 > string_pool.table_size)
+        string_pool_grow_table(&string_pool);  // Slot positions change, so find it again
+    string_pool.table[string_pool_slot(&string_pool, text, hash)] = ref;
+    return ref;
+}
+
+// find_interned_string() - Returns the offset of text if it was stored before, 0 otherwise
+StrRef find_interned_string(const char *text)
+{
+    if (!string_pool.data || text[0] == '\0')
+        return 0;
+    return string_pool.table[string_pool_slot(&string_pool, text, hash_string(text))];
+}
+
+// str_of() - Turns a string heap offset back into readable text
+// The pointer is only valid until the next intern_string() call (the heap may move)
+const char *str_of(StrRef ref)
+{
+    return string_pool.data ? string_pool.data + ref : "";
+}
+
+// ===== RECORD PARSING =====
+// These functions split a pipe-separated line in place (no sscanf) and
+// intern the text fields into the string heap. The field by field code is
+// generated from the RECORD SCHEMAS lists with the macros below.
+
+// PARSE_FIELD: stores the next field f[n] of the line, converted for its kind (f and n are locals of the parser)
+#define PARSE_FIELD(record, member, kind, decimals, title, width, left) PARSE_##kind(record->member, f[n++]);
+#define PARSE_INT(field, text) field = atoi(text)
+#define PARSE_FLOAT(field, text) field = strtof(text, NULL)
+#define PARSE_TEXT(field, text) field = intern_string(text)
+#define PARSE_DISEASE(field, text) field = dictionary_encode(&disease_dictionary, intern_string(text))
+#define PARSE_CHARS(field, text) snprintf(field, sizeof(field), "%s", text)
+
+// FORMAT_FIELD: appends one field and a '|' to line (line, size and length are locals of the formatter)
+#define FORMAT_FIELD(record, member, kind, decimals, title, width, left) \
+    length += snprintf(line + (length < size ? length : size), length < size ? size - length : 0, FORMAT_##kind "|", VALUE_##kind(record->member, decimals));
+#define FORMAT_INT "%d"
+#define FORMAT_FLOAT "%.*f"
+#define FORMAT_TEXT "%s"
+#define FORMAT_DISEASE "%s"
+#define FORMAT_CHARS "%s"
+#define VALUE_INT(field, decimals) field
+#define VALUE_FLOAT(field, decimals) decimals, (double)field
+#define VALUE_TEXT(field, decimals) str_of(field)
+#define VALUE_DISEASE(field, decimals) disease_name(field)
+#define VALUE_CHARS(field, decimals) field
+
+// split_fields() - Cuts line at every '|' and stores a pointer to each field
+// Returns the number of fields found
+static int split_fields(char *line, char **fields, int max_fields)
+{
+    line[strcspn(line, "\r\n")] = '\0';  // Drop the line ending
+    int count = 0;
+    fields[count++] = line;
+    for (char *c = line; *c && count < max_fields; c++)
+    {
+        if (*c == '|')
+        {
+            *c = '\0';  // Terminate the previous field
+            fields[count++] = c + 1;
+        }
+    }
+    return count;
+}
+
+// parse_hospital_line() - Fills h (hot fields) and t (text) from
+// "id|name|city|beds|price|rating|reviews" with an optional "|latitude|longitude" at the end
+// Returns 1 on success, 0 if the line does not have seven or nine fields
+int parse_hospital_line(char *line, Hospital *h, HospitalText *t)
+{
+    int sampled = stats.records_parsed++ % PARSE_SAMPLE_RATE == 0;  // Only time a sample of parses
+    uint64_t started = sampled ? stats_start() : 0;
+    char *f[HOSPITAL_FIELD_MAX];
+    int n = 0;
+    int fields = split_fields(line, f, HOSPITAL_FIELD_MAX);
+    if (fields != HOSPITAL_FIELD_COUNT && fields != HOSPITAL_FIELD_MAX)
+        return 0;
+    HOSPITAL_FIELDS(PARSE_FIELD)
+    if (fields == HOSPITAL_FIELD_MAX)
+    {
+        HOSPITAL_LOCATION_FIELDS(PARSE_FIELD)
+    }
+    else
+    {
+        t->latitude = NO_LOCATION;
+        t->longitude = 0;
+    }
+    if (sampled)
+        stats_record(OP_PARSE, started);
+    return 1;
+}
+
+// end_formatted_line() - Turns the '|' after the last field into the line ending
+static void end_formatted_line(char *line, int size, int length)
+{
+    if (length > 0 && length < size)
+        line[length - 1] = '\n';
+}
+
+// format_hospital_line() - Formats one hospital the way parse_hospital_line() reads it
+void format_hospital_line(char *line, int size, const Hospital *h, const HospitalText *t)
+{
+    int length = 0;
+    HOSPITAL_FIELDS(FORMAT_FIELD)
+    if (t->latitude != NO_LOCATION)
+    {
+        HOSPITAL_LOCATION_FIELDS(FORMAT_FIELD)
+    }
+    end_formatted_line(line, size, length);
+}
+
+// write_hospital_line() - Writes one hospitals.txt line
+void write_hospital_line(FILE *fp, const Hospital *h, const HospitalText *t)
+{
+    char line[LINE_SIZE];
+    format_hospital_line(line, LINE_SIZE, h, t);
+    fputs(line, fp);
+}
+
+// parse_patient_line() - Fills p from "id|name|age|disease|hospital_id"
+// Returns 1 on success, 0 if the line does not have all five fields
+int parse_patient_line(char *line, Patient *p)
+{
+    int sampled = stats.records_parsed++ % PARSE_SAMPLE_RATE == 0;  // Only time a sample of parses
+    uint64_t started = sampled ? stats_start() : 0;
+    char *f[PATIENT_FIELD_COUNT];
+    int n = 0;
+    if (split_fields(line, f, PATIENT_FIELD_COUNT) != PATIENT_FIELD_COUNT)
+        return 0;
+    PATIENT_FIELDS(PARSE_FIELD)
+    if (sampled)
+        stats_record(OP_PARSE, started);
+    return 1;
+}
+
+// format_patient_line() - Formats one patient the way parse_patient_line() reads it
+void format_patient_line(char *line, int size, const Patient *p)
+{
+    int length = 0;
+    PATIENT_FIELDS(FORMAT_FIELD)
+    end_formatted_line(line, size, length);
+}
+
+// parse_user_line() - Fills u from "username|password"
+// Returns 1 on success, 0 if the line does not have both fields
+int parse_user_line(char *line, User *u)
+{
+    char *f[USER_FIELD_COUNT];
+    int n = 0;
+    if (split_fields(line, f, USER_FIELD_COUNT) != USER_FIELD_COUNT)
+        return 0;
+    USER_FIELDS(PARSE_FIELD)
+    return 1;
+}
+
+// format_user_line() - Formats one user the way parse_user_line() reads it
+void format_user_line(char *line, int size, const User *u)
+{
+    int length = 0;
+    USER_FIELDS(FORMAT_FIELD)
+    end_formatted_line(line, size, length);
+}
+
+// ===== LAYOUT BENCHMARK =====
+// Builds the same synthetic hospitals in the original 104-byte layout and in
+// the hot/cold split, then times every sort and the city filter on both.
+// On Linux the hardware cache-miss counter is read as well.
+
+// now_seconds() - Returns a high resolution timestamp in seconds
+double now_seconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// cache_miss_counter_open() - Opens the cache-miss counter, returns -1 if unavailable
+static int cache_miss_counter_open()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;        // Start stopped, enabled around each measurement
+    attr.exclude_kernel = 1;  // Count only our own code
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;  // No portable counter API on this platform
+#endif
+}
+
+// cache_miss_counter_start() / cache_miss_counter_stop() - Measure one region
+// stop returns the number of misses, or -1 when counters are not available
+static void cache_miss_counter_start(int fd)
+{
+#ifdef __linux__
+    if (fd >= 0)
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)fd;
+#endif
+}
+
+static long long cache_miss_counter_stop(int fd)
+{
+#ifdef __linux__
+    long long count;
+    if (fd >= 0)
+    {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) == sizeof(count))
+            return count;
+    }
+#else
+    (void)fd;
+#endif
+    return -1;
+}
+
+// Comparison functions for the original layout (same orderings as the real sorts)
+static const LegacyHospital *sort_legacy;  // Legacy table currently being sorted
+
+static int compare_legacy_by_bed_price(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    if (sort_legacy[x].bed_price != sort_legacy[y].bed_price)
+        return sort_legacy[x].bed_price < sort_legacy[y].bed_price ? 1 : -1;
+    return x - y;
+}
+
+static int compare_legacy_by_available_beds(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    if (sort_legacy[x].available_beds != sort_legacy[y].available_beds)
+        return sort_legacy[x].available_beds < sort_legacy[y].available_beds ? 1 : -1;
+    return x - y;
+}
+
+static int compare_legacy_by_name(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    int result = strcmp(sort_legacy[x].hospital_name, sort_legacy[y].hospital_name);
+    return result != 0 ? result : x - y;
+}
+
+static int compare_legacy_by_rating_and_reviews(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    if (sort_legacy[x].rating != sort_legacy[y].rating)
+        return sort_legacy[x].rating < sort_legacy[y].rating ? 1 : -1;
+    if (sort_legacy[x].reviews != sort_legacy[y].reviews)
+        return sort_legacy[x].reviews < sort_legacy[y].reviews ? 1 : -1;
+    return x - y;
+}
+
+// print_benchmark_row() - Prints one line of the benchmark result table
+static void print_benchmark_row(const char *operation, double legacy_ms, long long legacy_misses,
+                                double split_ms, long long split_misses)
+{
+    char legacy_text[24], split_text[24];  // Miss counts, or "n/a" without counters
+    if (legacy_misses >= 0)
+        snprintf(legacy_text, sizeof(legacy_text), "%lld", legacy_misses);
+    else
+        snprintf(legacy_text, sizeof(legacy_text), "n/a");
+    if (split_misses >= 0)
+        snprintf(split_text, sizeof(split_text), "%lld", split_misses);
+    else
+        snprintf(split_text, sizeof(split_text), "n/a");
+
+    printf(CYAN "%-22s | %10.2f | %14s | %10.2f | %14s | %6.2fx\n" RESET,
+           operation, legacy_ms, legacy_text, split_ms, split_text,
+           split_ms > 0 ? legacy_ms / split_ms : 0.0);
+}
+
+// benchmark_random() - Small private random generator (xorshift), so the benchmark
+// gets the same data every run without reseeding the program's rand()
+static int benchmark_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (int)(x & 0x7FFFFFFF);
+}
+
+// run_layout_benchmark() - Compares the original and hot/cold layouts on synthetic data
+void run_layout_benchmark()
+{
+    static const char *cities[] = {"Lahore", "Karachi", "Islamabad", "Sialkot", "Multan",
+                                   "Faisalabad", "Peshawar", "Quetta", "Layyah", "Sambrial"};
+    int city_count = sizeof(cities) / sizeof(cities[0]);
+    int n;  // Number of synthetic hospitals
+
+    printf(GREEN "Enter number of synthetic hospitals (e.g. 200000): " RESET);
+    while (scanf("%d", &n) != 1 || n <= 0)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter number of synthetic hospitals: " RESET);
+    }
+    clear_input_buffer();
+
+    // Build both layouts with identical contents
+    arena_reset(&query_arena);
+    LegacyHospital *legacy = (LegacyHospital *)arena_alloc(&query_arena, n * sizeof(LegacyHospital));
+    Hospital *hot = (Hospital *)arena_alloc(&query_arena, n * sizeof(Hospital));
+    HospitalText *text = (HospitalText *)arena_alloc(&query_arena, n * sizeof(HospitalText));
+    int *order = (int *)arena_alloc(&query_arena, n * sizeof(int));
+    uint32_t seed = 12345;  // Fixed seed so runs are comparable
+
+    // The synthetic names go into a private string heap that is freed at the end,
+    // so the benchmark leaves nothing behind in the program's own string heap
+    StringPool saved_pool = string_pool;
+    memset(&string_pool, 0, sizeof(string_pool));
+    for (int i = 0; i < n; i++)
+    {
+        LegacyHospital *l = &legacy[i];
+        l->hospital_id = i + 1;
+        snprintf(l->hospital_name, NAME_SIZE, "Hospital %08d", benchmark_random(&seed) % 100000000);
+        snprintf(l->city, CITY_SIZE, "%s", cities[benchmark_random(&seed) % city_count]);
+        l->available_beds = benchmark_random(&seed) % 500;
+        l->bed_price = (float)(benchmark_random(&seed) % 50000) / 2.0f;
+        l->rating = (float)(benchmark_random(&seed) % 51) / 10.0f;
+        l->reviews = benchmark_random(&seed) % 5000;
+
+        hot[i].hospital_id = l->hospital_id;
+        hot[i].available_beds = l->available_beds;
+        hot[i].bed_price = l->bed_price;
+        hot[i].rating = l->rating;
+        hot[i].reviews = l->reviews;
+        hot[i].city = intern_string(l->city);
+        text[i].hospital_name = intern_string(l->hospital_name);
+    }
+
+    struct
+    {
+        const char *operation;
+        int (*legacy_compare)(const void *, const void *);
+        int (*split_compare)(const void *, const void *);
+    } sorts[] = {
+        {"Sort by bed price", compare_legacy_by_bed_price, compare_by_bed_price},
+        {"Sort by available beds", compare_legacy_by_available_beds, compare_by_available_beds},
+        {"Sort by name", compare_legacy_by_name, compare_by_name},
+        {"Sort by rating/reviews", compare_legacy_by_rating_and_reviews, compare_by_rating_and_reviews},
+    };
+
+    int counter = cache_miss_counter_open();
+    printf(MAGENTA BOLD "\n--- Record Layout Benchmark (%d hospitals) ---\n" RESET, n);
+    printf("Original record: %d bytes, hot record: %d bytes + %d byte text row\n",
+           (int)sizeof(LegacyHospital), (int)sizeof(Hospital), (int)sizeof(HospitalText));
+    if (counter < 0)
+        printf(YELLOW "Cache-miss counters are not available here, only times are shown.\n" RESET);
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    printf("%-22s | %10s | %14s | %10s | %14s | %7s\n", "Operation", "Orig ms", "Orig misses", "Hot ms", "Hot misses", "Speedup");
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+
+    for (int s = 0; s < (int)(sizeof(sorts) / sizeof(sorts[0])); s++)
+    {
+        for (int i = 0; i < n; i++)
+            order[i] = i;
+        sort_legacy = legacy;
+        cache_miss_counter_start(counter);
+        double start = now_seconds();
+        qsort(order, n, sizeof(int), sorts[s].legacy_compare);
+        double legacy_ms = (now_seconds() - start) * 1000.0;
+        long long legacy_misses = cache_miss_counter_stop(counter);
+
+        for (int i = 0; i < n; i++)
+            order[i] = i;
+        cache_miss_counter_start(counter);
+        start = now_seconds();
+        sort_hospital_rows(hot, text, order, n, sorts[s].split_compare);
+        double split_ms = (now_seconds() - start) * 1000.0;
+        long long split_misses = cache_miss_counter_stop(counter);
+
+        print_benchmark_row(sorts[s].operation, legacy_ms, legacy_misses, split_ms, split_misses);
+    }
+
+    // City filter: the original layout compares text, the hot layout compares city codes
+    const char *city = cities[0];
+    int legacy_matches = 0, split_matches = 0;
+    cache_miss_counter_start(counter);
+    double start = now_seconds();
+    for (int i = 0; i < n; i++)
+    {
+        if (strcmp(legacy[i].city, city) == 0)
+            order[legacy_matches++] = i;
+    }
+    double legacy_ms = (now_seconds() - start) * 1000.0;
+    long long legacy_misses = cache_miss_counter_stop(counter);
+
+    cache_miss_counter_start(counter);
+    start = now_seconds();
+    StrRef wanted = find_interned_string(city);
+    for (int i = 0; i < n; i++)
+    {
+        if (hot[i].city == wanted)
+            order[split_matches++] = i;
+    }
+    double split_ms = (now_seconds() - start) * 1000.0;
+    long long split_misses = cache_miss_counter_stop(counter);
+    print_benchmark_row("Filter by city", legacy_ms, legacy_misses, split_ms, split_misses);
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    if (legacy_matches != split_matches)
+        printf(RED "Filter results differ (%d vs %d)!\n" RESET, legacy_matches, split_matches);
+
+    free(string_pool.data);  // Back to the program's own strings
+    free(string_pool.table);
+    string_pool = saved_pool;
+
+#ifdef __linux__
+    if (counter >= 0)
+        close(counter);
+#endif
+}
+
+// ===== INTEGER HASH MAP =====
+// Open-addressing hash table used to map IDs and string offsets to small numbers
+
+// intmap_init() - Allocates an empty map with room for capacity keys
+void intmap_init(IntMap *m, uint32_t capacity)
+{
+    uint32_t cap = 16;
+    while (cap < capacity * 2)  // Keep at most half the slots full
+        cap <<= 1;
+    m->capacity = cap;
+    m->count = 0;
+    m->keys = (int *)stats_malloc(cap * sizeof(int));
+    m->values = (int *)stats_malloc(cap * sizeof(int));
+    m->used = (unsigned char *)stats_calloc(cap, 1);
+}
+
+// intmap_free() - Releases all memory owned by the map
+void intmap_free(IntMap *m)
+{
+    free(m->keys);
+    free(m->values);
+    free(m->used);
+    memset(m, 0, sizeof(*m));
+}
+
+// intmap_slot() - Finds the slot holding key, or the empty slot where it belongs
+static uint32_t intmap_slot(const IntMap *m, int key)
+{
+    uint32_t i = (uint32_t)hash_id(key) & (m->capacity - 1);
+    while (m->used[i] && m->keys[i] != key)
+        i = (i + 1) & (m->capacity - 1);
+    return i;
+}
+
+// intmap_get() - Copies the value of key into *value, returns 1 if found and 0 if not
+int intmap_get(const IntMap *m, int key, int *value)
+{
+    if (m->capacity == 0)
+        return 0;
+    uint32_t i = intmap_slot(m, key);
+    if (!m->used[i])
+        return 0;
+    *value = m->values[i];
+    return 1;
+}
+
+// intmap_put() - Stores value under key, replacing any previous value
+void intmap_put(IntMap *m, int key, int value)
+{
+    if (m->capacity == 0)
+        intmap_init(m, 8);
+    if ((m->count + 1) * 2 > m->capacity)  // Grow before the table gets too full
+    {
+        IntMap bigger;
+        intmap_init(&bigger, m->capacity);
+        for (uint32_t i = 0; i < m->capacity; i++)
+        {
+            if (m->used[i])
+                intmap_put(&bigger, m->keys[i], m->values[i]);
+        }
+        intmap_free(m);
+        *m = bigger;
+    }
+    uint32_t i = intmap_slot(m, key);
+    if (!m->used[i])
+    {
+        m->used[i] = 1;
+        m->keys[i] = key;
+        m->count++;
+    }
+    m->values[i] = value;
+}
+
+// ===== DICTIONARY ENCODING =====
+// A dictionary turns each distinct interned string into a dense code.
+// Because strings are interned first, the lookup key is just the offset.
+
+// dictionary_encode() - Returns the code for value, giving it the next code if it is new
+uint32_t dictionary_encode(Dictionary *d, StrRef value)
+{
+    int code;
+    if (intmap_get(&d->codes, (int)value, &code))
+        return (uint32_t)code;
+
+    if (d->count == d->capacity)  // Make room for one more code
+    {
+        d->capacity = d->capacity ? d->capacity * 2 : 64;
+        d->values = (StrRef *)stats_realloc(d->values, d->capacity * sizeof(StrRef));
+    }
+    d->values[d->count] = value;
+    intmap_put(&d->codes, (int)value, (int)d->count);
+    return d->count++;
+}
+
+// dictionary_value() - Returns the interned string offset for a code
+StrRef dictionary_value(const Dictionary *d, uint32_t code)
+{
+    return code < d->count ? d->values[code] : 0;
+}
+
+// disease_name() - Returns the text of a disease code
+const char *disease_name(uint32_t code)
+{
+    return str_of(dictionary_value(&disease_dictionary, code));
+}
+
+// ===== PATIENT ANALYTICS =====
+// Loads the patient file into encoded columns and answers every report with
+// one pass of array increments: no string compares, no per-group searching.
+
+// The group lists are sorted by count with qsort, which cannot pass the
+// counts array as an argument, so it is shared through this pointer
+static const int *rank_counts;
+
+// compare_by_count() - Orders group codes by their count, largest first
+static int compare_by_count(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    if (rank_counts[x] != rank_counts[y])
+        return rank_counts[x] < rank_counts[y] ? 1 : -1;
+    return x - y;
+}
+
+// ranked_groups() - Returns the codes 0..count-1 sorted by counts (largest first)
+static int *ranked_groups(const int *counts, int count)
+{
+    int *order = (int *)arena_alloc(&query_arena, (count > 0 ? count : 1) * sizeof(int));
+    for (int i = 0; i < count; i++)
+        order[i] = i;
+    rank_counts = counts;
+    qsort(order, count, sizeof(int), compare_by_count);
+    return order;
+}
+
+// patient_analytics() - Prints patient counts per disease, hospital, age group and the top conditions per city
+void patient_analytics()
+{
+    int top_n;  // How many conditions to show for each city
+    printf(GREEN "Enter how many top conditions to show per city: " RESET);
+    while (scanf("%d", &top_n) != 1 || top_n <= 0)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter how many top conditions to show per city: " RESET);
+    }
+    clear_input_buffer();
+
+    int n = count_records(PATIENT_FILE);
+    if (n == 0)
+    {
+        printf(RED "No patients found!\n" RESET);
+        return;
+    }
+    arena_reset(&query_arena);  // Reuse the memory of the previous query
+
+    // Hospitals: map each hospital ID to its row and each row to a dense city code
+    int hospital_count = count_records(HOSPITAL_FILE);
+    Hospital *hospitals = (Hospital *)arena_alloc(&query_arena, (hospital_count + 1) * sizeof(Hospital));
+    HospitalText *text = (HospitalText *)arena_alloc(&query_arena, (hospital_count + 1) * sizeof(HospitalText));
+    load_hospitals(hospitals, text, &hospital_count);
+
+    Dictionary cities = {0};  // Dense city codes for this report
+    IntMap hospital_rows = {0};  // hospital_id -> row (first record with an ID wins, like the lookups)
+    intmap_init(&hospital_rows, hospital_count);
+    int *city_of_row = (int *)arena_alloc(&query_arena, (hospital_count + 1) * sizeof(int));
+    for (int i = 0; i < hospital_count; i++)
+    {
+        int row;
+        if (!intmap_get(&hospital_rows, hospitals[i].hospital_id, &row))
+            intmap_put(&hospital_rows, hospitals[i].hospital_id, i);
+        city_of_row[i] = (int)dictionary_encode(&cities, hospitals[i].city);
+    }
+    int unknown_row = hospital_count;  // Extra group for patients whose hospital is missing
+    int unknown_city = (int)cities.count;  // Extra city group for the same patients
+    city_of_row[unknown_row] = unknown_city;
+
+    // Patients: keep only the encoded columns the reports need
+    uint32_t *disease_column = (uint32_t *)arena_alloc(&query_arena, n * sizeof(uint32_t));
+    int *age_column = (int *)arena_alloc(&query_arena, n * sizeof(int));
+    int *hospital_column = (int *)arena_alloc(&query_arena, n * sizeof(int));
+    FILE *fp = stats_fopen(PATIENT_FILE, "r");
+    if (!fp)
+    {
+        printf(RED "Error opening patient file, file not found.\n" RESET);
+        intmap_free(&hospital_rows);
+        intmap_free(&cities.codes);
+        free(cities.values);
+        return;
+    }
+    int rows = 0;
+    char line[LINE_SIZE];
+    while (rows < n && read_line(line, LINE_SIZE, fp))
+    {
+        Patient p;
+        if (!parse_patient_line(line, &p))
+            continue;
+        int row;
+        disease_column[rows] = p.disease;
+        age_column[rows] = p.age;
+        hospital_column[rows] = intmap_get(&hospital_rows, p.hospital_id, &row) ? row : unknown_row;
+        rows++;
+    }
+    fclose(fp);
+
+    // Counters: one array slot per group, plus a city x disease matrix
+    int disease_count = (int)disease_dictionary.count;
+    int city_groups = unknown_city + 1;
+    int *per_disease = (int *)arena_alloc(&query_arena, disease_count * sizeof(int));
+    int *per_hospital = (int *)arena_alloc(&query_arena, (hospital_count + 1) * sizeof(int));
+    int *per_age = (int *)arena_alloc(&query_arena, AGE_BUCKETS * sizeof(int));
+    int *per_city_disease = (int *)arena_alloc(&query_arena, (size_t)city_groups * disease_count * sizeof(int));
+    memset(per_disease, 0, disease_count * sizeof(int));
+    memset(per_hospital, 0, (hospital_count + 1) * sizeof(int));
+    memset(per_age, 0, AGE_BUCKETS * sizeof(int));
+    memset(per_city_disease, 0, (size_t)city_groups * disease_count * sizeof(int));
+
+    // The single aggregation pass: every report is updated from the same row
+    for (int i = 0; i < rows; i++)
+    {
+        int bucket = age_column[i] / AGE_BUCKET_WIDTH;
+        bucket = bucket < 0 ? 0 : (bucket >= AGE_BUCKETS ? AGE_BUCKETS - 1 : bucket);
+        per_disease[disease_column[i]]++;
+        per_hospital[hospital_column[i]]++;
+        per_age[bucket]++;
+        per_city_disease[(size_t)city_of_row[hospital_column[i]] * disease_count + disease_column[i]]++;
+    }
+
+    // Report 1: patients per disease
+    printf(MAGENTA BOLD "\n--- Patients per Disease/Condition ---\n" RESET);
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    printf("%-50s | %8s\n", "Disease/Condition", "Patients");
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    int *order = ranked_groups(per_disease, disease_count);
+    for (int i = 0; i < disease_count && per_disease[order[i]] > 0; i++)
+        printf(CYAN "%-50s | %8d\n" RESET, disease_name(order[i]), per_disease[order[i]]);
+
+    // Report 2: patients per hospital
+    printf(MAGENTA BOLD "\n--- Patients per Hospital ---\n" RESET);
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    printf("%5s | %-50s | %8s\n", "ID", "Hospital Name", "Patients");
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    order = ranked_groups(per_hospital, hospital_count + 1);
+    for (int i = 0; i <= hospital_count && per_hospital[order[i]] > 0; i++)
+    {
+        if (order[i] == unknown_row)
+            printf(CYAN "%5s | %-50s | %8d\n" RESET, "-", "Unknown", per_hospital[order[i]]);
+        else
+            printf(CYAN "%5d | %-50s | %8d\n" RESET, hospitals[order[i]].hospital_id,
+                   str_of(text[order[i]].hospital_name), per_hospital[order[i]]);
+    }
+
+    // Report 3: age histogram
+    printf(MAGENTA BOLD "\n--- Patients per Age Group ---\n" RESET);
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    for (int b = 0; b < AGE_BUCKETS; b++)
+    {
+        char label[16];
+        if (b == AGE_BUCKETS - 1)
+            snprintf(label, sizeof(label), "%d+", b * AGE_BUCKET_WIDTH);
+        else
+            snprintf(label, sizeof(label), "%d-%d", b * AGE_BUCKET_WIDTH, (b + 1) * AGE_BUCKET_WIDTH - 1);
+        printf(CYAN "%-8s | %8d | " RESET, label, per_age[b]);
+        int bar = rows > 0 ? (per_age[b] * 50 + rows - 1) / rows : 0;  // Bar length out of 50
+        for (int k = 0; k < bar; k++)
+            putchar('#');
+        putchar('\n');
+    }
+
+    // Report 4: top conditions per city
+    printf(MAGENTA BOLD "\n--- Top %d Conditions per City ---\n" RESET, top_n);
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    for (int c = 0; c < city_groups; c++)
+    {
+        int *counts = per_city_disease + (size_t)c * disease_count;
+        int total = 0;
+        for (int d = 0; d < disease_count; d++)
+            total += counts[d];
+        if (total == 0)
+            continue;  // No patients in this city
+        printf(YELLOW "%s (%d patients)\n" RESET, c == unknown_city ? "Unknown" : str_of(dictionary_value(&cities, c)), total);
+        order = ranked_groups(counts, disease_count);
+        for (int i = 0; i < top_n && i < disease_count && counts[order[i]] > 0; i++)
+            printf(CYAN "   %2d. %-45s | %8d\n" RESET, i + 1, disease_name(order[i]), counts[order[i]]);
+    }
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+
+    intmap_free(&hospital_rows);
+    intmap_free(&cities.codes);
+    free(cities.values);
+}
+
+// ===== TABLE RENDERER =====
+// Table rows are formatted by hand into one large buffer (no printf per row)
+// and written with a single fwrite whenever the buffer fills up. Colour codes
+// are only added when stdout is a real console, so redirected output stays clean.
+
+static OutputBuffer render_out;  // Shared output buffer for all tables
+static WorkerLock *render_lock;  // Held while rows are formatted, let go while the pager waits for a key (NULL = none)
+
+// stdout_is_terminal() - Returns 1 if stdout is an interactive console
+static int stdout_is_terminal()
+{
+#ifdef _WIN32
+    return _isatty(_fileno(stdout));
+#else
+    return isatty(fileno(stdout));
+#endif
+}
+
+// stdin_is_terminal() - Returns 1 if keys can be read interactively (needed by the pager)
+static int stdin_is_terminal()
+{
+#ifdef _WIN32
+    return _isatty(_fileno(stdin));
+#else
+    return isatty(fileno(stdin));
+#endif
+}
+
+// out_flush() - Writes everything collected so far with one large write
+static void out_flush()
+{
+    if (render_out.size > 0)
+    {
+        fflush(stdout);  // Keep order with anything printed by printf before
+        fwrite(render_out.data, 1, render_out.size, stdout);
+        fflush(stdout);
+        render_out.size = 0;
+    }
+}
+
+// out_bytes() - Appends length bytes to the buffer, flushing first if they would not fit
+static void out_bytes(const char *text, size_t length)
+{
+    if (render_out.size + length > RENDER_BUFFER_SIZE)
+        out_flush();
+    if (length > RENDER_BUFFER_SIZE)  // Too big to buffer at all
+    {
+        fwrite(text, 1, length, stdout);
+        return;
+    }
+    memcpy(render_out.data + render_out.size, text, length);
+    render_out.size += length;
+}
+
+// out_text() - Appends a zero-terminated string
+static void out_text(const char *text)
+{
+    out_bytes(text, strlen(text));
+}
+
+// out_color() - Appends a colour escape code when colours are enabled
+static void out_color(const char *code)
+{
+    if (render_out.color)
+        out_text(code);
+}
+
+// out_spaces() - Appends count spaces
+static void out_spaces(int count)
+{
+    static const char spaces[] = "                                                  ";  // 50 spaces
+    while (count > 0)
+    {
+        int chunk = count < 50 ? count : 50;
+        out_bytes(spaces, chunk);
+        count -= chunk;
+    }
+}
+
+// out_padded() - Appends text padded to width (like %-Ns when left is 1, %Ns otherwise)
+// Longer text is not cut, exactly like printf
+static void out_padded(const char *text, int width, int left)
+{
+    int length = (int)strlen(text);
+    if (!left)
+        out_spaces(width - length);
+    out_bytes(text, length);
+    if (left)
+        out_spaces(width - length);
+}
+
+// format_integer() - Writes the digits of value into buffer, returns the length
+static int format_integer(long long value, char *buffer)
+{
+    char digits[24];
+    int count = 0, length = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do  // Produce digits from the right
+    {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0)
+        buffer[length++] = '-';
+    while (count > 0)
+        buffer[length++] = digits[--count];
+    buffer[length] = '\0';
+    return length;
+}
+
+// out_int() - Appends an integer padded to width (like %Nd, or %-Nd when left is 1)
+static void out_int(long long value, int width, int left)
+{
+    char buffer[24];
+    format_integer(value, buffer);
+    out_padded(buffer, width, left);
+}
+
+// out_fixed() - Appends a number with a fixed number of decimals (like %N.Df)
+static void out_fixed(double value, int decimals, int width)
+{
+    long long scale = 1;
+    for (int i = 0; i < decimals; i++)
+        scale *= 10;
+    int negative = value < 0;
+    long long scaled = (long long)((negative ? -value : value) * scale + 0.5);  // Round half up
+
+    char buffer[40];
+    int length = 0;
+    if (negative && scaled != 0)
+        buffer[length++] = '-';
+    length += format_integer(scaled / scale, buffer + length);
+    if (decimals > 0)
+    {
+        buffer[length++] = '.';
+        long long fraction = scaled % scale;
+        for (long long place = scale / 10; place > 0; place /= 10)  // Keep leading zeros
+            buffer[length++] = (char)('0' + (fraction / place) % 10);
+    }
+    buffer[length] = '\0';
+    out_padded(buffer, width, 0);
+}
+
+// render_table() - Prints count rows of a table
+// On an interactive console with more than one page of rows, only the visible
+// page is formatted and the user moves with n (next), p (previous) and q (quit).
+// Otherwise every row is formatted into the buffer and written in large chunks.
+void render_table(void (*header)(void), RowRenderer row, const void *table, int count)
+{
+    int interactive = stdout_is_terminal();
+    render_out.color = interactive;
+
+    if (!interactive || !stdin_is_terminal() || count <= PAGE_ROWS)
+    {
+        header();
+        for (int i = 0; i < count; i++)
+            row(i, table);
+        out_text("-------------------------------------------------------------------------------------------------------------------\n");
+        out_flush();
+        return;
+    }
+
+    int pages = (count + PAGE_ROWS - 1) / PAGE_ROWS;
+    int page = 0;
+    while (1)
+    {
+        int first = page * PAGE_ROWS;
+        int last = first + PAGE_ROWS < count ? first + PAGE_ROWS : count;
+        header();
+        for (int i = first; i < last; i++)
+            row(i, table);
+        out_text("-------------------------------------------------------------------------------------------------------------------\n");
+        out_flush();
+
+        printf(YELLOW "Rows %d-%d of %d (page %d/%d)  [n] next  [p] previous  [q] quit: " RESET,
+               first + 1, last, count, page + 1, pages);
+        if (render_lock)
+            lock_release(render_lock);  // Nobody waits for the lock while the user reads the page
+        int key = getch();
+        if (render_lock)
+            lock_acquire(render_lock);
+        printf("\n");
+        if (key == 'q' || key == 'Q' || key == 27)  // q or Escape leaves the pager
+            break;
+        if (key == 'p' || key == 'P')
+        {
+            if (page > 0)
+                page--;
+        }
+        else if (page == pages - 1)
+        {
+            break;  // Moving past the last page ends the listing
+        }
+        else
+        {
+            page++;
+        }
+    }
+}
+
+// HospitalTableView structure: what render_hospital_row needs to find a row
+typedef struct
+{
+    const Hospital *hot;       // Hot hospital table
+    const HospitalText *text;  // Cold text table
+    const int *order;          // Row numbers in display order (NULL = table order)
+    const float *score;        // Quality score per row (NULL = no score column)
+} HospitalTableView;
+
+static int hospital_table_scored;  // 1 while a table with a score column is printed
+
+// Table columns generated from the RECORD SCHEMAS lists (fields with width 0 are skipped).
+// separator is a local of the renderer: nothing before the first column, " | " after that.
+#define COLUMN_TITLE(record, member, kind, decimals, title, width, left) \
+    if (width > 0)                                                      \
+    {                                                                   \
+        out_text(separator);                                            \
+        out_padded(title, width, left);                                 \
+        separator = " | ";                                              \
+    }
+#define COLUMN_VALUE(record, member, kind, decimals, title, width, left) \
+    if (width > 0)                                                      \
+    {                                                                   \
+        out_text(separator);                                            \
+        SHOW_##kind(record->member, decimals, width, left);             \
+        separator = " | ";                                              \
+    }
+#define SHOW_INT(field, decimals, width, left) out_int(field, width, left)
+#define SHOW_FLOAT(field, decimals, width, left) out_fixed(field, decimals, width)
+#define SHOW_TEXT(field, decimals, width, left) out_padded(str_of(field), width, left)
+#define SHOW_DISEASE(field, decimals, width, left) out_padded(disease_name(field), width, left)
+#define SHOW_CHARS(field, decimals, width, left) out_padded(field, width, left)
+
+// COLUMN_FROM_TEXT: same column, but shown straight from the text field f[n] of an unparsed line
+#define COLUMN_FROM_TEXT(record, member, kind, decimals, title, width, left) \
+    if (width > 0)                                                          \
+    {                                                                       \
+        out_text(separator);                                                \
+        SHOW_TEXT_##kind(f[n], decimals, width, left);                      \
+        separator = " | ";                                                  \
+    }                                                                       \
+    n++;
+#define SHOW_TEXT_INT(text, decimals, width, left) out_int(atoi(text), width, left)
+#define SHOW_TEXT_FLOAT(text, decimals, width, left) out_fixed(strtof(text, NULL), decimals, width)
+#define SHOW_TEXT_TEXT(text, decimals, width, left) out_padded(text, width, left)
+#define SHOW_TEXT_DISEASE(text, decimals, width, left) out_padded(text, width, left)
+
+// render_hospital_header() - Appends the column titles of the hospital table
+static void render_hospital_header()
+{
+    const char *separator = "";
+    out_text("\n\n-------------------------------------------------------------------------------------------------------------------\n");
+    HOSPITAL_FIELDS(COLUMN_TITLE)
+    if (hospital_table_scored)
+    {
+        out_text(" | ");
+        out_padded("Score", 5, 0);
+    }
+    out_text("\n-------------------------------------------------------------------------------------------------------------------\n");
+}
+
+// render_hospital_row() - Appends one hospital row (same layout as the old printf)
+static void render_hospital_row(int index, const void *table)
+{
+    const HospitalTableView *view = (const HospitalTableView *)table;
+    int r = view->order ? view->order[index] : index;
+    const Hospital *h = &view->hot[r];
+    const HospitalText *t = &view->text[r];
+    const char *separator = "";
+
+    out_color(CYAN);
+    HOSPITAL_FIELDS(COLUMN_VALUE)
+    if (view->score)
+    {
+        out_text(" | ");
+        out_fixed(view->score[r], 2, 5);
+    }
+    out_color(RESET);
+    out_bytes("\n", 1);
+}
+
+// render_hospital_table() - Prints hospital rows in the given order (NULL = table order)
+void render_hospital_table(const Hospital *hot, const HospitalText *text, const int *order, int count)
+{
+    HospitalTableView view = {hot, text, order, NULL};
+    render_table(render_hospital_header, render_hospital_row, &view, count);
+}
+
+// render_scored_hospital_table() - Same table with an extra score column
+void render_scored_hospital_table(const Hospital *hot, const HospitalText *text, const int *order, const float *score, int count)
+{
+    HospitalTableView view = {hot, text, order, score};
+    hospital_table_scored = 1;
+    render_table(render_hospital_header, render_hospital_row, &view, count);
+    hospital_table_scored = 0;
+}
+
+// render_patient_header() - Appends the column titles of the patient table
+static void render_patient_header()
+{
+    const char *separator = "";
+    out_text("\n\n-------------------------------------------------------------------------------------------------------------------\n");
+    PATIENT_FIELDS(COLUMN_TITLE)
+    out_text(" | Hospital\n-------------------------------------------------------------------------------------------------------------------\n");
+}
+
+static const StrRef *patient_table_names;  // Hospital name per patient row while a named table is printed
+
+// render_patient_row() - Appends one patient row with the name of its hospital
+static void render_patient_row(int index, const void *table)
+{
+    const Patient *p = &((const Patient *)table)[index];
+    const char *h_name = patient_table_names ? str_of(patient_table_names[index])  // Looked up already
+                                             : get_hospital_name_by_id(p->hospital_id);  // Get hospital name for this patient
+
+    const char *separator = "";
+
+    out_color(CYAN);
+    PATIENT_FIELDS(COLUMN_VALUE)
+    out_text(" | ");
+    out_text(h_name);
+    out_color(RESET);
+    out_bytes("\n", 1);
+}
+
+// render_patient_table() - Prints patient rows in table order
+void render_patient_table(const Patient *patients, int count)
+{
+    render_table(render_patient_header, render_patient_row, patients, count);
+}
+
+// render_named_patient_table() - Same table with the hospital names already looked up
+void render_named_patient_table(const Patient *patients, const StrRef *hospital_names, int count)
+{
+    patient_table_names = hospital_names;
+    render_table(render_patient_header, render_patient_row, patients, count);
+    patient_table_names = NULL;
+}
+
+// ===== STATISTICS =====
+// Every operation is timed into a latency histogram and file/memory activity is
+// counted. Recording costs two timestamp reads and a few additions, so it is
+// always on. Stats are shown from System Tools and written to STATS_FILE every
+// STATS_DUMP_INTERVAL seconds and on exit, in Prometheus text format.
+
+static const char *operation_names[OP_COUNT] = {"load", "parse", "sort", "filter", "lookup", "insert", "login", "scan", "search", "update", "nearest", "schedule", "history"};
+
+// now_nanoseconds() - Returns a high resolution timestamp in nanoseconds
+static uint64_t now_nanoseconds()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;  // Ticks per second, read once
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// histogram_bucket() - Returns the bucket number for a timing in nanoseconds
+static int histogram_bucket(uint64_t ns)
+{
+    if (ns < HISTOGRAM_SUB_BUCKETS)
+        return (int)ns;  // Small values get one bucket each
+    int top_bit = 63;
+    while (!(ns >> top_bit))  // Position of the highest set bit
+        top_bit--;
+    int shift = top_bit - 3;  // Keep 3 bits below the top bit (8 sub-buckets)
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)((ns >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// histogram_bucket_value() - Returns the smallest nanosecond value that falls in a bucket
+static uint64_t histogram_bucket_value(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return (uint64_t)bucket;
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+// histogram_percentile() - Returns the timing (ns) below which percent of the samples fall
+static uint64_t histogram_percentile(const LatencyHistogram *h, double percent)
+{
+    if (h->count == 0)
+        return 0;
+    uint64_t target = (uint64_t)(h->count * percent / 100.0 + 0.5);
+    if (target == 0)
+        target = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+        if (seen >= target)
+        {
+            uint64_t value = histogram_bucket_value(b);
+            return value < h->max_ns ? value : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// stats_start() - Returns the start time of an operation (pass it to stats_record)
+uint64_t stats_start()
+{
+    return now_nanoseconds();
+}
+
+// stats_record() - Adds the time since started to the histogram of an operation
+void stats_record(int operation, uint64_t started)
+{
+    uint64_t elapsed = now_nanoseconds() - started;
+    LatencyHistogram *h = &stats.latency[operation];
+    h->buckets[histogram_bucket(elapsed)]++;
+    h->count++;
+    h->total_ns += elapsed;
+    if (elapsed > h->max_ns)
+        h->max_ns = elapsed;
+
+    // Periodic dump, checked here so no timer thread is needed
+    double now = (double)(started + elapsed) / 1e9;
+    if (now - stats.last_dump >= STATS_DUMP_INTERVAL)
+        dump_stats();
+}
+
+// stats_fopen() - Opens a data file and counts the open
+FILE *stats_fopen(const char *filename, const char *mode)
+{
+    persist_wait_for_file(filename);  // A data file is only read after its queued lines are written
+    stats.file_opens++;
+    return fopen(filename, mode);
+}
+
+// read_line() - Reads one line like fgets and counts the bytes read
+char *read_line(char *line, int size, FILE *fp)
+{
+    char *result = fgets(line, size, fp);
+    if (result)
+        stats.bytes_read += strlen(line);
+    return result;
+}
+
+// stats_malloc() / stats_calloc() / stats_realloc() - Heap allocation with counting
+void *stats_malloc(size_t bytes)
+{
+    stats.heap_allocations++;
+    return malloc(bytes);
+}
+
+void *stats_calloc(size_t count, size_t bytes)
+{
+    stats.heap_allocations++;
+    return calloc(count, bytes);
+}
+
+void *stats_realloc(void *ptr, size_t bytes)
+{
+    stats.heap_allocations++;
+    return realloc(ptr, bytes);
+}
+
+// show_stats() - Prints the latency percentiles of every operation and the I/O counters
+void show_stats()
+{
+    printf(MAGENTA BOLD "\n--- Performance Statistics (%.0f seconds) ---\n" RESET, now_seconds() - stats.started_at);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    printf("\n-------------------------------------------------------------------------------------------------------------------\n");
+    printf("%-10s | %10s | %12s | %12s | %12s | %12s | %12s\n", "Operation", "Count", "Mean us", "p50 us", "p90 us", "p99 us", "Max us");
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        const LatencyHistogram *h = &stats.latency[op];
+        printf(CYAN "%-10s | %10llu | %12.2f | %12.2f | %12.2f | %12.2f | %12.2f\n" RESET,
+               operation_names[op], (unsigned long long)h->count,
+               h->count ? h->total_ns / 1000.0 / h->count : 0.0,
+               histogram_percentile(h, 50) / 1000.0, histogram_percentile(h, 90) / 1000.0,
+               histogram_percentile(h, 99) / 1000.0, h->max_ns / 1000.0);
+    }
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    printf(CYAN "File opens:        %llu\n" RESET, (unsigned long long)stats.file_opens);
+    printf(CYAN "Bytes read:        %llu\n" RESET, (unsigned long long)stats.bytes_read);
+    printf(CYAN "Records parsed:    %llu\n" RESET, (unsigned long long)stats.records_parsed);
+    printf(CYAN "Heap allocations:  %llu\n" RESET, (unsigned long long)stats.heap_allocations);
+    printf(CYAN "Arena allocations: %llu\n" RESET, (unsigned long long)stats.arena_allocations);
+    printf(CYAN "View cache:        %llu hits, %llu misses, %llu invalidated, %llu evicted (%d views, %.1f of %d KB)\n" RESET,
+           (unsigned long long)view_cache.hits, (unsigned long long)view_cache.misses,
+           (unsigned long long)view_cache.invalidations, (unsigned long long)view_cache.evictions,
+           view_cache.count, view_cache.bytes / 1024.0, VIEW_CACHE_BUDGET / 1024);
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    printf(YELLOW "Statistics are also written to %s every %d seconds and on exit.\n" RESET, STATS_FILE, STATS_DUMP_INTERVAL);
+}
+
+// dump_stats() - Writes all statistics to STATS_FILE in Prometheus text format
+// Example lines:  hms_latency_us{op="sort",quantile="0.99"} 12.5
+//                 hms_file_opens_total 42
+void dump_stats()
+{
+    stats.last_dump = now_seconds();
+    FILE *fp = fopen(STATS_FILE, "w");  // Plain fopen: the dump itself is not counted
+    if (!fp)
+        return;
+
+    static const double quantiles[] = {50, 90, 99, 99.9};
+    fprintf(fp, "# Hospital Management System statistics\n");
+    fprintf(fp, "hms_uptime_seconds %.0f\n", stats.last_dump - stats.started_at);
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        const LatencyHistogram *h = &stats.latency[op];
+        for (int q = 0; q < 4; q++)
+            fprintf(fp, "hms_latency_us{op=\"%s\",quantile=\"%g\"} %.3f\n",
+                    operation_names[op], quantiles[q] / 100.0, histogram_percentile(h, quantiles[q]) / 1000.0);
+        fprintf(fp, "hms_latency_us_max{op=\"%s\"} %.3f\n", operation_names[op], h->max_ns / 1000.0);
+        fprintf(fp, "hms_latency_us_sum{op=\"%s\"} %.3f\n", operation_names[op], h->total_ns / 1000.0);
+        fprintf(fp, "hms_latency_us_count{op=\"%s\"} %llu\n", operation_names[op], (unsigned long long)h->count);
+    }
+    fprintf(fp, "hms_file_opens_total %llu\n", (unsigned long long)stats.file_opens);
+    fprintf(fp, "hms_bytes_read_total %llu\n", (unsigned long long)stats.bytes_read);
+    fprintf(fp, "hms_records_parsed_total %llu\n", (unsigned long long)stats.records_parsed);
+    fprintf(fp, "hms_heap_allocations_total %llu\n", (unsigned long long)stats.heap_allocations);
+    fprintf(fp, "hms_arena_allocations_total %llu\n", (unsigned long long)stats.arena_allocations);
+    fprintf(fp, "hms_view_cache_hits_total %llu\n", (unsigned long long)view_cache.hits);
+    fprintf(fp, "hms_view_cache_misses_total %llu\n", (unsigned long long)view_cache.misses);
+    fprintf(fp, "hms_view_cache_invalidations_total %llu\n", (unsigned long long)view_cache.invalidations);
+    fprintf(fp, "hms_view_cache_evictions_total %llu\n", (unsigned long long)view_cache.evictions);
+    fprintf(fp, "hms_view_cache_bytes %llu\n", (unsigned long long)view_cache.bytes);
+    fclose(fp);
+}
+
+// ===== B+ TREE INDEX FILES =====
+// A B+ tree stored in fixed-size pages on disk. Keys and values are 64-bit
+// numbers: the patient ID (or hospital ID + patient ID) and the byte offset of
+// the record line in patients.txt. Page 0 holds the IndexMeta header. Lookups
+// walk 3-4 pages even with tens of millions of keys, and recently used pages
+// stay in an in-memory cache, so a point lookup costs a few microseconds.
+
+// index_page_size_check: compile error if the page structures do not fit a page
+typedef char index_page_size_check[(sizeof(IndexPage) == INDEX_PAGE_SIZE && sizeof(IndexMeta) <= INDEX_PAGE_SIZE) ? 1 : -1];
+
+// btree_write_page() - Writes one page to the file and refreshes its cache slot
+// Returns 0 (and marks the tree as failed) if the page could not be written
+static int btree_write_page(BPlusTree *t, int64_t page_no, const IndexPage *page)
+{
+    int slot = (int)(page_no % INDEX_CACHE_PAGES);
+    t->cache[slot] = *page;
+    t->cached[slot] = page_no;
+    if (!t->fp || file_seek(t->fp, page_no * INDEX_PAGE_SIZE, SEEK_SET) != 0 ||
+        fwrite(page, INDEX_PAGE_SIZE, 1, t->fp) != 1)
+    {
+        t->write_failed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// btree_page() - Returns a page from the cache, reading it from disk if needed
+// The pointer is only valid until the next btree_page() call
+static const IndexPage *btree_page(BPlusTree *t, int64_t page_no)
+{
+    int slot = (int)(page_no % INDEX_CACHE_PAGES);
+    if (t->cached[slot] != page_no)
+    {
+        file_seek(t->fp, page_no * INDEX_PAGE_SIZE, SEEK_SET);
+        if (fread(&t->cache[slot], INDEX_PAGE_SIZE, 1, t->fp) != 1)
+            memset(&t->cache[slot], 0, sizeof(IndexPage));
+        t->cached[slot] = page_no;
+        stats.bytes_read += INDEX_PAGE_SIZE;
+    }
+    return &t->cache[slot];
+}
+
+// btree_write_meta() - Saves the header page
+// Returns 0 (and marks the tree as failed) if the header could not be written
+static int btree_write_meta(BPlusTree *t)
+{
+    char page[INDEX_PAGE_SIZE] = {0};
+    memcpy(page, &t->meta, sizeof(IndexMeta));
+    if (!t->fp || file_seek(t->fp, 0, SEEK_SET) != 0 || fwrite(page, INDEX_PAGE_SIZE, 1, t->fp) != 1 ||
+        fflush(t->fp) != 0)
+    {
+        t->write_failed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// key_position() - Number of keys in keys[0..count-1] that are < key (or <= key when after_equal is 1)
+static int key_position(const int64_t *keys, int count, int64_t key, int after_equal)
+{
+    int low = 0, high = count;
+    while (low < high)  // Binary search
+    {
+        int mid = (low + high) / 2;
+        if (keys[mid] < key || (after_equal && keys[mid] == key))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// btree_find_leaf() - Walks from the root to the leaf that may hold key
+static int64_t btree_find_leaf(BPlusTree *t, int64_t key)
+{
+    int64_t page_no = t->meta.root;
+    const IndexPage *page = btree_page(t, page_no);
+    while (!page->is_leaf)
+    {
+        int pos = key_position(page->keys, page->count, key, 1);  // Keys equal to a separator live on its right
+        page_no = pos == 0 ? page->next : page->values[pos - 1];
+        page = btree_page(t, page_no);
+    }
+    return page_no;
+}
+
+// btree_search() - Finds key and copies its value into *value, returns 1 if found
+int btree_search(BPlusTree *t, int64_t key, int64_t *value)
+{
+    if (t->meta.entries == 0)
+        return 0;
+    const IndexPage *leaf = btree_page(t, btree_find_leaf(t, key));
+    int pos = key_position(leaf->keys, leaf->count, key, 0);
+    if (pos < leaf->count && leaf->keys[pos] == key)
+    {
+        *value = leaf->values[pos];
+        return 1;
+    }
+    return 0;
+}
+
+// btree_seek() - Positions a cursor on the first key >= key
+void btree_seek(BPlusTree *t, int64_t key, IndexCursor *cursor)
+{
+    cursor->tree = t;
+    if (t->meta.entries == 0)
+    {
+        cursor->page = 0;  // Page 0 is the header, so it marks the end
+        return;
+    }
+    cursor->page = btree_find_leaf(t, key);
+    const IndexPage *leaf = btree_page(t, cursor->page);
+    cursor->index = key_position(leaf->keys, leaf->count, key, 0);
+}
+
+// btree_next() - Copies the key/value under the cursor and moves it forward
+// Returns 0 when there are no more entries
+int btree_next(IndexCursor *cursor, int64_t *key, int64_t *value)
+{
+    while (cursor->page != 0)
+    {
+        const IndexPage *leaf = btree_page(cursor->tree, cursor->page);
+        if (cursor->index < leaf->count)
+        {
+            *key = leaf->keys[cursor->index];
+            *value = leaf->values[cursor->index];
+            cursor->index++;
+            return 1;
+        }
+        cursor->page = leaf->next;  // Continue in the next leaf (0 = none)
+        cursor->index = 0;
+    }
+    return 0;
+}
+
+// btree_insert_into() - Inserts into the subtree at page_no
+// Returns 1 and fills *split_key / *split_page when the page had to be split,
+// 0 when it did not, and -1 when the key already existed
+static int btree_insert_into(BPlusTree *t, int64_t page_no, int64_t key, int64_t value,
+                             int64_t *split_key, int64_t *split_page)
+{
+    IndexPage node = *btree_page(t, page_no);  // Private copy, other pages are read below
+    int pos;
+
+    if (node.is_leaf)
+    {
+        pos = key_position(node.keys, node.count, key, 0);
+        if (pos < node.count && node.keys[pos] == key)
+            return -1;  // Keys are unique
+    }
+    else
+    {
+        pos = key_position(node.keys, node.count, key, 1);
+        int64_t child = pos == 0 ? node.next : node.values[pos - 1];
+        int result = btree_insert_into(t, child, key, value, &key, &value);
+        if (result <= 0)
+            return result;  // Child did not split, nothing to add here
+        // The child split: add its separator key and new right page at pos
+    }
+
+    // Build the key/value list with the new entry in place (one more than a page holds)
+    int64_t keys[INDEX_NODE_CAPACITY + 1], values[INDEX_NODE_CAPACITY + 1];
+    memcpy(keys, node.keys, pos * sizeof(int64_t));
+    memcpy(values, node.values, pos * sizeof(int64_t));
+    keys[pos] = key;
+    values[pos] = value;
+    memcpy(keys + pos + 1, node.keys + pos, (node.count - pos) * sizeof(int64_t));
+    memcpy(values + pos + 1, node.values + pos, (node.count - pos) * sizeof(int64_t));
+    int total = node.count + 1;
+
+    if (total <= INDEX_NODE_CAPACITY)  // Still fits
+    {
+        memcpy(node.keys, keys, total * sizeof(int64_t));
+        memcpy(node.values, values, total * sizeof(int64_t));
+        node.count = (uint16_t)total;
+        btree_write_page(t, page_no, &node);
+        return 0;
+    }
+
+    // Split into two pages
+    IndexPage right;
+    memset(&right, 0, sizeof(right));
+    right.is_leaf = node.is_leaf;
+    int64_t right_no = t->meta.page_count++;
+    int half = total / 2;
+
+    if (node.is_leaf)
+    {
+        // Leaf: left keeps the first half, right gets the rest, the separator is copied up
+        node.count = (uint16_t)half;
+        right.count = (uint16_t)(total - half);
+        memcpy(right.keys, keys + half, right.count * sizeof(int64_t));
+        memcpy(right.values, values + half, right.count * sizeof(int64_t));
+        right.next = node.next;  // Keep the leaf chain in key order
+        node.next = right_no;
+        *split_key = right.keys[0];
+    }
+    else
+    {
+        // Branch: the middle key moves up, its child becomes the leftmost child of the right page
+        node.count = (uint16_t)half;
+        right.next = values[half];
+        right.count = (uint16_t)(total - half - 1);
+        memcpy(right.keys, keys + half + 1, right.count * sizeof(int64_t));
+        memcpy(right.values, values + half + 1, right.count * sizeof(int64_t));
+        *split_key = keys[half];
+    }
+    memcpy(node.keys, keys, half * sizeof(int64_t));
+    memcpy(node.values, values, half * sizeof(int64_t));
+    btree_write_page(t, page_no, &node);
+    btree_write_page(t, right_no, &right);
+    *split_page = right_no;
+    return 1;
+}
+
+// btree_insert() - Adds key -> value, returns 0 if the key was already present
+int btree_insert(BPlusTree *t, int64_t key, int64_t value)
+{
+    int64_t split_key, split_page;
+    int result = btree_insert_into(t, t->meta.root, key, value, &split_key, &split_page);
+    if (result < 0)
+        return 0;
+    if (result == 1)  // The root split, so the tree grows one level
+    {
+        IndexPage root;
+        memset(&root, 0, sizeof(root));
+        root.next = t->meta.root;
+        root.keys[0] = split_key;
+        root.values[0] = split_page;
+        root.count = 1;
+        t->meta.root = t->meta.page_count++;
+        btree_write_page(t, t->meta.root, &root);
+    }
+    t->meta.entries++;
+    return 1;
+}
+
+// compare_index_entries() - Orders IndexEntry items by key, then by value
+static int compare_index_entries(const void *a, const void *b)
+{
+    const IndexEntry *x = (const IndexEntry *)a, *y = (const IndexEntry *)b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->value < y->value ? -1 : (x->value > y->value);
+}
+
+// btree_build() - Creates a new index file from count entries (any order)
+// Entries are sorted, duplicate keys keep their smallest value (the first
+// record in the file), then the tree is built bottom-up with pages 90% full
+// so later inserts do not split straight away.
+// Returns 0 if the index file could not be created or written
+int btree_build(BPlusTree *t, IndexEntry *entries, int64_t count, int64_t source_size)
+{
+    if (t->fp)
+        fclose(t->fp);
+    t->fp = stats_fopen(t->filename, "w+b");
+    for (int i = 0; i < INDEX_CACHE_PAGES; i++)
+        t->cached[i] = -1;
+    memset(&t->meta, 0, sizeof(t->meta));
+    t->write_failed = 0;
+    if (!t->fp)  // Read-only folder, locked file, ...
+    {
+        t->write_failed = 1;
+        return 0;
+    }
+    t->meta.magic = INDEX_MAGIC;
+    t->meta.page_size = INDEX_PAGE_SIZE;
+    t->meta.page_count = 1;  // Page 0 is the header
+    t->meta.source_size = source_size;
+
+    qsort(entries, count, sizeof(IndexEntry), compare_index_entries);
+    int64_t unique = 0;
+    for (int64_t i = 0; i < count; i++)  // Drop duplicate keys
+    {
+        if (unique == 0 || entries[unique - 1].key != entries[i].key)
+            entries[unique++] = entries[i];
+    }
+    t->meta.entries = unique;
+
+    int fill = INDEX_NODE_CAPACITY * 9 / 10;
+    IndexPage page;
+
+    // Leaf level, remembering the first key and page number of every leaf
+    int64_t level_count = unique > 0 ? (unique + fill - 1) / fill : 1;
+    IndexEntry *level = (IndexEntry *)stats_malloc(level_count * sizeof(IndexEntry));
+    int64_t first_page = t->meta.page_count;
+    for (int64_t l = 0; l < level_count; l++)
+    {
+        memset(&page, 0, sizeof(page));
+        page.is_leaf = 1;
+        int64_t start = l * fill;
+        int64_t end = start + fill < unique ? start + fill : unique;
+        for (int64_t i = start; i < end; i++)
+        {
+            page.keys[page.count] = entries[i].key;
+            page.values[page.count++] = entries[i].value;
+        }
+        page.next = l + 1 < level_count ? first_page + l + 1 : 0;
+        level[l].key = page.count > 0 ? page.keys[0] : 0;
+        level[l].value = t->meta.page_count++;
+        btree_write_page(t, level[l].value, &page);
+    }
+
+    // Branch levels: each branch page points at up to fill + 1 pages of the level below
+    while (level_count > 1)
+    {
+        int64_t parents = (level_count + fill) / (fill + 1);
+        for (int64_t p = 0; p < parents; p++)
+        {
+            memset(&page, 0, sizeof(page));
+            int64_t start = p * (fill + 1);
+            int64_t end = start + fill + 1 < level_count ? start + fill + 1 : level_count;
+            page.next = level[start].value;  // Leftmost child
+            for (int64_t i = start + 1; i < end; i++)
+            {
+                page.keys[page.count] = level[i].key;
+                page.values[page.count++] = level[i].value;
+            }
+            int64_t page_no = t->meta.page_count++;
+            btree_write_page(t, page_no, &page);
+            level[p].key = level[start].key;
+            level[p].value = page_no;
+        }
+        level_count = parents;
+    }
+    t->meta.root = level[0].value;
+    free(level);
+    btree_write_meta(t);
+    return !t->write_failed;
+}
+
+// btree_open() - Opens an index file, returns 1 if it is valid and matches source_size
+// Returns 0 when the file is missing, damaged or out of date and must be rebuilt
+int btree_open(BPlusTree *t, const char *filename, int64_t source_size)
+{
+    t->filename = filename;
+    if (!t->cache)
+    {
+        t->cache = (IndexPage *)stats_malloc(INDEX_CACHE_PAGES * sizeof(IndexPage));
+        t->cached = (int64_t *)stats_malloc(INDEX_CACHE_PAGES * sizeof(int64_t));
+    }
+    for (int i = 0; i < INDEX_CACHE_PAGES; i++)
+        t->cached[i] = -1;  // Nothing cached yet
+
+    if (!t->fp)
+        t->fp = stats_fopen(filename, "r+b");
+    if (!t->fp)
+        return 0;
+    t->write_failed = 0;
+    file_seek(t->fp, 0, SEEK_SET);  // The file may have been open already
+    if (fread(&t->meta, sizeof(IndexMeta), 1, t->fp) != 1 || t->meta.magic != INDEX_MAGIC ||
+        t->meta.page_size != INDEX_PAGE_SIZE || t->meta.source_size != source_size)
+        return 0;
+    return 1;
+}
+
+// ===== PATIENT INDEXES =====
+// patient_id_index:       patient_id                      -> offset of the line in patients.txt
+// patient_hospital_index: (hospital_id, patient_id) pair  -> offset of the line in patients.txt
+// Both files remember the size of patients.txt they describe; if the file was
+// changed by something else they are rebuilt with one scan on first use.
+
+static BPlusTree patient_id_index;        // Primary index on patient_id
+static BPlusTree patient_hospital_index;  // Secondary index on hospital_id
+static FILE *patient_data;                // Read handle for fetching indexed records
+static int patient_indexes_ready;         // 1 once both indexes are open and current
+
+// hospital_patient_key() - Combines hospital and patient IDs into one sortable key
+// Sorting by this key groups patients by hospital, then orders them by patient ID
+int64_t hospital_patient_key(int hospital_id, int patient_id)
+{
+    return (int64_t)hospital_id * 4294967296LL + (int64_t)((uint32_t)patient_id ^ 0x80000000u);
+}
+
+// data_file_size() - Returns the size of a file in bytes (0 if it does not exist)
+static int64_t data_file_size(const char *filename)
+{
+    int64_t queued = persist_queued_size(filename);  // Lines still waiting for the writer thread count too
+    if (queued >= 0)
+        return queued;
+    FILE *fp = stats_fopen(filename, "rb");
+    if (!fp)
+        return 0;
+    file_seek(fp, 0, SEEK_END);
+    int64_t size = file_tell(fp);
+    fclose(fp);
+    return size;
+}
+
+// data_file_time() - Returns when a file was last modified, in the finest unit the system
+// keeps (0 if it does not exist, -1 while lines for it wait for the writer thread)
+static int64_t data_file_time(const char *filename)
+{
+    if (persist_queued_size(filename) >= 0)
+        return -1;  // The writer is about to change it
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &info))
+        return 0;
+    return (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat info;
+    if (stat(filename, &info) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    return (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+#endif
+}
+
+// open_patient_indexes() - Makes sure both patient indexes exist and are up to date
+// Returns 0 if the patient file cannot be read or the index files cannot be written
+int open_patient_indexes()
+{
+    persist_recover_failures();  // A failed background write leaves the indexes pointing past the file
+    int64_t size = data_file_size(PATIENT_FILE);
+    if (patient_indexes_ready && patient_id_index.meta.source_size == size &&
+        patient_hospital_index.meta.source_size == size)
+        return 1;  // Still describe patients.txt as it is now
+    patient_indexes_ready = 0;  // Changed outside the program (or never opened): check the files
+
+    int id_ok = btree_open(&patient_id_index, PATIENT_INDEX_FILE, size);
+    int hospital_ok = btree_open(&patient_hospital_index, PATIENT_HOSPITAL_INDEX_FILE, size);
+    if (!id_ok || !hospital_ok)
+    {
+        // Rebuild both from one scan, remembering where every line starts
+        int n = count_records(PATIENT_FILE);
+        IndexEntry *by_id = (IndexEntry *)stats_malloc((n + 1) * sizeof(IndexEntry));
+        IndexEntry *by_hospital = (IndexEntry *)stats_malloc((n + 1) * sizeof(IndexEntry));
+        int64_t count = 0, offset = 0;
+        FILE *fp = stats_fopen(PATIENT_FILE, "rb");  // Binary so offsets are exact bytes
+        if (fp)
+        {
+            char line[LINE_SIZE];
+            while (count < n && read_line(line, LINE_SIZE, fp))
+            {
+                int64_t line_start = offset;
+                offset += strlen(line);
+                Patient p;
+                if (!parse_patient_line(line, &p))
+                    continue;
+                by_id[count].key = p.patient_id;
+                by_id[count].value = line_start;
+                by_hospital[count].key = hospital_patient_key(p.hospital_id, p.patient_id);
+                by_hospital[count].value = line_start;
+                count++;
+            }
+            fclose(fp);
+        }
+        id_ok = btree_build(&patient_id_index, by_id, count, size);
+        hospital_ok = btree_build(&patient_hospital_index, by_hospital, count, size);
+        free(by_id);
+        free(by_hospital);
+        if (!id_ok || !hospital_ok)
+        {
+            printf(RED "Could not write the patient index files (%s, %s).\n" RESET, PATIENT_INDEX_FILE, PATIENT_HOSPITAL_INDEX_FILE);
+            return 0;  // Not ready: the next call tries again
+        }
+    }
+
+    if (patient_data)
+        fclose(patient_data);  // Its buffer may hold the file as it was before the change
+    patient_data = stats_fopen(PATIENT_FILE, "rb");
+    patient_indexes_ready = patient_data != NULL;
+    return patient_indexes_ready;
+}
+
+// invalidate_patient_indexes() - Makes the next open_patient_indexes() rebuild both index files
+void invalidate_patient_indexes()
+{
+    patient_indexes_ready = 0;
+    patient_id_index.meta.source_size = 0;
+    patient_hospital_index.meta.source_size = 0;
+    if (patient_id_index.fp)  // The header on disk must not match the file any more either
+        btree_write_meta(&patient_id_index);
+    if (patient_hospital_index.fp)
+        btree_write_meta(&patient_hospital_index);
+}
+
+// index_patient() - Adds a newly appended patient line to both indexes
+// offset is where the line starts and new_size is the file size after writing it
+void index_patient(const Patient *p, int64_t offset, int64_t new_size)
+{
+    if (!patient_indexes_ready)
+        return;  // Indexes will be rebuilt on first use
+    btree_insert(&patient_id_index, p->patient_id, offset);
+    btree_insert(&patient_hospital_index, hospital_patient_key(p->hospital_id, p->patient_id), offset);
+    if (!patient_id_index.write_failed && !patient_hospital_index.write_failed)
+    {
+        patient_id_index.meta.source_size = new_size;
+        patient_hospital_index.meta.source_size = new_size;
+        btree_write_meta(&patient_id_index);
+        btree_write_meta(&patient_hospital_index);
+    }
+    if (patient_id_index.write_failed || patient_hospital_index.write_failed)
+    {
+        // The headers on disk keep the old size, so the files are rebuilt on the next use
+        patient_indexes_ready = 0;
+        patient_id_index.meta.source_size = 0;
+        patient_hospital_index.meta.source_size = 0;
+    }
+}
+
+// read_patient_at() - Reads and parses the patient line starting at offset
+int read_patient_at(int64_t offset, Patient *p)
+{
+    char line[LINE_SIZE];
+    persist_wait_for_file(PATIENT_FILE);  // The line may still be waiting for the writer thread
+    file_seek(patient_data, offset, SEEK_SET);  // Seeking also drops stale buffered data
+    if (!read_line(line, LINE_SIZE, patient_data))
+        return 0;
+    return parse_patient_line(line, p);
+}
+
+// read_int() - Prompts until the user types a whole number
+static int read_int(const char *prompt)
+{
+    int value;
+    printf(GREEN "%s" RESET, prompt);
+    while (scanf("%d", &value) != 1)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "%s" RESET, prompt);
+    }
+    clear_input_buffer();
+    return value;
+}
+
+// scan_patient_index() - Collects the patients whose keys are in [from, to] into the query arena
+// Returns the number of patients found
+static int scan_patient_index(BPlusTree *index, int64_t from, int64_t to, Patient **result)
+{
+    int capacity = 64, count = 0;
+    Patient *patients = (Patient *)arena_alloc(&query_arena, capacity * sizeof(Patient));
+    IndexCursor cursor;
+    int64_t key, offset;
+
+    uint64_t started = stats_start();  // Time the range scan
+    btree_seek(index, from, &cursor);
+    while (btree_next(&cursor, &key, &offset) && key <= to)
+    {
+        if (count == capacity)  // Grow by taking a bigger block from the arena
+        {
+            Patient *bigger = (Patient *)arena_alloc(&query_arena, capacity * 2 * sizeof(Patient));
+            memcpy(bigger, patients, count * sizeof(Patient));
+            patients = bigger;
+            capacity *= 2;
+        }
+        if (read_patient_at(offset, &patients[count]))
+            count++;
+    }
+    stats_record(OP_SCAN, started);
+    *result = patients;
+    return count;
+}
+
+// find_patient_by_id() - Shows one patient using the primary index
+void find_patient_by_id()
+{
+    int id = read_int("Enter Patient ID: ");
+    if (!open_patient_indexes())
+    {
+        printf(RED "Error opening patient file or its index files.\n" RESET);
+        return;
+    }
+
+    int64_t offset;
+    Patient p;
+    uint64_t started = stats_start();  // Time the point lookup
+    int found = btree_search(&patient_id_index, id, &offset) && read_patient_at(offset, &p);
+    stats_record(OP_LOOKUP, started);
+    if (!found)
+    {
+        printf(RED "No patient with ID %d.\n" RESET, id);
+        return;
+    }
+    printf(MAGENTA BOLD "\n--- Patient %d ---\n" RESET, id);
+    render_patient_table(&p, 1);
+}
+
+// display_patients_by_id_range() - Shows patients whose IDs are between two values
+void display_patients_by_id_range()
+{
+    int from = read_int("Enter first Patient ID: ");
+    int to = read_int("Enter last Patient ID: ");
+    if (!open_patient_indexes())
+    {
+        printf(RED "Error opening patient file or its index files.\n" RESET);
+        return;
+    }
+
+    arena_reset(&query_arena);  // Reuse the memory of the previous query
+    Patient *patients;
+    int count = scan_patient_index(&patient_id_index, from, to, &patients);
+    if (count == 0)
+    {
+        printf(RED "No patients with IDs from %d to %d.\n" RESET, from, to);
+        return;
+    }
+    StrRef *hospital_names = (StrRef *)arena_alloc(&query_arena, count * sizeof(StrRef));
+    resolve_hospital_names(patients, count, hospital_names);  // One pass over hospitals.txt, not one per row
+    printf(MAGENTA BOLD "\n--- Patients with IDs %d to %d ---\n" RESET, from, to);
+    render_named_patient_table(patients, hospital_names, count);
+}
+
+// display_patients_by_hospital() - Shows every patient admitted to one hospital
+void display_patients_by_hospital()
+{
+    int hospital_id = read_int("Enter Hospital ID: ");
+    if (!open_patient_indexes())
+    {
+        printf(RED "Error opening patient file or its index files.\n" RESET);
+        return;
+    }
+
+    arena_reset(&query_arena);  // Reuse the memory of the previous query
+    Patient *patients;
+    int count = scan_patient_index(&patient_hospital_index, hospital_patient_key(hospital_id, INT32_MIN),
+                                   hospital_patient_key(hospital_id, INT32_MAX), &patients);
+    if (count == 0)
+    {
+        printf(RED "No patients found in hospital %d.\n" RESET, hospital_id);
+        return;
+    }
+    StrRef *hospital_names = (StrRef *)arena_alloc(&query_arena, count * sizeof(StrRef));
+    resolve_hospital_names(patients, count, hospital_names);  // One pass over hospitals.txt, not one per row
+    printf(MAGENTA BOLD "\n--- Patients in %s ---\n" RESET, str_of(hospital_names[0]));
+    render_named_patient_table(patients, hospital_names, count);
+}
+
+// ===== NAME SEARCH =====
+// Each name index keeps, in memory:
+//   - a trigram inverted index: every 3-letter piece of a lower-cased name
+//     points to the sorted list of names containing it (substring search)
+//   - the names sorted alphabetically (prefix search by binary search)
+// It is built from the data file on the first search and then kept up to date
+// by add_hospital()/add_patient(), so searches never read the files.
+
+// lower_copy() - Copies text into buffer in lower case, returns the length
+static int lower_copy(const char *text, char *buffer, int size)
+{
+    int length = 0;
+    while (text[length] && length < size - 1)
+    {
+        char c = text[length];
+        buffer[length++] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+// trigram_key() - Packs three characters into one integer key
+static int trigram_key(const char *text)
+{
+    return ((unsigned char)text[0] << 16) | ((unsigned char)text[1] << 8) | (unsigned char)text[2];
+}
+
+// name_index_postings() - Returns the posting list of a trigram (NULL if no name has it)
+static PostingList *name_index_postings(const NameIndex *index, int trigram)
+{
+    int slot;
+    return intmap_get(&index->trigram_lists, trigram, &slot) ? &index->lists[slot] : NULL;
+}
+
+// posting_seek() - First position at or after from whose document is >= doc
+// (gallops ahead in growing steps, then binary searches, so long lists are skipped quickly)
+static int posting_seek(const PostingList *list, int from, int doc)
+{
+    int step = 1, high = from;
+    while (high < list->count && list->docs[high] < doc)
+    {
+        from = high + 1;
+        high += step;
+        step *= 2;
+    }
+    if (high > list->count)
+        high = list->count;
+    while (from < high)
+    {
+        int mid = (from + high) / 2;
+        if (list->docs[mid] < doc)
+            from = mid + 1;
+        else
+            high = mid;
+    }
+    return from;
+}
+
+// compare_names() - Orders document numbers by their lower-case name (for qsort)
+static const NameIndex *sort_index;  // Index being sorted (qsort has no extra argument)
+static int compare_names(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    int result = strcmp(str_of(sort_index->docs[x].lowered), str_of(sort_index->docs[y].lowered));
+    return result != 0 ? result : x - y;
+}
+
+// name_index_append() - Adds one name to the document list and the trigram lists
+static void name_index_append(NameIndex *index, int id, const char *name, StrRef detail)
+{
+    if (index->count == index->capacity)  // Make room for more documents
+    {
+        index->capacity = index->capacity ? index->capacity * 2 : 1024;
+        index->docs = (NameDoc *)stats_realloc(index->docs, index->capacity * sizeof(NameDoc));
+        index->by_name = (int *)stats_realloc(index->by_name, index->capacity * sizeof(int));
+        index->seen = (uint32_t *)stats_realloc(index->seen, index->capacity * sizeof(uint32_t));
+    }
+    char lowered[LINE_SIZE];
+    int length = lower_copy(name, lowered, LINE_SIZE);
+    int doc = index->count++;
+    index->docs[doc].id = id;
+    index->docs[doc].name = intern_string(name);
+    index->docs[doc].lowered = intern_string(lowered);
+    index->docs[doc].detail = detail;
+    index->docs[doc].length = length;
+    index->seen[doc] = 0;
+
+    for (int i = 0; i + 3 <= length; i++)  // Every trigram of the name
+    {
+        int trigram = trigram_key(lowered + i), slot;
+        if (!intmap_get(&index->trigram_lists, trigram, &slot))
+        {
+            if (index->list_count == index->list_capacity)
+            {
+                index->list_capacity = index->list_capacity ? index->list_capacity * 2 : 1024;
+                index->lists = (PostingList *)stats_realloc(index->lists, index->list_capacity * sizeof(PostingList));
+            }
+            slot = index->list_count++;
+            memset(&index->lists[slot], 0, sizeof(PostingList));
+            intmap_put(&index->trigram_lists, trigram, slot);
+        }
+        PostingList *list = &index->lists[slot];
+        if (list->count > 0 && list->docs[list->count - 1] == doc)
+            continue;  // Trigram repeats inside the same name
+        if (list->count == list->capacity)
+        {
+            list->capacity = list->capacity ? list->capacity * 2 : 4;
+            list->docs = (int *)stats_realloc(list->docs, list->capacity * sizeof(int));
+        }
+        list->docs[list->count++] = doc;  // Documents are added in order, so lists stay sorted
+    }
+}
+
+// name_index_add() - Adds a new name to a built index, keeping the alphabetical list sorted
+void name_index_add(NameIndex *index, int id, const char *name, StrRef detail)
+{
+    if (!index->built)
+        return;  // The index will read the new record when it is first built
+    name_index_append(index, id, name, detail);
+    int doc = index->count - 1;
+
+    int low = 0, high = doc;  // Binary search for the position in the alphabetical list
+    sort_index = index;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (compare_names(&index->by_name[mid], &doc) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    memmove(index->by_name + low + 1, index->by_name + low, (doc - low) * sizeof(int));
+    index->by_name[low] = doc;
+}
+
+// build_name_index() - Reads every name of a data file into the index (first search only)
+static void build_name_index(NameIndex *index, int hospitals)
+{
+    FILE *fp = stats_fopen(hospitals ? HOSPITAL_FILE : PATIENT_FILE, "r");
+    index->built = 1;
+    if (fp)
+    {
+        char line[LINE_SIZE];
+        while (read_line(line, LINE_SIZE, fp))
+        {
+            if (hospitals)
+            {
+                Hospital h;
+                HospitalText t;
+                if (parse_hospital_line(line, &h, &t))
+                    name_index_append(index, h.hospital_id, str_of(t.hospital_name), h.city);
+            }
+            else
+            {
+                Patient p;
+                if (parse_patient_line(line, &p))
+                    name_index_append(index, p.patient_id, str_of(p.patient_name), dictionary_value(&disease_dictionary, p.disease));
+            }
+        }
+        fclose(fp);
+    }
+    for (int i = 0; i < index->count; i++)
+        index->by_name[i] = i;
+    sort_index = index;
+    qsort(index->by_name, index->count, sizeof(int), compare_names);
+}
+
+// hospital_name_index() / patient_name_index() - Return an index, building it on first use
+NameIndex *hospital_name_index()
+{
+    if (!hospital_names.built)
+        build_name_index(&hospital_names, 1);
+    return &hospital_names;
+}
+
+NameIndex *patient_name_index()
+{
+    if (!patient_names.built)
+        build_name_index(&patient_names, 0);
+    return &patient_names;
+}
+
+// name_index_reset() - Frees an index; the next search builds it again from the data file
+void name_index_reset(NameIndex *index)
+{
+    free(index->docs);
+    free(index->by_name);
+    free(index->seen);
+    for (int i = 0; i < index->list_count; i++)
+        free(index->lists[i].docs);
+    free(index->lists);
+    intmap_free(&index->trigram_lists);
+    memset(index, 0, sizeof(NameIndex));  // built = 0
+}
+
+// fuzzy_distance() - Smallest number of edits needed to find pattern somewhere inside text
+// (approximate substring matching: the match may start and end anywhere in text)
+static int fuzzy_distance(const char *pattern, int m, const char *text)
+{
+    int column[LINE_SIZE];  // column[i] = best distance for pattern[0..i) ending at this text position
+    for (int i = 0; i <= m; i++)
+        column[i] = i;
+    int best = m;
+    for (const char *c = text; *c; c++)
+    {
+        int diagonal = 0;  // A match may start at any position, so row 0 is always 0
+        for (int i = 1; i <= m; i++)
+        {
+            int above = column[i];
+            int cost = diagonal + (pattern[i - 1] != *c);
+            int value = above + 1 < column[i - 1] + 1 ? above + 1 : column[i - 1] + 1;
+            column[i] = cost < value ? cost : value;
+            diagonal = above;
+        }
+        if (column[m] < best)
+            best = column[m];
+    }
+    return best;
+}
+
+// add_search_result() - Keeps the best limit results, ordered by score, then shorter name, then A-Z
+static void add_search_result(const NameIndex *index, SearchResult *results, int *count, int limit, int doc, int score)
+{
+    int length = index->docs[doc].length;
+    int pos = *count;
+    while (pos > 0)  // Insertion into the small sorted result list
+    {
+        const SearchResult *r = &results[pos - 1];
+        int r_length = index->docs[r->doc].length;
+        int better = score > r->score ||
+                     (score == r->score && (length < r_length ||
+                     (length == r_length && strcmp(str_of(index->docs[doc].lowered), str_of(index->docs[r->doc].lowered)) < 0)));
+        if (!better)
+            break;
+        pos--;
+    }
+    if (pos >= limit)
+        return;  // Not good enough for the list
+    int last = *count < limit ? *count : limit - 1;
+    memmove(results + pos + 1, results + pos, (last - pos) * sizeof(SearchResult));
+    results[pos].doc = doc;
+    results[pos].score = score;
+    if (*count < limit)
+        (*count)++;
+}
+
+// search_name_index() - Finds names containing query (case-insensitive), best first
+// Returns the number of results written to results (at most limit)
+int search_name_index(NameIndex *index, const char *query, int allow_typos, SearchResult *results, int limit)
+{
+    char q[LINE_SIZE];
+    int m = lower_copy(query, q, LINE_SIZE);
+    int count = 0;
+    if (m == 0 || index->count == 0)
+        return 0;
+    uint32_t stamp = ++index->query_number;  // Marks documents already scored in this query
+
+    // 1. Prefix matches: one contiguous block of the alphabetical list. They outrank every
+    //    other kind of match, so the first limit names of the block (A-Z) are enough
+    int low = 0, high = index->count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (strncmp(str_of(index->docs[index->by_name[mid]].lowered), q, m) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for (int i = low; i < index->count && count < limit; i++)
+    {
+        int doc = index->by_name[i];
+        const char *name = str_of(index->docs[doc].lowered);
+        if (strncmp(name, q, m) != 0)
+            break;
+        index->seen[doc] = stamp;
+        add_search_result(index, results, &count, limit, doc, name[m] == '\0' ? SCORE_EXACT : SCORE_PREFIX);
+    }
+    if (m < 3 || count >= limit)
+        return count;  // Shorter queries have no trigrams, prefix matches only
+
+    // 2. Substring matches: intersect the posting lists of the query's trigrams, shortest first
+    PostingList *lists[LINE_SIZE];
+    int list_count = 0;
+    for (int i = 0; i + 3 <= m; i++)
+    {
+        PostingList *list = name_index_postings(index, trigram_key(q + i));
+        if (!list)
+        {
+            list_count = -1;  // Some trigram never occurs, so no exact substring match exists
+            break;
+        }
+        lists[list_count++] = list;
+    }
+    if (list_count > 0)
+    {
+        PostingList *shortest = lists[0];
+        for (int i = 1; i < list_count; i++)
+            if (lists[i]->count < shortest->count)
+                shortest = lists[i];
+        int *cursor = (int *)arena_alloc(&query_arena, list_count * sizeof(int));  // Position in each list
+        memset(cursor, 0, list_count * sizeof(int));
+        for (int k = 0; k < shortest->count; k++)
+        {
+            int doc = shortest->docs[k], in_all = 1;
+            if (index->seen[doc] == stamp)
+                continue;  // Already found as a prefix match
+            for (int i = 0; i < list_count && in_all; i++)
+            {
+                const PostingList *list = lists[i];
+                cursor[i] = posting_seek(list, cursor[i], doc);  // Lists are sorted, only move forward
+                in_all = cursor[i] < list->count && list->docs[cursor[i]] == doc;
+            }
+            if (!in_all)
+                continue;
+            const char *name = str_of(index->docs[doc].lowered);
+            const char *found = strstr(name, q);  // Trigrams can match out of order, so confirm
+            if (!found)
+                continue;
+            index->seen[doc] = stamp;
+            int word_start = found[-1] == ' ' || found[-1] == '-' || found[-1] == '\'';
+            add_search_result(index, results, &count, limit, doc, word_start ? SCORE_WORD : SCORE_SUBSTRING);
+        }
+    }
+
+    // 3. Names with spelling mistakes: one edit changes at most 3 trigrams of a name, so a name
+    //    within max_edits still shares (trigrams - 3 * max_edits) of the query's trigrams and
+    //    is in at least one of any (3 * max_edits + 1) of their lists. Candidates come from the
+    //    rarest lists (merged in document order), are counted against the others, and only
+    //    those with enough shared trigrams are checked with fuzzy_distance().
+    int max_edits = m >= 12 ? 2 : 1;  // Long names may have two mistakes
+    int trigrams = m - 2;
+    int needed = 3 * max_edits + 1;  // Number of lists candidates are taken from
+    if (!allow_typos || count >= limit || trigrams < needed)
+        return count;
+    PostingList **rare = (PostingList **)arena_alloc(&query_arena, trigrams * sizeof(PostingList *));
+    int *cursor = (int *)arena_alloc(&query_arena, trigrams * sizeof(int));
+    for (int i = 0; i < trigrams; i++)
+    {
+        rare[i] = name_index_postings(index, trigram_key(q + i));  // NULL counts as an empty list
+        cursor[i] = 0;
+    }
+    for (int i = 0; i < needed; i++)  // Move the shortest lists to the front
+    {
+        int best = i;
+        for (int j = i + 1; j < trigrams; j++)
+            if ((rare[j] ? rare[j]->count : 0) < (rare[best] ? rare[best]->count : 0))
+                best = j;
+        PostingList *swap = rare[i];
+        rare[i] = rare[best];
+        rare[best] = swap;
+    }
+    while (1)
+    {
+        int doc = -1, shared = 0;
+        for (int i = 0; i < needed; i++)  // Smallest next document of the rare lists
+            if (rare[i] && cursor[i] < rare[i]->count && (doc < 0 || rare[i]->docs[cursor[i]] < doc))
+                doc = rare[i]->docs[cursor[i]];
+        if (doc < 0)
+            break;
+        for (int i = 0; i < needed; i++)
+            if (rare[i] && cursor[i] < rare[i]->count && rare[i]->docs[cursor[i]] == doc)
+            {
+                shared++;
+                cursor[i]++;
+            }
+        if (index->seen[doc] == stamp)
+            continue;  // Already an exact match
+        for (int i = needed; i < trigrams; i++)
+        {
+            if (!rare[i])
+                continue;
+            cursor[i] = posting_seek(rare[i], cursor[i], doc);
+            shared += cursor[i] < rare[i]->count && rare[i]->docs[cursor[i]] == doc;
+        }
+        if (shared < trigrams - 3 * max_edits)
+            continue;  // Too different to be a spelling mistake
+        int distance = fuzzy_distance(q, m, str_of(index->docs[doc].lowered));
+        if (distance <= max_edits)
+            add_search_result(index, results, &count, limit, doc, SCORE_TYPO - distance);
+    }
+    return count;
+}
+
+// search_names() - Asks for a search text and prints the best matching names
+static void search_names(NameIndex *index, const char *title, const char *detail_title)
+{
+    char query[NAME_SIZE], answer[8];
+    printf(GREEN "Enter part of the name: " RESET);
+    fgets(query, NAME_SIZE, stdin);
+    query[strcspn(query, "\n")] = 0;
+    printf(GREEN "Allow spelling mistakes? (y/n): " RESET);
+    fgets(answer, sizeof(answer), stdin);
+    if (!strchr(answer, '\n'))
+        clear_input_buffer();
+
+    arena_reset(&query_arena);  // Reuse the memory of the previous query
+    SearchResult results[SEARCH_RESULT_LIMIT];
+    uint64_t started = stats_start();  // Time the search
+    int count = search_name_index(index, query, answer[0] == 'y' || answer[0] == 'Y', results, SEARCH_RESULT_LIMIT);
+    stats_record(OP_SEARCH, started);
+
+    if (count == 0)
+    {
+        printf(RED "No names match \"%s\".\n" RESET, query);
+        return;
+    }
+    printf(MAGENTA BOLD "\n--- %s matching \"%s\" (best %d) ---\n" RESET, title, query, count);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    printf("\n-------------------------------------------------------------------------------------------------------------------\n");
+    printf("%4s | %5s | %-50s | %-25s | %s\n", "Rank", "ID", "Name", detail_title, "Match");
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    for (int i = 0; i < count; i++)
+    {
+        const NameDoc *d = &index->docs[results[i].doc];
+        int score = results[i].score;
+        const char *match = score == SCORE_EXACT ? "exact" : score == SCORE_PREFIX ? "starts with" :
+                            score == SCORE_WORD ? "word starts with" : score == SCORE_SUBSTRING ? "contains" : "similar spelling";
+        printf(CYAN "%4d | %5d | %-50s | %-25s | %s\n" RESET, i + 1, d->id, str_of(d->name), str_of(d->detail), match);
+    }
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+}
+
+// search_hospitals_by_name() - Prefix/substring search over hospital names
+void search_hospitals_by_name()
+{
+    search_names(hospital_name_index(), "Hospitals", "City");
+}
+
+// search_patients_by_name() - Prefix/substring search over patient names
+void search_patients_by_name()
+{
+    search_names(patient_name_index(), "Patients", "Disease/Condition");
+}
+
+// ===== QUALITY RANKING =====
+// Raw ratings favour hospitals with very few reviews (one 5-star review beats 999
+// reviews averaging 4.8). The quality score pulls every rating towards a prior:
+//
+//     bayes = (prior_weight x prior_mean + reviews x rating) / (prior_weight + reviews)
+//
+// so a rating only counts fully once it has many reviews. Optionally the score is
+// blended with a price score (cheaper beds score higher):
+//
+//     score = (1 - price_weight) x bayes + price_weight x 5 / (1 + bed_price / price_reference)
+//
+// The priors are fixed numbers (not the average of all hospitals), so adding or
+// re-rating one hospital only changes that hospital's score. The scores are kept as
+// a column next to the hospital rows, together with the rows in ranked order, and
+// are updated in place on every add/re-rate; the ranked listing just reads the order.
+
+// load_ranking_settings() - Reads RANKING_FILE, keeping the defaults for missing values
+void load_ranking_settings(RankingSettings *s)
+{
+    s->prior_mean = DEFAULT_PRIOR_MEAN;
+    s->prior_weight = DEFAULT_PRIOR_WEIGHT;
+    s->price_weight = DEFAULT_PRICE_WEIGHT;
+    s->price_reference = DEFAULT_PRICE_REFERENCE;
+
+    FILE *fp = stats_fopen(RANKING_FILE, "r");
+    if (!fp)
+        return;  // No settings saved yet
+    char line[LINE_SIZE];
+    if (read_line(line, LINE_SIZE, fp))
+    {
+        char *f[4];
+        if (split_fields(line, f, 4) == 4)  // prior_mean|prior_weight|price_weight|price_reference
+        {
+            s->prior_mean = atof(f[0]);
+            s->prior_weight = atof(f[1]);
+            s->price_weight = atof(f[2]);
+            s->price_reference = atof(f[3]);
+        }
+    }
+    fclose(fp);
+}
+
+// save_ranking_settings() - Writes the settings to RANKING_FILE
+static int save_ranking_settings(const RankingSettings *s)
+{
+    FILE *fp = stats_fopen(RANKING_FILE, "w");
+    if (!fp)
+        return 0;
+    fprintf(fp, "%.2f|%.2f|%.2f|%.2f\n", s->prior_mean, s->prior_weight, s->price_weight, s->price_reference);
+    fclose(fp);
+    return 1;
+}
+
+// stored_rating() - The rating as it reads back from the file (one decimal place)
+float stored_rating(float rating)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.1f", rating);
+    return strtof(text, NULL);
+}
+
+// quality_score() - Bayesian quality score of one hospital (0 to 5)
+float quality_score(const Hospital *h, const RankingSettings *s)
+{
+    double reviews = h->reviews > 0 ? h->reviews : 0;
+    double bayes = s->prior_weight + reviews > 0
+                   ? (s->prior_weight * s->prior_mean + reviews * h->rating) / (s->prior_weight + reviews)
+                   : s->prior_mean;
+    if (s->price_weight <= 0 || s->price_reference <= 0)
+        return (float)bayes;
+    double value = 5.0 / (1.0 + h->bed_price / s->price_reference);  // 5 for free beds, 2.5 at the reference price
+    return (float)((1.0 - s->price_weight) * bayes + s->price_weight * value);
+}
+
+// ranked_before() - 1 if row a comes before row b (higher score first, then file order)
+static int ranked_before(const Ranking *r, int a, int b)
+{
+    if (r->score[a] != r->score[b])
+        return r->score[a] > r->score[b];
+    return a < b;
+}
+
+// ranking_position() - Position of row in the ranked order (or where it belongs)
+static int ranking_position(const Ranking *r, int row)
+{
+    int low = 0, high = r->ranked;
+    while (low < high)  // Binary search, the order is always sorted
+    {
+        int mid = (low + high) / 2;
+        if (ranked_before(r, r->order[mid], row))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// ranking_place() - Puts a row with a fresh score into the ranked order
+static void ranking_place(Ranking *r, int row)
+{
+    int pos = ranking_position(r, row);
+    memmove(r->order + pos + 1, r->order + pos, (r->ranked - pos) * sizeof(int));
+    r->order[pos] = row;
+    r->ranked++;
+}
+
+// ranking_unplace() - Takes a row out of the ranked order (before its score changes)
+static void ranking_unplace(Ranking *r, int row)
+{
+    int pos = ranking_position(r, row);
+    memmove(r->order + pos, r->order + pos + 1, (r->ranked - pos - 1) * sizeof(int));
+    r->ranked--;
+}
+
+// compare_ranked_rows() - qsort version of ranked_before() for the first build
+static const Ranking *sort_ranking;  // Ranking being sorted (qsort has no extra argument)
+static int compare_ranked_rows(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return ranked_before(sort_ranking, x, y) ? -1 : ranked_before(sort_ranking, y, x) ? 1 : 0;
+}
+
+// ranking_reserve() - Makes room for at least count rows
+static void ranking_reserve(Ranking *r, int count)
+{
+    if (count <= r->capacity)
+        return;
+    int capacity = r->capacity ? r->capacity : 64;
+    while (capacity < count)
+        capacity *= 2;
+    r->score = (float *)stats_realloc(r->score, capacity * sizeof(float));
+    r->order = (int *)stats_realloc(r->order, capacity * sizeof(int));
+    r->capacity = capacity;
+}
+
+// refresh_ranking() - Makes the ranking match the loaded hospital rows
+// Only rebuilds (one sort) the first time, after the settings change, or when
+// hospitals.txt was edited outside the program; otherwise it is already current.
+void refresh_ranking(const Hospital *hot, int count)
+{
+    Ranking *r = &hospital_ranking;
+    int64_t size = data_file_size(HOSPITAL_FILE);
+    if (r->built && r->source_size == size && r->count == count)
+        return;  // Kept up to date by add_hospital() and rate_hospital()
+
+    load_ranking_settings(&r->settings);
+    ranking_reserve(r, count);
+    for (int i = 0; i < count; i++)  // Materialise the score column
+    {
+        r->score[i] = quality_score(&hot[i], &r->settings);
+        r->order[i] = i;
+    }
+    sort_ranking = r;
+    uint64_t started = stats_start();  // Time the full ranking
+    qsort(r->order, count, sizeof(int), compare_ranked_rows);
+    stats_record(OP_SORT, started);
+    r->count = r->ranked = count;
+    r->source_size = size;
+    r->built = 1;
+}
+
+// ranking_add() - Ranks a hospital that was just appended to the file
+// Parameters: old_size/new_size = file size before and after the new line
+void ranking_add(const Hospital *h, int64_t old_size, int64_t new_size)
+{
+    Ranking *r = &hospital_ranking;
+    if (!r->built || r->source_size != old_size)
+    {
+        r->built = 0;  // Not loaded yet or out of date: rebuild on the next listing
+        return;
+    }
+    ranking_reserve(r, r->count + 1);
+    int row = r->count++;  // New lines become the last row
+    r->score[row] = quality_score(h, &r->settings);
+    ranking_place(r, row);
+    r->source_size = new_size;
+}
+
+// ranking_update() - Moves a changed hospital to its new place
+void ranking_update(int row, const Hospital *h, int64_t old_size, int64_t new_size)
+{
+    Ranking *r = &hospital_ranking;
+    if (!r->built || r->source_size != old_size || row >= r->count)
+    {
+        r->built = 0;
+        return;
+    }
+    ranking_unplace(r, row);
+    r->score[row] = quality_score(h, &r->settings);
+    ranking_place(r, row);
+    r->source_size = new_size;
+}
+
+// rank_hospitals_by_quality() - Lists hospitals best first using the stored ranking
+void rank_hospitals_by_quality()
+{
+    Hospital *h;
+    HospitalText *text;
+    const int *order;
+    const float *score;
+    int n;
+    CachedView *view = view_cache_find(VIEW_HOSPITALS_BY_QUALITY, 0);  // Rows already in ranked order?
+    if (view)
+    {
+        h = view->hot;
+        text = view->text;
+        order = view->order;
+        score = view->score;
+        n = view->count;
+    }
+    else
+    {
+        n = count_records(HOSPITAL_FILE);
+        if (n == 0)
+        {
+            printf(RED "No hospitals found!\n" RESET);
+            return;
+        }
+        arena_reset(&query_arena);  // Reuse the memory of the previous query
+        h = (Hospital *)arena_alloc(&query_arena, n * sizeof(Hospital));
+        text = (HospitalText *)arena_alloc(&query_arena, n * sizeof(HospitalText));
+        load_hospitals(h, text, &n);
+        refresh_ranking(h, n);  // Nothing to do unless the ranking is out of date
+        order = hospital_ranking.order;
+        score = hospital_ranking.score;
+        view_cache_store_hospitals(VIEW_HOSPITALS_BY_QUALITY, 0, h, text, order, score, n);
+    }
+
+    const RankingSettings *s = &hospital_ranking.settings;
+    printf(MAGENTA BOLD "\n--- Hospitals Ranked by Quality Score ---\n" RESET);
+    printf(YELLOW "Score = (%.0f x %.1f + reviews x rating) / (%.0f + reviews)", s->prior_weight, s->prior_mean, s->prior_weight);
+    if (s->price_weight > 0)
+        printf(", blended %.0f%% with bed price", s->price_weight * 100);
+    printf("\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    render_scored_hospital_table(h, text, order, score, n);
+}
+
+// add_star_rating() - HospitalEdit that adds one review with the given stars
+static void add_star_rating(Hospital *h, int stars)
+{
+    h->rating = (h->rating * h->reviews + stars) / (h->reviews + 1);  // New average rating
+    h->reviews++;
+}
+
+// rate_hospital() - Adds a 1 to 5 star review to a hospital and updates its ranking
+void rate_hospital()
+{
+    int hospital_id = read_int("Enter Hospital ID: ");
+    if (!registry_contains(hospital_id_registry(), hospital_id))
+    {
+        printf(RED "No hospital with ID %d!\n" RESET, hospital_id);
+        return;
+    }
+    int stars = read_int("Enter your rating (1 to 5 stars): ");
+    while (stars < 1 || stars > 5)
+    {
+        printf(RED "Rating must be between 1 and 5!\n" RESET);
+        stars = read_int("Enter your rating (1 to 5 stars): ");
+    }
+
+    uint64_t started = stats_start();  // Time the update
+    int64_t old_size = data_file_size(HOSPITAL_FILE);
+    Hospital h;
+    HospitalText t;
+    int row = update_hospital_record(hospital_id, add_star_rating, stars, &h, &t);
+    if (row < 0)
+    {
+        printf(RED "Error updating hospital file\n" RESET);
+        return;
+    }
+    int64_t new_size = data_file_size(HOSPITAL_FILE);
+    ranking_update(row, &h, old_size, new_size);
+    spatial_update_beds(hospital_id, h.available_beds, old_size, new_size);  // Beds unchanged, keeps the tree current
+    stats_record(OP_UPDATE, started);
+    printf(GREEN BOLD "Thank you! Hospital %d is now rated %.1f from %d reviews.\n" RESET, h.hospital_id, h.rating, h.reviews);
+}
+
+// ranking_settings() - Shows and changes the priors of the quality score
+void ranking_settings()
+{
+    RankingSettings s;
+    load_ranking_settings(&s);
+    printf(MAGENTA BOLD "\n--- Quality Score Settings ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    printf(YELLOW "Prior mean rating  : %.2f  (rating assumed before any reviews)\n", s.prior_mean);
+    printf("Prior weight       : %.2f  (how many reviews the prior counts as)\n", s.prior_weight);
+    printf("Price weight       : %.2f  (0 = quality only, 1 = price only)\n", s.price_weight);
+    printf("Reference price    : %.2f  (bed price that gets half the price score)\n" RESET, s.price_reference);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+
+    printf(GREEN "Enter prior mean rating (0 to 5): " RESET);
+    while (scanf("%lf", &s.prior_mean) != 1 || s.prior_mean < 0 || s.prior_mean > 5)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter prior mean rating (0 to 5): " RESET);
+    }
+    printf(GREEN "Enter prior weight (reviews, 0 or more): " RESET);
+    while (scanf("%lf", &s.prior_weight) != 1 || s.prior_weight < 0)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter prior weight (reviews, 0 or more): " RESET);
+    }
+    printf(GREEN "Enter price weight (0 to 1): " RESET);
+    while (scanf("%lf", &s.price_weight) != 1 || s.price_weight < 0 || s.price_weight > 1)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter price weight (0 to 1): " RESET);
+    }
+    printf(GREEN "Enter reference bed price: " RESET);
+    while (scanf("%lf", &s.price_reference) != 1 || s.price_reference <= 0)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter reference bed price: " RESET);
+    }
+    clear_input_buffer();
+
+    if (!save_ranking_settings(&s))
+    {
+        printf(RED "Error saving ranking settings\n" RESET);
+        return;
+    }
+    hospital_ranking.built = 0;  // Every score changes, recompute on the next listing
+    view_cache_invalidate(VIEW_HOSPITALS_BY_QUALITY);  // The cached ranking used the old settings
+    printf(GREEN BOLD "Settings saved.\n" RESET);
+}
+
+// ===== NEAREST HOSPITALS (K-D TREE) =====
+// Hospitals that have a location are kept in a k-d tree. Each location is turned
+// into a point on a unit sphere (x, y, z), so straight-line distance between points
+// orders hospitals exactly like distance along the Earth's surface, with no trouble
+// at the poles or the date line. Every node also counts the hospitals with free beds
+// below it, so the search skips whole branches where every bed is taken.
+// The tree is built from the file on the first query and kept current by
+// add_hospital() and update_available_beds(); queries never read the file.
+
+// location_to_point() - Converts latitude/longitude in degrees to a unit-sphere point
+static void location_to_point(double latitude, double longitude, float xyz[3])
+{
+    double lat = latitude * PI / 180.0, lon = longitude * PI / 180.0;
+    xyz[0] = (float)(cos(lat) * cos(lon));
+    xyz[1] = (float)(cos(lat) * sin(lon));
+    xyz[2] = (float)sin(lat);
+}
+
+// chord_to_km() - Converts a squared straight-line distance on the unit sphere to km along the surface
+static double chord_to_km(float distance2)
+{
+    double chord = sqrt(distance2);
+    return 2.0 * EARTH_RADIUS_KM * asin(chord / 2.0 < 1.0 ? chord / 2.0 : 1.0);
+}
+
+// point_distance2() - Squared straight-line distance between two unit-sphere points
+static float point_distance2(const float a[3], const float b[3])
+{
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// kd_select() - Reorders nodes[] so nodes[k] has the k-th smallest coordinate on axis
+// (quickselect: everything before k is smaller or equal, everything after is larger or equal)
+static void kd_select(const SpatialPoint *points, int *nodes, int count, int k, int axis)
+{
+    int low = 0, high = count - 1;
+    while (low < high)
+    {
+        float pivot = points[nodes[(low + high) / 2]].xyz[axis];
+        int i = low, j = high;
+        while (i <= j)
+        {
+            while (points[nodes[i]].xyz[axis] < pivot)
+                i++;
+            while (points[nodes[j]].xyz[axis] > pivot)
+                j--;
+            if (i <= j)
+            {
+                int swap = nodes[i];
+                nodes[i++] = nodes[j];
+                nodes[j--] = swap;
+            }
+        }
+        if (k <= j)
+            high = j;
+        else if (k >= i)
+            low = i;
+        else
+            break;
+    }
+}
+
+// kd_build() - Builds a balanced subtree from nodes[] by splitting at the median
+// Returns the root of the subtree (-1 if empty)
+static int kd_build(SpatialPoint *points, int *nodes, int count, int depth, int parent)
+{
+    if (count == 0)
+        return -1;
+    int axis = depth % 3, middle = count / 2;
+    kd_select(points, nodes, count, middle, axis);
+    int node = nodes[middle];
+    SpatialPoint *p = &points[node];
+    p->axis = (unsigned char)axis;
+    p->parent = parent;
+    p->left = kd_build(points, nodes, middle, depth + 1, node);
+    p->right = kd_build(points, nodes + middle + 1, count - middle - 1, depth + 1, node);
+    p->free_count = (p->available_beds > 0) +
+                    (p->left >= 0 ? points[p->left].free_count : 0) +
+                    (p->right >= 0 ? points[p->right].free_count : 0);
+    return node;
+}
+
+// spatial_rebalance() - Rebuilds the tree shape over all points already in memory
+static void spatial_rebalance(SpatialIndex *s)
+{
+    int *nodes = (int *)stats_malloc((s->count ? s->count : 1) * sizeof(int));
+    for (int i = 0; i < s->count; i++)
+        nodes[i] = i;
+    s->root = kd_build(s->points, nodes, s->count, 0, -1);
+    s->rebalance_at = s->count * 2 + 64;  // Inserts can unbalance the tree, rebuild once it doubles
+    free(nodes);
+}
+
+// spatial_append() - Adds a point to the point array (not yet linked into the tree)
+static int spatial_append(SpatialIndex *s, const Hospital *h, const HospitalText *t)
+{
+    if (s->count == s->capacity)
+    {
+        s->capacity = s->capacity ? s->capacity * 2 : 256;
+        s->points = (SpatialPoint *)stats_realloc(s->points, s->capacity * sizeof(SpatialPoint));
+    }
+    int i = s->count++;
+    SpatialPoint *p = &s->points[i];
+    p->hospital_id = h->hospital_id;
+    p->name = t->hospital_name;
+    p->city = h->city;
+    p->available_beds = h->available_beds;
+    p->latitude = t->latitude;
+    p->longitude = t->longitude;
+    location_to_point(t->latitude, t->longitude, p->xyz);
+    p->left = p->right = p->parent = -1;
+    p->axis = 0;
+    p->free_count = h->available_beds > 0;
+    int existing;
+    if (!intmap_get(&s->by_id, h->hospital_id, &existing))  // First record with an ID wins, like the lookups
+        intmap_put(&s->by_id, h->hospital_id, i);
+    return i;
+}
+
+// spatial_index() - Returns the hospital k-d tree, building it if it is out of date
+SpatialIndex *spatial_index()
+{
+    SpatialIndex *s = &hospital_locations;
+    int64_t size = data_file_size(HOSPITAL_FILE);
+    if (s->built && s->source_size == size)
+        return s;  // Kept up to date by add_hospital() and update_available_beds()
+
+    s->count = 0;
+    intmap_free(&s->by_id);
+    intmap_init(&s->by_id, 256);
+    FILE *fp = stats_fopen(HOSPITAL_FILE, "r");
+    if (fp)
+    {
+        char line[LINE_SIZE];
+        while (read_line(line, LINE_SIZE, fp))
+        {
+            Hospital h;
+            HospitalText t;
+            if (parse_hospital_line(line, &h, &t) && t.latitude != NO_LOCATION)
+                spatial_append(s, &h, &t);
+        }
+        fclose(fp);
+    }
+    spatial_rebalance(s);
+    s->source_size = size;
+    s->built = 1;
+    return s;
+}
+
+// spatial_add() - Links a newly added hospital into the tree
+// Parameters: old_size/new_size = file size before and after the new line
+void spatial_add(const Hospital *h, const HospitalText *t, int64_t old_size, int64_t new_size)
+{
+    SpatialIndex *s = &hospital_locations;
+    if (!s->built || s->source_size != old_size)
+    {
+        s->built = 0;  // Not loaded yet or out of date: rebuild on the next query
+        return;
+    }
+    s->source_size = new_size;
+    if (t->latitude == NO_LOCATION)
+        return;  // Hospitals without a location are not in the tree
+    int node = spatial_append(s, h, t);
+    SpatialPoint *points = s->points;
+    if (s->count >= s->rebalance_at)
+    {
+        spatial_rebalance(s);
+        return;
+    }
+    if (s->root < 0)
+    {
+        s->root = node;
+        return;
+    }
+    int parent = s->root;
+    while (1)  // Walk down to an empty child slot, counting the new free beds on the way
+    {
+        SpatialPoint *p = &points[parent];
+        p->free_count += h->available_beds > 0;
+        int *child = points[node].xyz[p->axis] < p->xyz[p->axis] ? &p->left : &p->right;
+        if (*child < 0)
+        {
+            *child = node;
+            points[node].parent = parent;
+            points[node].axis = (unsigned char)((p->axis + 1) % 3);
+            return;
+        }
+        parent = *child;
+    }
+}
+
+// spatial_update_beds() - Changes the free beds of a hospital in the tree
+void spatial_update_beds(int hospital_id, int available_beds, int64_t old_size, int64_t new_size)
+{
+    SpatialIndex *s = &hospital_locations;
+    if (!s->built || s->source_size != old_size)
+    {
+        s->built = 0;
+        return;
+    }
+    s->source_size = new_size;
+    int node;
+    if (!intmap_get(&s->by_id, hospital_id, &node))
+        return;  // Hospital has no location
+    SpatialPoint *p = &s->points[node];
+    int change = (available_beds > 0) - (p->available_beds > 0);
+    p->available_beds = available_beds;
+    for (int i = node; change != 0 && i >= 0; i = s->points[i].parent)  // Fix the counts up to the root
+        s->points[i].free_count += change;
+}
+
+// kd_nearest() - Collects the k closest points with free beds below node into best[]
+// best[] is kept sorted by distance; branches that cannot beat the k-th best are skipped
+static void kd_nearest(const SpatialPoint *points, int node, const float q[3], NearestResult *best, int *count, int k)
+{
+    if (node < 0 || points[node].free_count == 0)
+        return;  // Empty branch or no free beds anywhere below
+    const SpatialPoint *p = &points[node];
+    if (p->available_beds > 0)
+    {
+        float d = point_distance2(p->xyz, q);
+        if (*count < k || d < best[*count - 1].distance2)
+        {
+            int pos = *count < k ? (*count)++ : k - 1;
+            while (pos > 0 && best[pos - 1].distance2 > d)  // Insert in distance order
+            {
+                best[pos] = best[pos - 1];
+                pos--;
+            }
+            best[pos].point = node;
+            best[pos].distance2 = d;
+        }
+    }
+    float diff = q[p->axis] - p->xyz[p->axis];
+    int near = diff < 0 ? p->left : p->right;
+    int far = diff < 0 ? p->right : p->left;
+    kd_nearest(points, near, q, best, count, k);
+    if (*count < k || diff * diff < best[*count - 1].distance2)  // The other side may hold something closer
+        kd_nearest(points, far, q, best, count, k);
+}
+
+// nearest_with_free_beds() - The k hospitals closest to a location that have at least one free bed
+// Returns the number of results written to best[] (closest first)
+int nearest_with_free_beds(SpatialIndex *s, double latitude, double longitude, int k, NearestResult *best)
+{
+    float q[3];
+    int count = 0;
+    location_to_point(latitude, longitude, q);
+    kd_nearest(s->points, s->root, q, best, &count, k);
+    return count;
+}
+
+// read_location() - Asks for a latitude and longitude in degrees
+static void read_location(double *latitude, double *longitude)
+{
+    printf(GREEN "Enter Latitude and Longitude (e.g. 31.5204 74.3587): " RESET);
+    while (scanf("%lf %lf", latitude, longitude) != 2 ||
+           *latitude < -90 || *latitude > 90 || *longitude < -180 || *longitude > 180)
+    {
+        printf(RED "Invalid location!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter Latitude and Longitude (e.g. 31.5204 74.3587): " RESET);
+    }
+    clear_input_buffer();
+}
+
+// find_nearest_hospitals() - Emergency screen: closest hospitals that still have free beds
+void find_nearest_hospitals()
+{
+    double latitude, longitude;
+    read_location(&latitude, &longitude);
+    int k = read_int("How many hospitals to show (1 to 20): ");
+    if (k < 1)
+        k = 1;
+    if (k > NEAREST_LIMIT)
+        k = NEAREST_LIMIT;
+
+    SpatialIndex *s = spatial_index();  // Built on the first query only
+    NearestResult best[NEAREST_LIMIT];
+    uint64_t started = stats_start();  // Time only the tree search
+    int count = nearest_with_free_beds(s, latitude, longitude, k, best);
+    stats_record(OP_NEAREST, started);
+
+    if (count == 0)
+    {
+        printf(RED "No hospital with a location has free beds.\n" RESET);
+        return;
+    }
+    printf(MAGENTA BOLD "\n--- Nearest Hospitals with Free Beds ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    printf("\n-------------------------------------------------------------------------------------------------------------------\n");
+    printf("%4s | %5s | %-40s | %-12s | %5s | %9s\n", "Rank", "ID", "Hospital Name", "City", "Beds", "Distance");
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    for (int i = 0; i < count; i++)
+    {
+        const SpatialPoint *p = &s->points[best[i].point];
+        printf(CYAN "%4d | %5d | %-40s | %-12s | %5d | %6.1f km\n" RESET, i + 1, p->hospital_id,
+               str_of(p->name), str_of(p->city), p->available_beds, chord_to_km(best[i].distance2));
+    }
+    printf("-------------------------------------------------------------------------------------------------------------------\n");
+}
+
+// set_available_beds() - HospitalEdit that replaces the number of free beds
+static void set_available_beds(Hospital *h, int beds)
+{
+    h->available_beds = beds;
+}
+
+// update_available_beds() - Changes the free beds of a hospital in the file and in the indexes
+void update_available_beds()
+{
+    int hospital_id = read_int("Enter Hospital ID: ");
+    if (!registry_contains(hospital_id_registry(), hospital_id))
+    {
+        printf(RED "No hospital with ID %d!\n" RESET, hospital_id);
+        return;
+    }
+    int beds = read_int("Enter Number of Available Beds: ");
+    while (beds < 0)
+    {
+        printf(RED "Beds cannot be negative!\n" RESET);
+        beds = read_int("Enter Number of Available Beds: ");
+    }
+
+    uint64_t started = stats_start();  // Time the update
+    int64_t old_size = data_file_size(HOSPITAL_FILE);
+    Hospital h;
+    HospitalText t;
+    int row = update_hospital_record(hospital_id, set_available_beds, beds, &h, &t);
+    if (row < 0)
+    {
+        printf(RED "Error updating hospital file\n" RESET);
+        return;
+    }
+    int64_t new_size = data_file_size(HOSPITAL_FILE);
+    ranking_update(row, &h, old_size, new_size);  // Score is unchanged, but the file size moved on
+    spatial_update_beds(hospital_id, beds, old_size, new_size);
+    stats_record(OP_UPDATE, started);
+    printf(GREEN BOLD "Hospital %d now has %d available beds.\n" RESET, hospital_id, beds);
+}
+
+// ===== BATCH ADMISSIONS =====
+// Patients waiting for a bed are queued in WAITING_FILE with their city and urgency.
+// The scheduler places them greedily, most urgent first (queue order breaks ties):
+//   - every city has a min-heap of its hospitals that still have free beds, ordered
+//     by cost = bed_price made dearer for lower ratings, so the top is the cheapest
+//     well-rated bed in that city
+//   - a patient takes the top of their own city's heap; if the city is full, the
+//     patient goes to the closest city (by the average location of its hospitals)
+//     that still has beds
+// Each placement is O(log hospitals) plus a look over the cities when a city is full.
+
+// admission_cost() - Cost of one bed: the price, 10% dearer per star below 5
+static double admission_cost(const Hospital *h)
+{
+    double missing_stars = 5.0 - h->rating;
+    if (missing_stars < 0)
+        missing_stars = 0;
+    return h->bed_price * (1.0 + RATING_PRICE_PENALTY * missing_stars);
+}
+
+// heap_before() - 1 if hospital row a belongs above row b in a city heap
+static int heap_before(const double *cost, int a, int b)
+{
+    return cost[a] < cost[b] || (cost[a] == cost[b] && a < b);
+}
+
+// heap_sift_down() - Moves heap[i] down until both children are worse
+static void heap_sift_down(int *heap, int size, int i, const double *cost)
+{
+    while (1)
+    {
+        int best = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < size && heap_before(cost, heap[left], heap[best]))
+            best = left;
+        if (right < size && heap_before(cost, heap[right], heap[best]))
+            best = right;
+        if (best == i)
+            return;
+        int swap = heap[i];
+        heap[i] = heap[best];
+        heap[best] = swap;
+        i = best;
+    }
+}
+
+// city_key() - Lower-case interned city name, so "lahore" and "Lahore" are one city
+static StrRef city_key(StrRef city)
+{
+    char lowered[CITY_SIZE];
+    lower_copy(str_of(city), lowered, CITY_SIZE);
+    return intern_string(lowered);
+}
+
+// compare_by_urgency() - Orders queue positions by urgency (highest first), then queue order
+static const WaitingPatient *sort_queue;  // Queue being sorted (qsort has no extra argument)
+static int compare_by_urgency(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    if (sort_queue[x].urgency != sort_queue[y].urgency)
+        return sort_queue[y].urgency - sort_queue[x].urgency;
+    return x - y;
+}
+
+// schedule_admissions() - Assigns waiting patients to hospital rows
+// hot[].available_beds is decreased for every placed patient; assigned_row[i] gets the
+// hospital row of queue[i] (-1 if no bed was left). Returns the number of placed patients.
+int schedule_admissions(Hospital *hot, const HospitalText *text, int hospital_count,
+                        const WaitingPatient *queue, int waiting_count, int *assigned_row)
+{
+    Dictionary cities = {0};  // Dense city codes for hospitals and patients
+    int *city_of_row = (int *)arena_alloc(&query_arena, (hospital_count + 1) * sizeof(int));
+    double *cost = (double *)arena_alloc(&query_arena, (hospital_count + 1) * sizeof(double));
+    for (int i = 0; i < hospital_count; i++)
+    {
+        city_of_row[i] = (int)dictionary_encode(&cities, city_key(hot[i].city));
+        cost[i] = admission_cost(&hot[i]);
+    }
+    int *city_of_patient = (int *)arena_alloc(&query_arena, (waiting_count + 1) * sizeof(int));
+    for (int i = 0; i < waiting_count; i++)  // Patients from cities without hospitals get empty heaps
+        city_of_patient[i] = (int)dictionary_encode(&cities, city_key(queue[i].city));
+    int city_count = (int)cities.count;
+
+    // One heap per city, all stored in one array: city c owns heap[start[c] .. start[c] + size[c])
+    int *start = (int *)arena_alloc(&query_arena, (city_count + 1) * sizeof(int));
+    int *size = (int *)arena_alloc(&query_arena, (city_count + 1) * sizeof(int));
+    float *centre = (float *)arena_alloc(&query_arena, (city_count + 1) * 3 * sizeof(float));
+    int *located = (int *)arena_alloc(&query_arena, (city_count + 1) * sizeof(int));
+    memset(size, 0, (city_count + 1) * sizeof(int));
+    memset(centre, 0, (city_count + 1) * 3 * sizeof(float));
+    memset(located, 0, (city_count + 1) * sizeof(int));
+    for (int i = 0; i < hospital_count; i++)
+    {
+        int c = city_of_row[i];
+        if (hot[i].available_beds > 0)
+            size[c]++;
+        if (text[i].latitude != NO_LOCATION)  // Add up hospital locations for the city centre
+        {
+            float xyz[3];
+            location_to_point(text[i].latitude, text[i].longitude, xyz);
+            for (int k = 0; k < 3; k++)
+                centre[c * 3 + k] += xyz[k];
+            located[c]++;
+        }
+    }
+    for (int c = 0, total = 0; c < city_count; c++)
+    {
+        start[c] = total;
+        total += size[c];
+        size[c] = 0;
+    }
+    int *heap = (int *)arena_alloc(&query_arena, (hospital_count + 1) * sizeof(int));
+    for (int i = 0; i < hospital_count; i++)
+        if (hot[i].available_beds > 0)
+            heap[start[city_of_row[i]] + size[city_of_row[i]]++] = i;
+    for (int c = 0; c < city_count; c++)
+    {
+        for (int i = size[c] / 2 - 1; i >= 0; i--)  // Heapify bottom-up
+            heap_sift_down(heap + start[c], size[c], i, cost);
+        float length = sqrtf(centre[c * 3] * centre[c * 3] + centre[c * 3 + 1] * centre[c * 3 + 1] + centre[c * 3 + 2] * centre[c * 3 + 2]);
+        for (int k = 0; located[c] && length > 0 && k < 3; k++)
+            centre[c * 3 + k] /= length;  // Back onto the unit sphere
+    }
+
+    // Most urgent patients choose first
+    int *order = (int *)arena_alloc(&query_arena, (waiting_count + 1) * sizeof(int));
+    for (int i = 0; i < waiting_count; i++)
+    {
+        order[i] = i;
+        assigned_row[i] = -1;
+    }
+    sort_queue = queue;
+    qsort(order, waiting_count, sizeof(int), compare_by_urgency);
+
+    int placed = 0;
+    for (int k = 0; k < waiting_count; k++)
+    {
+        int i = order[k], c = city_of_patient[i];
+        if (size[c] == 0)  // Own city is full: closest city with beds, then the cheapest bed
+        {
+            int best = -1;
+            float best_distance = 0;
+            for (int d = 0; d < city_count; d++)
+            {
+                if (size[d] == 0)
+                    continue;
+                float distance = located[c] && located[d] ? point_distance2(&centre[c * 3], &centre[d * 3]) : 5.0f;  // 5 > any unit-sphere distance
+                if (best < 0 || distance < best_distance ||
+                    (distance == best_distance && heap_before(cost, heap[start[d]], heap[start[best]])))
+                {
+                    best = d;
+                    best_distance = distance;
+                }
+            }
+            if (best < 0)
+                break;  // No free bed left anywhere
+            c = best;
+        }
+        int *city_heap = heap + start[c];
+        int row = city_heap[0];
+        assigned_row[i] = row;
+        placed++;
+        if (--hot[row].available_beds == 0)  // Hospital full: remove it from the heap
+        {
+            city_heap[0] = city_heap[--size[c]];
+            heap_sift_down(city_heap, size[c], 0, cost);
+        }
+    }
+    intmap_free(&cities.codes);
+    free(cities.values);
+    return placed;
+}
+
+// parse_waiting_line() - Fills w from "id|name|age|disease|city|urgency"
+static int parse_waiting_line(char *line, WaitingPatient *w)
+{
+    char *f[6];
+    if (split_fields(line, f, 6) != 6)
+        return 0;
+    w->patient_id = atoi(f[0]);
+    w->patient_name = intern_string(f[1]);
+    w->age = atoi(f[2]);
+    w->disease = dictionary_encode(&disease_dictionary, intern_string(f[3]));
+    w->city = intern_string(f[4]);
+    w->urgency = atoi(f[5]);
+    return 1;
+}
+
+// add_to_waiting_queue() - Puts a patient in the queue for the next batch assignment
+void add_to_waiting_queue()
+{
+    char name[NAME_SIZE], disease[DISEASE_SIZE], city[CITY_SIZE];
+    int patient_id = read_int("Enter Patient ID: ");
+    while (registry_contains(patient_id_registry(), patient_id))
+    {
+        printf(RED "Patient ID %d already exists! Please enter a unique ID.\n" RESET, patient_id);
+        patient_id = read_int("Enter Patient ID: ");
+    }
+    printf(GREEN "Enter Patient Name: " RESET);
+    fgets(name, NAME_SIZE, stdin);
+    name[strcspn(name, "\n")] = 0;
+    int age = read_int("Enter Patient Age: ");
+    printf(GREEN "Enter Disease/Condition: " RESET);
+    fgets(disease, DISEASE_SIZE, stdin);
+    disease[strcspn(disease, "\n")] = 0;
+    printf(GREEN "Enter City: " RESET);
+    fgets(city, CITY_SIZE, stdin);
+    city[strcspn(city, "\n")] = 0;
+    int urgency = read_int("Enter Urgency (1 = can wait to 5 = critical): ");
+    while (urgency < 1 || urgency > 5)
+    {
+        printf(RED "Urgency must be between 1 and 5!\n" RESET);
+        urgency = read_int("Enter Urgency (1 = can wait to 5 = critical): ");
+    }
+
+    FILE *fp = stats_fopen(WAITING_FILE, "a");
+    if (!fp)
+    {
+        printf(RED "Error opening waiting queue file\n" RESET);
+        return;
+    }
+    fprintf(fp, "%d|%s|%d|%s|%s|%d\n", patient_id, name, age, disease, city, urgency);
+    fclose(fp);
+    printf(GREEN BOLD "Patient added to the waiting queue.\n" RESET);
+}
+
+// AdmissionView structure: what render_admission_row needs
+typedef struct
+{
+    const WaitingPatient *queue;   // Waiting patients
+    const int *placed;             // Queue positions of placed patients, in placement order
+    const int *assigned_row;       // Hospital row per queue position
+    const Hospital *hot;           // Hospital rows
+    const HospitalText *text;      // Hospital names
+} AdmissionView;
+
+// render_admission_header() - Appends the column titles of the admission plan
+static void render_admission_header()
+{
+    out_text("\n\n-------------------------------------------------------------------------------------------------------------------\n");
+    out_padded("ID", 5, 0);
+    out_text(" | ");
+    out_padded("Patient", 20, 1);
+    out_text(" | ");
+    out_padded("Urg", 3, 0);
+    out_text(" | ");
+    out_padded("City", 12, 1);
+    out_text(" | ");
+    out_padded("Hosp", 5, 0);
+    out_text(" | ");
+    out_padded("Hospital Name", 30, 1);
+    out_text(" | ");
+    out_padded("Hosp City", 12, 1);
+    out_text(" | ");
+    out_padded("Price", 10, 1);
+    out_text("\n-------------------------------------------------------------------------------------------------------------------\n");
+}
+
+// render_admission_row() - Appends one placed patient and the hospital they go to
+static void render_admission_row(int index, const void *table)
+{
+    const AdmissionView *view = (const AdmissionView *)table;
+    const WaitingPatient *w = &view->queue[view->placed[index]];
+    int row = view->assigned_row[view->placed[index]];
+    const Hospital *h = &view->hot[row];
+
+    out_color(city_key(h->city) == city_key(w->city) ? CYAN : YELLOW);  // Yellow = moved to another city
+    out_int(w->patient_id, 5, 0);
+    out_text(" | ");
+    out_padded(str_of(w->patient_name), 20, 1);
+    out_text(" | ");
+    out_int(w->urgency, 3, 0);
+    out_text(" | ");
+    out_padded(str_of(w->city), 12, 1);
+    out_text(" | ");
+    out_int(h->hospital_id, 5, 0);
+    out_text(" | ");
+    out_padded(str_of(view->text[row].hospital_name), 30, 1);
+    out_text(" | ");
+    out_padded(str_of(h->city), 12, 1);
+    out_text(" | ");
+    out_fixed(h->bed_price, 2, 10);
+    out_color(RESET);
+    out_bytes("\n", 1);
+}
+
+// save_hospital_beds() - Writes the changed bed counts back to hospitals.txt in one pass
+// changed[row] marks the rows to rewrite; every other line is copied as it is
+static int save_hospital_beds(const Hospital *hot, const HospitalText *text, const unsigned char *changed, int count)
+{
+    FILE *in = stats_fopen(HOSPITAL_FILE, "r");
+    if (!in)
+        return 0;
+    FILE *out = stats_fopen(HOSPITAL_TEMP_FILE, "w");
+    if (!out)
+    {
+        fclose(in);
+        return 0;
+    }
+    char line[LINE_SIZE], copy[LINE_SIZE];
+    int row = 0;
+    while (read_line(line, LINE_SIZE, in))
+    {
+        Hospital h;
+        HospitalText t;
+        strcpy(copy, line);
+        if (parse_hospital_line(copy, &h, &t) && row < count && changed[row++])
+            write_hospital_line(out, &hot[row - 1], &text[row - 1]);
+        else
+            fputs(line, out);
+    }
+    fclose(in);
+    int write_error = ferror(out);
+    if (fclose(out) != 0 || write_error)  // Disk full: keep the old file
+    {
+        remove(HOSPITAL_TEMP_FILE);
+        return 0;
+    }
+    replication_lock();
+    if (!replace_file(HOSPITAL_TEMP_FILE, HOSPITAL_FILE))
+    {
+        replication_unlock();
+        remove(HOSPITAL_TEMP_FILE);  // hospitals.txt is unchanged
+        return 0;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (changed[i])
+            replication_update_hospital(i, &hot[i], &text[i]);  // Ship the new bed counts to read replicas
+    }
+    replication_unlock();
+    bump_table_version(TABLE_HOSPITALS);
+    invalidate_hospital_shards();
+    return 1;
+}
+
+// assign_waiting_patients() - Places the waiting queue, shows the plan and saves it if confirmed
+void assign_waiting_patients()
+{
+    arena_reset(&query_arena);  // Reuse the memory of the previous query
+    int capacity = count_records(WAITING_FILE);
+    if (capacity == 0)
+    {
+        printf(RED "No patients are waiting.\n" RESET);
+        return;
+    }
+
+    // Read the queue; lines with a bad format or an ID already in use stay in the queue
+    WaitingPatient *queue = (WaitingPatient *)arena_alloc(&query_arena, capacity * sizeof(WaitingPatient));
+    char (*lines)[LINE_SIZE] = arena_alloc(&query_arena, capacity * sizeof(*lines));  // Original text per entry
+    int waiting = 0, rejected = 0, line_count = 0;
+    FILE *fp = stats_fopen(WAITING_FILE, "r");
+    if (!fp)
+        return;
+    IdRegistry queued = {0};  // IDs seen earlier in this queue
+    registry_init(&queued, capacity);
+    char line[LINE_SIZE];
+    while (line_count < capacity && read_line(line, LINE_SIZE, fp))
+    {
+        strcpy(lines[line_count], line);
+        WaitingPatient *w = &queue[waiting];
+        if (!parse_waiting_line(line, w) || registry_contains(patient_id_registry(), w->patient_id) ||
+            !registry_insert(&queued, w->patient_id))
+        {
+            if (line[0] != '\0')
+                rejected++;
+            line_count++;
+            continue;
+        }
+        w->line = line_count++;
+        waiting++;
+    }
+    fclose(fp);
+    registry_free(&queued);
+
+    int n = count_records(HOSPITAL_FILE);
+    Hospital *hot = (Hospital *)arena_alloc(&query_arena, (n + 1) * sizeof(Hospital));
+    HospitalText *text = (HospitalText *)arena_alloc(&query_arena, (n + 1) * sizeof(HospitalText));
+    load_hospitals(hot, text, &n);
+    int *beds_before = (int *)arena_alloc(&query_arena, (n + 1) * sizeof(int));
+    for (int i = 0; i < n; i++)
+        beds_before[i] = hot[i].available_beds;
+
+    int *assigned_row = (int *)arena_alloc(&query_arena, (waiting + 1) * sizeof(int));
+    uint64_t started = stats_start();  // Time only the assignment
+    double began = now_seconds();
+    int placed = schedule_admissions(hot, text, n, queue, waiting, assigned_row);
+    double elapsed = now_seconds() - began;
+    stats_record(OP_SCHEDULE, started);
+
+    // Show the plan in the order patients were placed
+    int *placed_order = (int *)arena_alloc(&query_arena, (waiting + 1) * sizeof(int));
+    int shown = 0;
+    for (int i = 0; i < waiting; i++)
+        placed_order[i] = i;
+    sort_queue = queue;
+    qsort(placed_order, waiting, sizeof(int), compare_by_urgency);
+    for (int i = 0; i < waiting; i++)
+        if (assigned_row[placed_order[i]] >= 0)
+            placed_order[shown++] = placed_order[i];
+
+    printf(MAGENTA BOLD "\n--- Batch Admission Plan ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    if (shown > 0)
+    {
+        AdmissionView view = {queue, placed_order, assigned_row, hot, text};
+        render_table(render_admission_header, render_admission_row, &view, shown);
+        printf("(yellow rows were moved to another city because their own city was full)\n");
+    }
+    printf(YELLOW "Waiting patients: %d   Placed: %d   Still waiting (no free bed): %d   Invalid/duplicate entries: %d\n" RESET,
+           waiting, placed, waiting - placed, rejected);
+    printf(YELLOW "Assignment time: %.3f ms\n" RESET, elapsed * 1000.0);
+    if (placed == 0)
+        return;
+
+    char answer[8];
+    printf(GREEN "Admit these patients? (y/n): " RESET);
+    if (!fgets(answer, sizeof(answer), stdin) || (answer[0] != 'y' && answer[0] != 'Y'))
+    {
+        printf(YELLOW "Nothing was changed.\n" RESET);
+        return;
+    }
+
+    // 1. Write the new bed counts in one pass and move the ranking and k-d tree along
+    // (first, so no patient is admitted to a bed that was never taken off the hospital)
+    unsigned char *changed = (unsigned char *)arena_alloc(&query_arena, n + 1);
+    for (int i = 0; i < n; i++)
+        changed[i] = hot[i].available_beds != beds_before[i];
+    int64_t old_size = data_file_size(HOSPITAL_FILE);
+    if (!save_hospital_beds(hot, text, changed, n))
+    {
+        printf(RED "Error updating hospital file! No patients were admitted and the queue is unchanged.\n" RESET);
+        return;
+    }
+    int64_t new_size = data_file_size(HOSPITAL_FILE);
+    for (int i = 0; i < n; i++)
+    {
+        if (!changed[i])
+            continue;
+        ranking_update(i, &hot[i], old_size, new_size);
+        spatial_update_beds(hot[i].hospital_id, hot[i].available_beds, old_size, new_size);
+        old_size = new_size;  // Both are current after the first update
+    }
+
+    // 2. Append the placed patients (keeps the ID registry and all patient indexes current)
+    open_patient_indexes();  // Bring the indexes up to date before the file grows
+    DurableAck *acks = (DurableAck *)arena_alloc(&query_arena, (shown + 1) * sizeof(DurableAck));
+    for (int k = 0; k < shown; k++)
+    {
+        const WaitingPatient *w = &queue[placed_order[k]];
+        Patient p = {w->patient_id, w->patient_name, w->age, w->disease, hot[assigned_row[placed_order[k]]].hospital_id};
+        acks[k].table = TABLE_PATIENTS;
+        acks[k].ok = acks[k].done = 0;
+        save_patient(&p, &acks[k]);  // Queued for the background writer (one batch for the whole group)
+    }
+
+    // 3. Wait until they are on the disk; a patient whose line was lost keeps its
+    // place in the queue and gives its bed back
+    unsigned char *admitted = (unsigned char *)arena_alloc(&query_arena, line_count + 1);
+    memset(admitted, 0, line_count + 1);
+    memset(changed, 0, n + 1);
+    int lost = 0;
+    for (int k = 0; k < shown; k++)
+    {
+        const WaitingPatient *w = &queue[placed_order[k]];
+        int row = assigned_row[placed_order[k]];
+        if (persist_wait_ack(&acks[k]))
+        {
+            admitted[w->line] = 1;
+            log_patient_event(EVENT_ADMIT, w->patient_id, hot[row].hospital_id, 0);
+        }
+        else
+        {
+            hot[row].available_beds++;
+            changed[row] = 1;
+            lost++;
+        }
+    }
+    if (lost > 0)
+    {
+        old_size = data_file_size(HOSPITAL_FILE);
+        if (!save_hospital_beds(hot, text, changed, n))
+            printf(RED "Error updating hospital file! The beds of the patients that were not saved are still taken.\n" RESET);
+        new_size = data_file_size(HOSPITAL_FILE);
+        for (int i = 0; i < n; i++)
+        {
+            if (!changed[i])
+                continue;
+            ranking_update(i, &hot[i], old_size, new_size);
+            spatial_update_beds(hot[i].hospital_id, hot[i].available_beds, old_size, new_size);
+            old_size = new_size;
+        }
+    }
+
+    // 4. Keep only the patients that are still waiting in the queue
+    fp = stats_fopen(WAITING_FILE, "w");
+    if (fp)
+    {
+        for (int i = 0; i < line_count; i++)
+            if (!admitted[i])
+                fputs(lines[i], fp);
+        fclose(fp);
+    }
+    printf(GREEN BOLD "%d patients admitted, %d still waiting.\n" RESET, placed - lost, waiting - placed + lost);
+    if (lost > 0)
+        printf(RED "%d patient(s) could not be saved to %s and stay in the queue.\n" RESET, lost, PATIENT_FILE);
+}
+
+// ===== CITY SHARDS =====
+// Optionally (System Tools), hospitals.txt is also kept split into HOSPITAL_SHARDS
+// shard files by city: every hospital goes to shard hash(lower-case city) % HOSPITAL_SHARDS,
+// so all hospitals of one city are in the same shard. Each shard line is the
+// hospitals.txt line with its row number in front ("row|id|name|..."), which lets
+// merged results keep the same order as the single file for equal keys.
+//   - "Display Hospitals by City" reads only the shard of that city
+//   - the global sorted listings load and sort every shard in its own thread, then
+//     a k-way merge (min-heap of shard heads) produces the full order
+// hospitals.txt stays the master copy. SHARD_MANIFEST_FILE records its size; if the
+// size no longer matches (a rating or bed update rewrote it, or it was edited by
+// hand) the shards are rebuilt from it in one pass before they are used.
+// add_hospital() appends to the right shard directly.
+// Patients are not sharded: their lookups already go through the B+ tree indexes.
+
+// run_parallel() - Runs task(args[i]) for count argument blocks, each in its own thread
+// Falls back to running a task in this thread if a thread cannot be started.
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID start)
+{
+    WorkerStart *w = (WorkerStart *)start;
+    w->task(w->arg);
+    return 0;
+}
+#else
+static void *worker_main(void *start)
+{
+    WorkerStart *w = (WorkerStart *)start;
+    w->task(w->arg);
+    return NULL;
+}
+#endif
+
+void run_parallel(void (*task)(void *), void *args, size_t arg_size, int count)
+{
+    WorkerStart *starts = (WorkerStart *)stats_malloc(count * sizeof(WorkerStart));
+    WorkerThread *threads = (WorkerThread *)stats_malloc(count * sizeof(WorkerThread));
+    unsigned char *started = (unsigned char *)stats_calloc(count, 1);
+    for (int i = 0; i < count; i++)
+    {
+        starts[i].task = task;
+        starts[i].arg = (char *)args + i * arg_size;
+#ifdef _WIN32
+        threads[i] = CreateThread(NULL, 0, worker_main, &starts[i], 0, NULL);
+        started[i] = threads[i] != NULL;
+#else
+        started[i] = pthread_create(&threads[i], NULL, worker_main, &starts[i]) == 0;
+#endif
+        if (!started[i])
+            task(starts[i].arg);  // No thread available, do the work here
+    }
+    for (int i = 0; i < count; i++)  // Wait for every thread to finish
+    {
+        if (!started[i])
+            continue;
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    free(starts);
+    free(threads);
+    free(started);
+}
+
+// shard_of_city() - Shard number of a city (case-insensitive)
+int shard_of_city(const char *city)
+{
+    char lowered[CITY_SIZE];
+    lower_copy(city, lowered, CITY_SIZE);
+    return (int)(hash_string(lowered) % HOSPITAL_SHARDS);
+}
+
+// shard_filename() - Name of the file holding one shard
+void shard_filename(int shard, char *filename, int size)
+{
+    snprintf(filename, size, HOSPITAL_SHARD_FORMAT, shard);
+}
+
+// read_shard_manifest() - Reads the size of hospitals.txt and the row count the shards match
+// Returns 0 if sharding is switched off (no manifest)
+static int read_shard_manifest(int64_t *source_size, int *rows)
+{
+    FILE *fp = stats_fopen(SHARD_MANIFEST_FILE, "r");
+    if (!fp)
+        return 0;
+    long long size = -1;
+    int ok = fscanf(fp, "%lld|%d", &size, rows) == 2;
+    fclose(fp);
+    *source_size = ok ? size : -1;  // A damaged manifest just forces a rebuild
+    if (!ok)
+        *rows = 0;
+    return 1;
+}
+
+// write_shard_manifest() - Records which hospitals.txt the shards belong to
+static void write_shard_manifest(int64_t source_size, int rows)
+{
+    FILE *fp = stats_fopen(SHARD_MANIFEST_FILE, "w");
+    if (!fp)
+        return;
+    fprintf(fp, "%lld|%d\n", (long long)source_size, rows);
+    fclose(fp);
+}
+
+// build_hospital_shards() - Splits hospitals.txt into the shard files (one pass)
+int build_hospital_shards()
+{
+    FILE *shards[HOSPITAL_SHARDS];
+    char filename[64];
+    for (int i = 0; i < HOSPITAL_SHARDS; i++)
+    {
+        shard_filename(i, filename, sizeof(filename));
+        shards[i] = stats_fopen(filename, "w");
+        if (!shards[i])
+        {
+            while (i-- > 0)
+                fclose(shards[i]);
+            return 0;
+        }
+    }
+    int64_t size = data_file_size(HOSPITAL_FILE);
+    int rows = 0;
+    FILE *fp = stats_fopen(HOSPITAL_FILE, "r");
+    if (fp)
+    {
+        char line[LINE_SIZE], copy[LINE_SIZE];
+        while (read_line(line, LINE_SIZE, fp))
+        {
+            Hospital h;
+            HospitalText t;
+            strcpy(copy, line);
+            if (!parse_hospital_line(copy, &h, &t))
+                continue;  // Same rows as load_hospitals()
+            line[strcspn(line, "\r\n")] = '\0';
+            fprintf(shards[shard_of_city(str_of(h.city))], "%d|%s\n", rows++, line);
+        }
+        fclose(fp);
+    }
+    for (int i = 0; i < HOSPITAL_SHARDS; i++)
+        fclose(shards[i]);
+    write_shard_manifest(size, rows);
+    return 1;
+}
+
+// hospital_shards_ready() - 1 if sharding is on (rebuilding stale shards first)
+int hospital_shards_ready()
+{
+    int64_t source_size;
+    int rows;
+    if (!read_shard_manifest(&source_size, &rows))
+        return 0;
+    if (source_size != data_file_size(HOSPITAL_FILE))
+        return build_hospital_shards();
+    return 1;
+}
+
+// shard_add_hospital() - Appends a new hospital to its shard
+// Parameters: old_size/new_size = size of hospitals.txt before and after the new line
+void shard_add_hospital(const Hospital *h, const HospitalText *t, int64_t old_size, int64_t new_size)
+{
+    int64_t source_size;
+    int rows;
+    if (!read_shard_manifest(&source_size, &rows) || source_size != old_size)
+        return;  // Sharding off, or stale (rebuilt on next use)
+    char filename[64], line[LINE_SIZE];
+    shard_filename(shard_of_city(str_of(h->city)), filename, sizeof(filename));
+    FILE *fp = stats_fopen(filename, "a");
+    if (!fp)
+        return;
+    format_hospital_line(line, LINE_SIZE, h, t);
+    fprintf(fp, "%d|%s", rows, line);
+    fclose(fp);
+    write_shard_manifest(new_size, rows + 1);
+}
+
+// invalidate_hospital_shards() - Makes the next query rebuild the shards
+// Called after hospitals.txt is rewritten in place (ratings, beds): the changed
+// lines can keep the same length, so the file size alone would not show it
+void invalidate_hospital_shards()
+{
+    int64_t source_size;
+    int rows;
+    if (read_shard_manifest(&source_size, &rows))
+        write_shard_manifest(-1, rows);
+}
+
+// load_hospital_shard() - Reads one shard into hot/text tables (like load_hospitals)
+void load_hospital_shard(int shard, Hospital *hospitals, HospitalText *text, int *n)
+{
+    uint64_t started = stats_start();
+    char filename[64], line[LINE_SIZE];
+    shard_filename(shard, filename, sizeof(filename));
+    int i = 0;
+    FILE *fp = stats_fopen(filename, "r");
+    if (fp)
+    {
+        while (i < *n && read_line(line, LINE_SIZE, fp))
+        {
+            char *record = strchr(line, '|');  // Skip the row number
+            if (record && parse_hospital_line(record + 1, &hospitals[i], &text[i]))
+                i++;
+        }
+        fclose(fp);
+    }
+    *n = i;
+    stats_record(OP_LOAD, started);
+}
+
+// Shard comparators: same orders as compare_by_bed_price/available_beds/name, but they
+// compare ShardRow values directly so every thread can sort without shared globals
+static int compare_shard_by_bed_price(const void *a, const void *b)
+{
+    const ShardRow *x = (const ShardRow *)a, *y = (const ShardRow *)b;
+    if (x->bed_price != y->bed_price)
+        return x->bed_price < y->bed_price ? 1 : -1;
+    return x->row - y->row;
+}
+
+static int compare_shard_by_available_beds(const void *a, const void *b)
+{
+    const ShardRow *x = (const ShardRow *)a, *y = (const ShardRow *)b;
+    if (x->available_beds != y->available_beds)
+        return x->available_beds < y->available_beds ? 1 : -1;
+    return x->row - y->row;
+}
+
+static int compare_shard_by_name(const void *a, const void *b)
+{
+    const ShardRow *x = (const ShardRow *)a, *y = (const ShardRow *)b;
+    int result = strcmp(x->name, y->name);
+    return result != 0 ? result : x->row - y->row;
+}
+
+// shard_comparator() - Shard version of a row comparator (NULL if there is none)
+static int (*shard_comparator(int (*compare)(const void *, const void *)))(const void *, const void *)
+{
+    if (compare == compare_by_bed_price)
+        return compare_shard_by_bed_price;
+    if (compare == compare_by_available_beds)
+        return compare_shard_by_available_beds;
+    if (compare == compare_by_name)
+        return compare_shard_by_name;
+    return NULL;
+}
+
+// load_and_sort_shard() - Thread task: reads one whole shard file and sorts its rows
+// Uses plain fopen/malloc because the statistics counters are not thread-safe;
+// the caller adds this task's numbers to the statistics after all threads finish.
+static void load_and_sort_shard(void *arg)
+{
+    ShardTask *task = (ShardTask *)arg;
+    char filename[64];
+    shard_filename(task->shard, filename, sizeof(filename));
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return;
+    file_seek(fp, 0, SEEK_END);
+    int64_t size = file_tell(fp);
+    file_seek(fp, 0, SEEK_SET);
+    task->buffer = (char *)malloc(size + 1);
+    task->bytes = (int64_t)fread(task->buffer, 1, size, fp);
+    task->buffer[task->bytes] = '\0';
+    fclose(fp);
+
+    int lines = 0;
+    for (char *c = task->buffer; *c; c++)
+        lines += *c == '\n';
+    task->rows = (ShardRow *)malloc((lines + 1) * sizeof(ShardRow));
+    char *line = task->buffer;
+    while (*line)
+    {
+        char *end = strchr(line, '\n');
+        char *next = end ? end + 1 : line + strlen(line);
+        if (end)
+            *end = '\0';
+        char *f[10];
+        int fields = split_fields(line, f, 10);  // row + the seven or nine hospital fields
+        if (fields == 8 || fields == 10)
+        {
+            ShardRow *r = &task->rows[task->count++];
+            r->row = atoi(f[0]);
+            r->hospital_id = atoi(f[1]);
+            r->name = f[2];
+            r->city = f[3];
+            r->available_beds = atoi(f[4]);
+            r->bed_price = strtof(f[5], NULL);
+            r->rating = strtof(f[6], NULL);
+            r->reviews = atoi(f[7]);
+            r->latitude = fields == 10 ? strtof(f[8], NULL) : NO_LOCATION;
+            r->longitude = fields == 10 ? strtof(f[9], NULL) : 0;
+        }
+        line = next;
+    }
+    qsort(task->rows, task->count, sizeof(ShardRow), task->compare);
+}
+
+// shard_head_before() - 1 if the next row of shard a comes before the next row of shard b
+static int shard_head_before(const ShardTask *tasks, const int *pos, int a, int b,
+                             int (*compare)(const void *, const void *))
+{
+    return compare(&tasks[a].rows[pos[a]], &tasks[b].rows[pos[b]]) < 0;
+}
+
+// load_sorted_hospital_shards() - Parallel version of load_sorted_hospitals()
+// Every shard is loaded and sorted in its own thread, then the sorted shards are
+// merged with a min-heap of shard heads. Returns -1 if this sort has no shard version.
+int load_sorted_hospital_shards(Hospital **hot, HospitalText **text, int **order,
+                                int (*compare)(const void *, const void *))
+{
+    int (*shard_compare)(const void *, const void *) = shard_comparator(compare);
+    if (!shard_compare)
+        return -1;
+
+    ShardTask tasks[HOSPITAL_SHARDS];
+    memset(tasks, 0, sizeof(tasks));
+    for (int i = 0; i < HOSPITAL_SHARDS; i++)
+    {
+        tasks[i].shard = i;
+        tasks[i].compare = shard_compare;
+    }
+    uint64_t started = stats_start();  // Parallel load + sort of all shards
+    run_parallel(load_and_sort_shard, tasks, sizeof(ShardTask), HOSPITAL_SHARDS);
+    stats_record(OP_LOAD, started);
+
+    int n = 0;
+    for (int i = 0; i < HOSPITAL_SHARDS; i++)  // Add the threads' work to the statistics
+    {
+        n += tasks[i].count;
+        stats.file_opens++;
+        stats.bytes_read += tasks[i].bytes;
+        stats.records_parsed += tasks[i].count;
+        stats.heap_allocations += 2;
+    }
+
+    // k-way merge: heap[] holds the shards that still have rows, best head on top
+    started = stats_start();
+    arena_reset(&query_arena);  // Reuse the memory of the previous query
+    *hot = (Hospital *)arena_alloc(&query_arena, (n + 1) * sizeof(Hospital));
+    *text = (HospitalText *)arena_alloc(&query_arena, (n + 1) * sizeof(HospitalText));
+    *order = (int *)arena_alloc(&query_arena, (n + 1) * sizeof(int));
+    int heap[HOSPITAL_SHARDS], pos[HOSPITAL_SHARDS], size = 0;
+    for (int i = 0; i < HOSPITAL_SHARDS; i++)
+    {
+        pos[i] = 0;
+        if (tasks[i].count == 0)
+            continue;
+        int c = size++;  // Sift the new shard up
+        while (c > 0 && shard_head_before(tasks, pos, i, heap[(c - 1) / 2], shard_compare))
+        {
+            heap[c] = heap[(c - 1) / 2];
+            c = (c - 1) / 2;
+        }
+        heap[c] = i;
+    }
+    for (int k = 0; k < n; k++)
+    {
+        int s = heap[0];
+        const ShardRow *r = &tasks[s].rows[pos[s]++];
+        Hospital *h = &(*hot)[k];
+        h->hospital_id = r->hospital_id;
+        h->available_beds = r->available_beds;
+        h->bed_price = r->bed_price;
+        h->rating = r->rating;
+        h->reviews = r->reviews;
+        h->city = intern_string(r->city);
+        (*text)[k].hospital_name = intern_string(r->name);
+        (*text)[k].latitude = r->latitude;
+        (*text)[k].longitude = r->longitude;
+        (*order)[k] = k;  // Rows are already in sorted order
+
+        if (pos[s] == tasks[s].count)  // Shard used up: move the last shard to the top
+            heap[0] = heap[--size];
+        int c = 0;  // Sift the top down
+        while (size > 0)
+        {
+            int best = c, left = 2 * c + 1, right = 2 * c + 2;
+            if (left < size && shard_head_before(tasks, pos, heap[left], heap[best], shard_compare))
+                best = left;
+            if (right < size && shard_head_before(tasks, pos, heap[right], heap[best], shard_compare))
+                best = right;
+            if (best == c)
+                break;
+            int swap = heap[c];
+            heap[c] = heap[best];
+            heap[best] = swap;
+            c = best;
+        }
+    }
+    for (int i = 0; i < HOSPITAL_SHARDS; i++)
+    {
+        free(tasks[i].rows);
+        free(tasks[i].buffer);
+    }
+    stats_record(OP_SORT, started);
+    return n;
+}
+
+// toggle_hospital_shards() - Switches the city shards on (building them) or off (deleting them)
+void toggle_hospital_shards()
+{
+    int64_t source_size;
+    int rows;
+    char filename[64];
+    if (read_shard_manifest(&source_size, &rows))
+    {
+        for (int i = 0; i < HOSPITAL_SHARDS; i++)
+        {
+            shard_filename(i, filename, sizeof(filename));
+            remove(filename);
+        }
+        remove(SHARD_MANIFEST_FILE);
+        printf(YELLOW "City shards switched off; all queries read %s again.\n" RESET, HOSPITAL_FILE);
+        return;
+    }
+    double started = now_seconds();
+    if (!build_hospital_shards())
+    {
+        printf(RED "Error creating shard files\n" RESET);
+        return;
+    }
+    read_shard_manifest(&source_size, &rows);
+    printf(GREEN BOLD "City shards switched on: %d hospitals split into %d shards in %.1f ms.\n" RESET,
+           rows, HOSPITAL_SHARDS, (now_seconds() - started) * 1000.0);
+    printf(YELLOW "City queries now read one shard; sorted listings sort the shards in parallel.\n" RESET);
+}
+
+// ===== READ REPLICAS (LOG SHIPPING) =====
+// A primary started with "--primary [port]" keeps a replication log in memory:
+// every change it makes to hospitals.txt or patients.txt is also stored as a
+// numbered record. A shipper thread listens on 127.0.0.1 and streams the records
+// to the connected read replicas, so a write only costs one extra log line in
+// memory and the front desk never waits for a replica.
+// A replica is the same program started with "--replica [port]". It gets a
+// snapshot of both files when it connects, then applies every record to its own
+// in-memory tables and answers the reporting queries (listings, sorted listings,
+// patient dump) from memory without opening the data files.
+//
+// Messages are text lines:
+//   primary -> replica   S|seq|time                        snapshot taken at record seq follows
+//                        h|<hospitals.txt line>            one snapshot hospital
+//                        p|<patients.txt line>             one snapshot patient
+//                        E                                 end of the snapshot
+//                        R|seq|time|H|<hospital line>      hospital added
+//                        R|seq|time|U|row|<hospital line>  hospital row rewritten
+//                        R|seq|time|P|<patient line>       patient added
+//                        B|seq|time                        heartbeat with the newest record
+//   replica -> primary   K|key                             first line: the secret from replication.key
+//                        A|seq                             records up to seq are applied
+// Replication lag is shown on both sides: how many records a replica is behind,
+// and how long ago the oldest record it has not applied was written.
+// The port only listens on 127.0.0.1, but any local user could still connect and
+// read every record. So the primary writes a random key to replication.key, which
+// only its owner can read, and closes every connection that does not send that key
+// before the snapshot.
+
+// lock_init() - Prepares a mutex
+void lock_init(WorkerLock *lock)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(lock);
+#else
+    pthread_mutex_init(lock, NULL);
+#endif
+}
+
+// lock_acquire() - Waits for and takes a mutex
+void lock_acquire(WorkerLock *lock)
+{
+#ifdef _WIN32
+    EnterCriticalSection(lock);
+#else
+    pthread_mutex_lock(lock);
+#endif
+}
+
+// lock_release() - Gives a mutex back
+void lock_release(WorkerLock *lock)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(lock);
+#else
+    pthread_mutex_unlock(lock);
+#endif
+}
+
+// signal_init() - Prepares a condition variable
+void signal_init(WorkerSignal *signal)
+{
+#ifdef _WIN32
+    InitializeConditionVariable(signal);
+#else
+    pthread_cond_init(signal, NULL);
+#endif
+}
+
+// signal_wait() - Lets go of lock, sleeps until signal_wake_all(), then takes lock again
+// May also wake up without a reason, so callers check their condition in a loop
+void signal_wait(WorkerSignal *signal, WorkerLock *lock)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(signal, lock, INFINITE);
+#else
+    pthread_cond_wait(signal, lock);
+#endif
+}
+
+// signal_wake_all() - Wakes every thread sleeping on a condition variable
+// The caller holds the matching lock, so a thread that is just about to sleep cannot miss it
+void signal_wake_all(WorkerSignal *signal)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(signal);
+#else
+    pthread_cond_broadcast(signal);
+#endif
+}
+
+// start_worker() - Starts a thread that runs until the program exits
+// Returns 1 on success
+int start_worker(WorkerStart *start)
+{
+#ifdef _WIN32
+    HANDLE thread = CreateThread(NULL, 0, worker_main, start, 0, NULL);
+    if (!thread)
+        return 0;
+    CloseHandle(thread);  // Nobody waits for it
+    return 1;
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker_main, start) != 0)
+        return 0;
+    pthread_detach(thread);
+    return 1;
+#endif
+}
+
+// wall_clock_ms() - Current time in milliseconds (the same clock in every process)
+int64_t wall_clock_ms()
+{
+#ifdef _WIN32
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    return (int64_t)((((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime) / 10000);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+// network_init() - Starts the socket library
+// On POSIX systems a send() to a replica that has gone away raises SIGPIPE, which
+// would end the whole program; ignoring it turns that into an error from send()
+static int network_init()
+{
+#ifdef _WIN32
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    signal(SIGPIPE, SIG_IGN);
+    return 1;
+#endif
+}
+
+// send_all() - Sends length bytes, returns 0 if the connection is gone
+static int send_all(ReplicaSocket s, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        int sent = send(s, data, (int)(length > 65536 ? 65536 : length), MSG_NOSIGNAL);
+        if (sent <= 0)
+            return 0;
+        data += sent;
+        length -= sent;
+    }
+    return 1;
+}
+
+// text_append() - Adds n bytes to a growing text buffer
+// Uses plain realloc because it also runs on the shipper thread
+static void text_append(TextBuffer *b, const char *text, size_t n)
+{
+    if (b->length + n + 1 > b->capacity)
+    {
+        b->capacity = (b->length + n + 1) * 2;
+        b->data = (char *)realloc(b->data, b->capacity);
+    }
+    memcpy(b->data + b->length, text, n);
+    b->length += n;
+    b->data[b->length] = '\0';
+}
+
+// ----- Primary side -----
+
+// replication_lock() - Taken around every change of the data files (no-op without --primary)
+// A new replica's snapshot is read under the same lock, so it sees each change
+// either in the files or as a record that follows the snapshot, never both
+void replication_lock()
+{
+    if (replication.enabled)
+        lock_acquire(&replication.lock);
+}
+
+// replication_unlock() - Ends a change of the data files
+void replication_unlock()
+{
+    if (replication.enabled)
+        lock_release(&replication.lock);
+}
+
+// replication_resync() - Makes every connected replica reload a snapshot of the files
+// For records that were logged for lines that never reached the disk. The shipper
+// drops the replicas; they reconnect and get the files as they really are.
+void replication_resync()
+{
+    if (!replication.enabled)
+        return;
+    lock_acquire(&replication.lock);
+    replication.resync = 1;
+    lock_release(&replication.lock);
+}
+
+// replication_push() - Adds a record to the replication log (lock held by the caller)
+// payload is the record text after the operation letter, without a line ending
+static void replication_push(char op, const char *payload)
+{
+    if (replication.count == replication.capacity)
+    {
+        replication.capacity = replication.capacity ? replication.capacity * 2 : 64;
+        replication.records = (ReplicationRecord *)stats_realloc(replication.records,
+                                                                  replication.capacity * sizeof(ReplicationRecord));
+    }
+    ReplicationRecord *r = &replication.records[replication.count++];
+    r->seq = ++replication.head_seq;
+    r->time_ms = wall_clock_ms();
+    char line[2 * LINE_SIZE];
+    int length = snprintf(line, sizeof(line), "R|%lld|%lld|%c|%s\n", (long long)r->seq, (long long)r->time_ms, op, payload);
+    r->text = (char *)stats_malloc(length + 1);
+    memcpy(r->text, line, length + 1);
+}
+
+// replication_append_hospital() - Logs a hospital added to the end of hospitals.txt
+void replication_append_hospital(const Hospital *h, const HospitalText *t)
+{
+    if (!replication.enabled)
+        return;
+    char line[LINE_SIZE];
+    format_hospital_line(line, LINE_SIZE, h, t);
+    line[strcspn(line, "\n")] = '\0';
+    replication_push('H', line);
+}
+
+// replication_update_hospital() - Logs a rewritten hospital line (row = position among the hospitals)
+void replication_update_hospital(int row, const Hospital *h, const HospitalText *t)
+{
+    if (!replication.enabled)
+        return;
+    char line[LINE_SIZE], payload[LINE_SIZE + 16];
+    format_hospital_line(line, LINE_SIZE, h, t);
+    line[strcspn(line, "\n")] = '\0';
+    snprintf(payload, sizeof(payload), "%d|%s", row, line);
+    replication_push('U', payload);
+}
+
+// replication_append_patient() - Logs a patient added to the end of patients.txt
+void replication_append_patient(const Patient *p)
+{
+    if (!replication.enabled)
+        return;
+    char line[LINE_SIZE];
+    format_patient_line(line, LINE_SIZE, p);
+    line[strcspn(line, "\n")] = '\0';
+    replication_push('P', line);
+}
+
+// snapshot_file() - Adds every line of a data file to a snapshot as "<kind>|<line>"
+static void snapshot_file(TextBuffer *b, const char *filename, char kind)
+{
+    persist_wait_for_file(filename);  // Queued lines are logged already, so they must be in the snapshot
+    FILE *fp = fopen(filename, "r");  // Plain fopen: this runs on the shipper thread
+    if (!fp)
+        return;
+    char line[LINE_SIZE + 3];
+    line[0] = kind;
+    line[1] = '|';
+    while (fgets(line + 2, LINE_SIZE, fp))  // Same line pieces as read_line() gives load_hospitals()
+    {
+        size_t length = strlen(line);
+        if (line[length - 1] != '\n')
+            line[length++] = '\n';
+        text_append(b, line, length);
+    }
+    fclose(fp);
+}
+
+// random_bytes() - Fills buffer with n bytes from the system's secure random source
+// Returns 1 on success
+static int random_bytes(unsigned char *buffer, int n)
+{
+#ifdef _WIN32
+    for (int i = 0; i < n; i++)
+    {
+        unsigned int value;
+        if (rand_s(&value) != 0)
+            return 0;
+        buffer[i] = (unsigned char)value;
+    }
+    return 1;
+#else
+    FILE *fp = fopen("/dev/urandom", "rb");
+    if (!fp)
+        return 0;
+    int ok = fread(buffer, 1, n, fp) == (size_t)n;
+    fclose(fp);
+    return ok;
+#endif
+}
+
+// write_replication_key() - Makes a new random key and saves it to REPLICATION_KEY_FILE
+// On POSIX the file is created with mode 0600 (owner only); on Windows it gets the
+// permissions of the folder it is in. Returns 1 on success
+static int write_replication_key()
+{
+    unsigned char bytes[REPLICATION_KEY_SIZE / 2];
+    if (!random_bytes(bytes, (int)sizeof(bytes)))
+        return 0;
+    for (int i = 0; i < (int)sizeof(bytes); i++)
+        snprintf(replication.key + 2 * i, 3, "%02x", bytes[i]);
+
+#ifdef _WIN32
+    FILE *fp = fopen(REPLICATION_KEY_FILE, "w");
+#else
+    int fd = open(REPLICATION_KEY_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0 && fchmod(fd, 0600) != 0)  // An older file may have wider permissions
+    {
+        close(fd);
+        fd = -1;
+    }
+    FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!fp && fd >= 0)
+        close(fd);
+#endif
+    if (!fp)
+        return 0;
+    int ok = fprintf(fp, "%s\n", replication.key) > 0;
+    ok = fclose(fp) == 0 && ok;
+    return ok;
+}
+
+// replication_authenticate() - Waits for a new replica's "K|key" line
+// Returns 1 if it sent the right key within REPLICATION_AUTH_MS
+static int replication_authenticate(ReplicaSocket s)
+{
+    char line[REPLICATION_KEY_SIZE + 8];
+    int used = 0;
+    int64_t deadline = wall_clock_ms() + REPLICATION_AUTH_MS;
+    while (used < (int)sizeof(line) - 1 && memchr(line, '\n', used) == NULL)
+    {
+        int64_t left = deadline - wall_clock_ms();
+        if (left <= 0)
+            return 0;
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s, &readable);
+        struct timeval timeout = {(long)(left / 1000), (long)(left % 1000) * 1000};
+        if (select((int)s + 1, &readable, NULL, NULL, &timeout) <= 0)
+            return 0;
+        int received = recv(s, line + used, (int)sizeof(line) - 1 - used, 0);
+        if (received <= 0)
+            return 0;
+        used += received;
+    }
+    line[used] = '\0';
+    char expected[REPLICATION_KEY_SIZE + 8];
+    int length = snprintf(expected, sizeof(expected), "K|%s\n", replication.key);
+    if (used != length)
+        return 0;
+    int difference = 0;
+    for (int i = 0; i < length; i++)  // Compare every byte, so the time taken gives nothing away
+        difference |= line[i] ^ expected[i];
+    return difference == 0;
+}
+
+// replication_accept() - Takes a new replica and sends it a snapshot
+static void replication_accept()
+{
+    ReplicaSocket s = accept(replication.listener, NULL, NULL);
+    if (s == INVALID_SOCKET)
+        return;
+    if (replication.replica_count == REPLICATION_MAX_REPLICAS || !replication_authenticate(s))
+    {
+        close_socket(s);
+        return;
+    }
+
+    // Read the files and note the newest record at the same moment
+    TextBuffer snapshot = {NULL, 0, 0};
+    char line[64];
+    lock_acquire(&replication.lock);
+    int64_t seq = replication.head_seq;
+    int length = snprintf(line, sizeof(line), "S|%lld|%lld\n", (long long)seq, (long long)wall_clock_ms());
+    text_append(&snapshot, line, length);
+    snapshot_file(&snapshot, HOSPITAL_FILE, 'h');
+    snapshot_file(&snapshot, PATIENT_FILE, 'p');
+    lock_release(&replication.lock);
+    text_append(&snapshot, "E\n", 2);
+
+    int sent = send_all(s, snapshot.data, snapshot.length);
+    free(snapshot.data);
+    if (!sent)
+    {
+        close_socket(s);
+        return;
+    }
+    lock_acquire(&replication.lock);
+    ReplicaLink *link = &replication.replicas[replication.replica_count++];
+    memset(link, 0, sizeof(*link));
+    link->socket = s;
+    link->next_seq = seq + 1;  // Records after the snapshot
+    link->acked_seq = seq;
+    link->connected_ms = wall_clock_ms();
+    lock_release(&replication.lock);
+}
+
+// replication_drop() - Forgets a replica whose connection is gone
+static void replication_drop(int i)
+{
+    lock_acquire(&replication.lock);
+    close_socket(replication.replicas[i].socket);
+    replication.replicas[i] = replication.replicas[--replication.replica_count];
+    lock_release(&replication.lock);
+}
+
+// replication_read_acks() - Reads "A|seq" lines from a replica, returns 0 if it disconnected
+static int replication_read_acks(ReplicaLink *link)
+{
+    int received = recv(link->socket, link->inbox + link->inbox_used, (int)sizeof(link->inbox) - 1 - link->inbox_used, 0);
+    if (received <= 0)
+        return 0;
+    link->inbox_used += received;
+    link->inbox[link->inbox_used] = '\0';
+    char *line = link->inbox, *end;
+    while ((end = strchr(line, '\n')) != NULL)
+    {
+        *end = '\0';
+        if (line[0] == 'A' && line[1] == '|')
+        {
+            lock_acquire(&replication.lock);
+            link->acked_seq = atoll(line + 2);
+            lock_release(&replication.lock);
+        }
+        line = end + 1;
+    }
+    link->inbox_used -= (int)(line - link->inbox);
+    memmove(link->inbox, line, link->inbox_used);
+    if (link->inbox_used == (int)sizeof(link->inbox) - 1)
+        link->inbox_used = 0;  // Not an acknowledgement, drop it
+    return 1;
+}
+
+// replication_ship() - Sends every replica the records it has not had yet
+// The messages are put together under the lock and sent after it is released,
+// so a slow replica never holds up a write
+static void replication_ship(int64_t *last_heartbeat)
+{
+    TextBuffer out[REPLICATION_MAX_REPLICAS];
+    memset(out, 0, sizeof(out));
+    int count = replication.replica_count;
+
+    lock_acquire(&replication.lock);
+    int64_t now = wall_clock_ms();
+    int heartbeat = now - *last_heartbeat >= REPLICATION_HEARTBEAT_MS;
+    int64_t applied_by_all = replication.head_seq;  // Records every replica has applied
+    for (int i = 0; i < count; i++)
+    {
+        ReplicaLink *link = &replication.replicas[i];
+        for (int64_t seq = link->next_seq; seq <= replication.head_seq; seq++)
+        {
+            const char *text = replication.records[seq - replication.first_seq].text;
+            text_append(&out[i], text, strlen(text));
+        }
+        link->next_seq = replication.head_seq + 1;
+        if (heartbeat)
+        {
+            char line[64];
+            int length = snprintf(line, sizeof(line), "B|%lld|%lld\n", (long long)replication.head_seq, (long long)now);
+            text_append(&out[i], line, length);
+        }
+        if (link->acked_seq < applied_by_all)
+            applied_by_all = link->acked_seq;
+    }
+    int64_t drop = applied_by_all - replication.first_seq + 1;  // Those records are no longer needed
+    if (drop > 0)
+    {
+        for (int i = 0; i < drop; i++)
+            free(replication.records[i].text);
+        replication.count -= (int)drop;
+        memmove(replication.records, replication.records + drop, replication.count * sizeof(ReplicationRecord));
+        replication.first_seq += drop;
+    }
+    lock_release(&replication.lock);
+    if (heartbeat)
+        *last_heartbeat = now;
+
+    for (int i = count - 1; i >= 0; i--)  // Backwards, so dropping one keeps the others in place
+    {
+        int ok = out[i].length == 0 || send_all(replication.replicas[i].socket, out[i].data, out[i].length);
+        free(out[i].data);
+        if (!ok)
+            replication_drop(i);
+    }
+}
+
+// replication_shipper() - Shipper thread: accepts replicas, reads their acknowledgements, sends records
+static void replication_shipper(void *arg)
+{
+    (void)arg;
+    int64_t last_heartbeat = 0;
+    while (1)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(replication.listener, &readable);
+        ReplicaSocket highest = replication.listener;
+        for (int i = 0; i < replication.replica_count; i++)
+        {
+            FD_SET(replication.replicas[i].socket, &readable);
+            if (replication.replicas[i].socket > highest)
+                highest = replication.replicas[i].socket;
+        }
+        struct timeval timeout = {0, REPLICATION_POLL_MS * 1000};
+        if (select((int)highest + 1, &readable, NULL, NULL, &timeout) < 0)
+        {
+            Sleep(REPLICATION_POLL_MS);
+            continue;
+        }
+        for (int i = replication.replica_count - 1; i >= 0; i--)
+        {
+            if (FD_ISSET(replication.replicas[i].socket, &readable) && !replication_read_acks(&replication.replicas[i]))
+                replication_drop(i);
+        }
+        lock_acquire(&replication.lock);
+        int resync = replication.resync;
+        replication.resync = 0;
+        lock_release(&replication.lock);
+        for (int i = replication.replica_count - 1; resync && i >= 0; i--)
+            replication_drop(i);  // Their tables hold records of lost lines
+        if (FD_ISSET(replication.listener, &readable))
+            replication_accept();
+        replication_ship(&last_heartbeat);
+    }
+}
+
+// start_replication_primary() - Listens for read replicas on 127.0.0.1:port
+// Returns 1 if the shipper thread is running
+int start_replication_primary(int port)
+{
+    if (!network_init() || !write_replication_key())
+        return 0;
+    ReplicaSocket s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET)
+        return 0;
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Local replicas only
+    if (bind(s, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(s, REPLICATION_MAX_REPLICAS) != 0)
+    {
+        close_socket(s);
+        return 0;
+    }
+    lock_init(&replication.lock);
+    replication.listener = s;
+    replication.port = port;
+    replication.first_seq = 1;
+    replication.enabled = 1;
+    replication.shipper.task = replication_shipper;
+    replication.shipper.arg = NULL;
+    if (!start_worker(&replication.shipper))
+    {
+        replication.enabled = 0;
+        close_socket(s);
+        return 0;
+    }
+    return 1;
+}
+
+// replication_status() - Shows the connected replicas and how far behind they are
+void replication_status()
+{
+    printf(MAGENTA BOLD "\n--- Replication Status ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    if (!replication.enabled)
+    {
+        printf(YELLOW "Log shipping is off. Start the program with --primary [port] to serve read replicas,\n");
+        printf("then start each replica with --replica [port] (default port %d).\n" RESET, REPLICATION_PORT);
+        return;
+    }
+    lock_acquire(&replication.lock);
+    int64_t now = wall_clock_ms();
+    printf(YELLOW "Listening on 127.0.0.1:%d, newest record %lld, %d records kept for replicas\n" RESET,
+           replication.port, (long long)replication.head_seq, replication.count);
+    if (replication.replica_count == 0)
+        printf(YELLOW "No replicas connected.\n" RESET);
+    for (int i = 0; i < replication.replica_count; i++)
+    {
+        const ReplicaLink *link = &replication.replicas[i];
+        int64_t behind = replication.head_seq - link->acked_seq;
+        int64_t lag_ms = 0;  // Age of the oldest record the replica has not applied
+        if (behind > 0)
+            lag_ms = now - replication.records[link->acked_seq + 1 - replication.first_seq].time_ms;
+        printf(CYAN "Replica %d: connected %llds ago, sent up to record %lld, applied up to %lld, %lld behind, lag %lld ms\n" RESET,
+               i + 1, (long long)((now - link->connected_ms) / 1000), (long long)(link->next_seq - 1),
+               (long long)link->acked_seq, (long long)behind, (long long)lag_ms);
+    }
+    lock_release(&replication.lock);
+}
+
+// ----- Replica side -----
+
+// replica_grow() - Makes room for one more hospital or patient in the replica tables
+static void replica_grow()
+{
+    if (replica.hospital_count == replica.hospital_capacity)
+    {
+        replica.hospital_capacity = replica.hospital_capacity ? replica.hospital_capacity * 2 : 1024;
+        replica.hot = (Hospital *)stats_realloc(replica.hot, replica.hospital_capacity * sizeof(Hospital));
+        replica.text = (HospitalText *)stats_realloc(replica.text, replica.hospital_capacity * sizeof(HospitalText));
+    }
+    if (replica.patient_count == replica.patient_capacity)
+    {
+        replica.patient_capacity = replica.patient_capacity ? replica.patient_capacity * 2 : 1024;
+        replica.patients = (Patient *)stats_realloc(replica.patients, replica.patient_capacity * sizeof(Patient));
+    }
+}
+
+// replica_add_hospital() - Appends a hospital line (skipped if malformed, like load_hospitals)
+static void replica_add_hospital(char *line)
+{
+    replica_grow();
+    int n = replica.hospital_count, row;
+    if (!parse_hospital_line(line, &replica.hot[n], &replica.text[n]))
+        return;
+    if (!intmap_get(&replica.hospital_rows, replica.hot[n].hospital_id, &row))
+        intmap_put(&replica.hospital_rows, replica.hot[n].hospital_id, n);  // First hospital with an ID wins
+    replica.hospital_count++;
+}
+
+// replica_add_patient() - Appends a patient line
+static void replica_add_patient(char *line)
+{
+    replica_grow();
+    if (parse_patient_line(line, &replica.patients[replica.patient_count]))
+        replica.patient_count++;
+}
+
+// replica_apply_record() - Applies one "R|seq|time|op|payload" record
+static void replica_apply_record(char *line)
+{
+    char *f[5];
+    if (split_fields(line, f, 5) != 5)  // The payload keeps its own '|' separators
+        return;
+    int64_t seq = atoll(f[1]);
+    if (seq <= replica.applied_seq)
+        return;  // Already part of the snapshot
+    if (f[3][0] == 'H')
+        replica_add_hospital(f[4]);
+    else if (f[3][0] == 'P')
+        replica_add_patient(f[4]);
+    else if (f[3][0] == 'U')
+    {
+        char *record = strchr(f[4], '|');
+        int row = atoi(f[4]);
+        Hospital h;
+        HospitalText t;
+        if (record && row >= 0 && row < replica.hospital_count && parse_hospital_line(record + 1, &h, &t))
+        {
+            replica.hot[row] = h;
+            replica.text[row] = t;
+        }
+    }
+    replica.applied_seq = seq;
+    if (replica.primary_seq < seq)
+        replica.primary_seq = seq;
+    replica.last_commit_ms = atoll(f[2]);
+    replica.last_apply_ms = wall_clock_ms();
+    replica.records_applied++;
+}
+
+// replica_apply() - Applies one message from the primary (replica lock held)
+static void replica_apply(char *line)
+{
+    char *f[3];
+    switch (line[0])
+    {
+    case 'S':  // A new snapshot replaces everything
+        if (split_fields(line, f, 3) != 3)
+            return;
+        replica.hospital_count = 0;
+        replica.patient_count = 0;
+        intmap_free(&replica.hospital_rows);
+        intmap_init(&replica.hospital_rows, 1024);
+        replica.snapshot_seq = atoll(f[1]);
+        replica.ready = 0;
+        break;
+    case 'h':
+        replica_add_hospital(line + 2);
+        break;
+    case 'p':
+        replica_add_patient(line + 2);
+        break;
+    case 'E':
+        replica.applied_seq = replica.snapshot_seq;
+        if (replica.primary_seq < replica.applied_seq)
+            replica.primary_seq = replica.applied_seq;
+        replica.ready = 1;
+        replica.snapshots++;
+        break;
+    case 'R':
+        replica_apply_record(line);
+        break;
+    case 'B':
+        if (split_fields(line, f, 3) == 3)
+            replica.primary_seq = atoll(f[1]);
+        break;
+    }
+}
+
+// read_replication_key() - Reads the primary's key from REPLICATION_KEY_FILE
+// Read again on every connection, because a restarted primary makes a new key
+static int read_replication_key(char key[REPLICATION_KEY_SIZE + 1])
+{
+    FILE *fp = fopen(REPLICATION_KEY_FILE, "r");
+    if (!fp)
+        return 0;
+    char line[LINE_SIZE];
+    int ok = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+    line[ok ? strcspn(line, "\r\n") : 0] = '\0';
+    if (strlen(line) != REPLICATION_KEY_SIZE)
+        return 0;
+    memcpy(key, line, REPLICATION_KEY_SIZE + 1);
+    return 1;
+}
+
+// replica_connect() - Connects to the primary and presents the key
+// Returns INVALID_SOCKET if the primary is not there or the key cannot be read
+static ReplicaSocket replica_connect(int port)
+{
+    char key[REPLICATION_KEY_SIZE + 1];
+    int have_key = read_replication_key(key);
+    lock_acquire(&replica.lock);
+    replica.key_missing = !have_key;
+    lock_release(&replica.lock);
+    if (!have_key)
+        return INVALID_SOCKET;
+    ReplicaSocket s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET)
+        return s;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    char hello[REPLICATION_KEY_SIZE + 8];
+    int length = snprintf(hello, sizeof(hello), "K|%s\n", key);
+    if (connect(s, (struct sockaddr *)&address, sizeof(address)) != 0 || !send_all(s, hello, length))
+    {
+        close_socket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// replica_receiver() - Receiver thread: applies the primary's messages and acknowledges them
+// Reconnects (and gets a fresh snapshot) whenever the connection is lost
+static void replica_receiver(void *arg)
+{
+    (void)arg;
+    char *buffer = (char *)malloc(REPLICATION_BUFFER_SIZE + 1);
+    while (1)
+    {
+        ReplicaSocket s = replica_connect(replica.port);
+        if (s == INVALID_SOCKET)
+        {
+            Sleep(REPLICATION_RETRY_MS);
+            continue;
+        }
+        lock_acquire(&replica.lock);
+        replica.connected = 1;
+        lock_release(&replica.lock);
+
+        int used = 0;
+        while (1)
+        {
+            int received = recv(s, buffer + used, REPLICATION_BUFFER_SIZE - used, 0);
+            if (received <= 0)
+                break;
+            used += received;
+
+            // Apply every complete line of this chunk under one lock
+            lock_acquire(&replica.lock);
+            int64_t before = replica.applied_seq;
+            char *line = buffer, *end;
+            while ((end = (char *)memchr(line, '\n', buffer + used - line)) != NULL)
+            {
+                *end = '\0';
+                replica_apply(line);
+                line = end + 1;
+            }
+            replica.last_heard_ms = wall_clock_ms();
+            int64_t applied = replica.applied_seq;
+            lock_release(&replica.lock);
+
+            used -= (int)(line - buffer);  // Keep the unfinished line for the next chunk
+            memmove(buffer, line, used);
+            if (used == REPLICATION_BUFFER_SIZE)
+                used = 0;  // No message is this long
+            if (applied != before)
+            {
+                char ack[32];
+                int length = snprintf(ack, sizeof(ack), "A|%lld\n", (long long)applied);
+                send_all(s, ack, length);
+            }
+        }
+        close_socket(s);
+        lock_acquire(&replica.lock);
+        replica.connected = 0;
+        lock_release(&replica.lock);
+        Sleep(REPLICATION_RETRY_MS);
+    }
+}
+
+// replica_hospital_name() - Name of a hospital from the replica tables ("Unknown" if missing)
+char *replica_hospital_name(int hospital_id)
+{
+    static char name[NAME_SIZE];
+    int row;
+    if (intmap_get(&replica.hospital_rows, hospital_id, &row))
+        snprintf(name, NAME_SIZE, "%s", str_of(replica.text[row].hospital_name));
+    else
+        strcpy(name, "Unknown");
+    return name;
+}
+
+// replica_listing() - Prints the replica's hospitals, sorted with compare (NULL = file order)
+// The rows are copied first: the receiver may grow (and move) the tables while
+// the pager waits for a key with the replica lock let go
+static void replica_listing(const char *title, int (*compare)(const void *, const void *))
+{
+    int n = replica.hospital_count;
+    if (n == 0)
+    {
+        printf(RED "No hospitals found!\n" RESET);
+        return;
+    }
+    arena_reset(&query_arena);
+    Hospital *hot = (Hospital *)arena_alloc(&query_arena, n * sizeof(Hospital));
+    HospitalText *text = (HospitalText *)arena_alloc(&query_arena, n * sizeof(HospitalText));
+    memcpy(hot, replica.hot, n * sizeof(Hospital));
+    memcpy(text, replica.text, n * sizeof(HospitalText));
+    int *order = NULL;
+    if (compare)
+    {
+        order = (int *)arena_alloc(&query_arena, n * sizeof(int));
+        for (int i = 0; i < n; i++)
+            order[i] = i;
+        sort_hospital_rows(hot, text, order, n, compare);
+    }
+    printf(MAGENTA BOLD "\n--- %s ---\n" RESET, title);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    render_hospital_table(hot, text, order, n);
+}
+
+// replica_patient_listing() - Prints the replica's patients with their hospital names
+// Copies the rows and looks up the names first, like replica_listing()
+static void replica_patient_listing()
+{
+    int n = replica.patient_count;
+    if (n == 0)
+    {
+        printf(RED "No patients found!\n" RESET);
+        return;
+    }
+    arena_reset(&query_arena);
+    Patient *patients = (Patient *)arena_alloc(&query_arena, n * sizeof(Patient));
+    StrRef *hospital_names = (StrRef *)arena_alloc(&query_arena, n * sizeof(StrRef));
+    memcpy(patients, replica.patients, n * sizeof(Patient));
+    StrRef unknown = intern_string("Unknown");
+    for (int i = 0; i < n; i++)
+    {
+        int row;
+        hospital_names[i] = intmap_get(&replica.hospital_rows, patients[i].hospital_id, &row) ? replica.text[row].hospital_name : unknown;
+    }
+    printf(MAGENTA BOLD "\n--- Patient Records (replica) ---\n" RESET);
+    render_named_patient_table(patients, hospital_names, n);
+}
+
+// replica_status() - Shows how far this replica is behind the primary
+static void replica_status()
+{
+    int64_t now = wall_clock_ms();
+    printf(MAGENTA BOLD "\n--- Replication Status ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    printf(YELLOW "Primary:               127.0.0.1:%d (%s)\n", replica.port,
+           replica.connected ? "connected" : replica.key_missing ? "no " REPLICATION_KEY_FILE " in this folder, retrying" : "not connected, retrying");
+    printf("Snapshots received:    %d\n", replica.snapshots);
+    printf("Hospitals / patients:  %d / %d\n", replica.hospital_count, replica.patient_count);
+    printf("Applied up to record:  %lld of %lld (%lld behind)\n", (long long)replica.applied_seq,
+           (long long)replica.primary_seq, (long long)(replica.primary_seq - replica.applied_seq));
+    if (replica.records_applied > 0)
+        printf("Last record applied:   %lld ms after the primary wrote it (%lld records since the snapshot)\n",
+               (long long)(replica.last_apply_ms - replica.last_commit_ms), (long long)replica.records_applied);
+    else
+        printf("Last record applied:   none since the snapshot\n");
+    if (replica.last_heard_ms > 0)
+        printf("Last message:          %lld ms ago\n" RESET, (long long)(now - replica.last_heard_ms));
+    else
+        printf("Last message:          never\n" RESET);
+}
+
+// run_replica() - Read-only reporting menu of a replica process
+// Every query holds the replica lock, which also keeps the receiver thread away
+// from the string heap, the query arena and the statistics while they are in use.
+// The pager lets go of it while it waits for a key (see render_lock), so records
+// keep arriving while a long listing is open.
+void run_replica(int port)
+{
+    replica.port = port;
+    replica.active = 1;
+    lock_init(&replica.lock);
+    replica.receiver.task = replica_receiver;
+    replica.receiver.arg = NULL;
+    if (!network_init() || !start_worker(&replica.receiver))
+    {
+        printf(RED "Could not start the replica.\n" RESET);
+        return;
+    }
+
+    while (1)
+    {
+        int choice;
+        clear_screen();
+        print_welcome_banner();
+        printf(MAGENTA BOLD "\n--- Read Replica (primary on port %d) ---\n" RESET, port);
+        printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+        printf(YELLOW "1. Display Hospital Data\n");
+        printf("2. Sort by Bed Price\n");
+        printf("3. Sort by Available Beds\n");
+        printf("4. Sort by Hospital Name\n");
+        printf("5. Display Patient Data\n");
+        printf("6. Replication Status\n");
+        printf("7. Exit\n" RESET);
+        printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+        printf(GREEN "Enter your choice: " RESET);
+        while (scanf("%d", &choice) != 1)
+        {
+            printf(RED "Invalid input!\n" RESET);
+            clear_input_buffer();
+            printf("Enter the valid option(1 to 7): ");
+        }
+        clear_input_buffer();
+        clear_screen();
+        print_welcome_banner();
+
+        if (choice == 7)
+        {
+            printf(GREEN "Thank you for using the Hospital Management System!\n" RESET);
+            printf(YELLOW "Exiting...\n" RESET);
+            return;
+        }
+
+        lock_acquire(&replica.lock);
+        render_lock = &replica.lock;
+        if (choice >= 1 && choice <= 5 && !replica.ready)
+            printf(RED "The replica has not received its data from the primary yet. Is the primary running with --primary?\n" RESET);
+        else
+        {
+            switch (choice)
+            {
+            case 1:
+                replica_listing("Hospital Records (replica)", NULL);
+                break;
+            case 2:
+                replica_listing("Hospitals Sorted by Bed Price (Highest to Lowest)", compare_by_bed_price);
+                break;
+            case 3:
+                replica_listing("Hospitals Sorted by Available Beds (Highest to Lowest)", compare_by_available_beds);
+                break;
+            case 4:
+                replica_listing("Hospitals Sorted by Name (A to Z)", compare_by_name);
+                break;
+            case 5:
+                replica_patient_listing();
+                break;
+            case 6:
+                replica_status();
+                break;
+            default:
+                printf(RED "Invalid choice! Try again.\n" RESET);
+            }
+        }
+        render_lock = NULL;
+        lock_release(&replica.lock);
+        press_any_key_to_continue();
+    }
+}
+
+// ===== EXTERNAL SORT =====
+// Sorts hospitals.txt or patients.txt with a fixed amount of memory, however big
+// the file is (sort_memory_budget, set with --sort-memory or from the Sorting menu):
+//   1. Lines are read into one block of budget bytes - text from the front, the
+//      sort keys from the back. When the block is full the keys are sorted and the
+//      lines written to a run file in that order ("row|line").
+//   2. The run files are merged with a min-heap of their first lines (k-way merge),
+//      at most SORT_MAX_FAN_IN at a time; if there are more, groups of runs are
+//      merged into bigger runs first.
+//   3. The final merge hands every line, in order, to an output function: a file
+//      writer, or the table renderer for the sorted listings.
+// If the whole file fits in one block nothing is written to disk.
+// Ties keep file order (the row number), so the result matches the in-memory sorts.
+
+// Key fields of every order (field numbers from the RECORD SCHEMAS)
+static const SortOrderInfo sort_orders[SORT_ORDER_COUNT] = {
+    {"Hospitals by Bed Price (Highest to Lowest)", HOSPITAL_FILE, 0, {{HOSPITAL_FIELD_bed_price, KEY_FLOAT, 1}, {-1, KEY_INT, 0}}},
+    {"Hospitals by Available Beds (Highest to Lowest)", HOSPITAL_FILE, 0, {{HOSPITAL_FIELD_available_beds, KEY_INT, 1}, {-1, KEY_INT, 0}}},
+    {"Hospitals by Name (A to Z)", HOSPITAL_FILE, 0, {{HOSPITAL_FIELD_hospital_name, KEY_TEXT, 0}, {-1, KEY_INT, 0}}},
+    {"Hospitals by Rating, then Reviews (Highest First)", HOSPITAL_FILE, 0, {{HOSPITAL_FIELD_rating, KEY_FLOAT, 1}, {HOSPITAL_FIELD_reviews, KEY_INT, 1}}},
+    {"Patients by ID", PATIENT_FILE, 1, {{PATIENT_FIELD_patient_id, KEY_INT, 0}, {-1, KEY_INT, 0}}},
+    {"Patients by Name (A to Z)", PATIENT_FILE, 1, {{PATIENT_FIELD_patient_name, KEY_TEXT, 0}, {-1, KEY_INT, 0}}},
+    {"Patients by Age (Oldest First)", PATIENT_FILE, 1, {{PATIENT_FIELD_age, KEY_INT, 1}, {-1, KEY_INT, 0}}},
+    {"Patients by Hospital ID", PATIENT_FILE, 1, {{PATIENT_FIELD_hospital_id, KEY_INT, 0}, {-1, KEY_INT, 0}}},
+};
+
+static const SortOrderInfo *sort_info;  // Order used by compare_sort_items() (qsort has no context)
+
+// sort_item_from_line() - Fills item with the keys of one data line (without line ending)
+// Accepts exactly the lines parse_hospital_line()/parse_patient_line() accept
+// Returns 0 for lines those would skip
+static int sort_item_from_line(const SortOrderInfo *info, const char *line, int length, int64_t row, SortItem *item)
+{
+    const char *field[HOSPITAL_FIELD_MAX];
+    int field_length[HOSPITAL_FIELD_MAX], fields = 1;
+    int max_fields = info->patients ? PATIENT_FIELD_COUNT : HOSPITAL_FIELD_MAX;  // Same limits as split_fields() in the parsers
+    field[0] = line;
+    for (int i = 0; i < length && fields < max_fields; i++)
+    {
+        if (line[i] == '|')
+        {
+            field_length[fields - 1] = (int)(line + i - field[fields - 1]);
+            field[fields++] = line + i + 1;
+        }
+    }
+    field_length[fields - 1] = (int)(line + length - field[fields - 1]);
+    if (info->patients ? fields != PATIENT_FIELD_COUNT : (fields != HOSPITAL_FIELD_COUNT && fields != HOSPITAL_FIELD_MAX))
+        return 0;
+
+    item->row = row;
+    item->line = line;
+    item->line_length = length;
+    item->text = NULL;
+    item->text_length = 0;
+    for (int k = 0; k < 2; k++)
+    {
+        const SortKey *key = &info->keys[k];
+        item->key[k] = 0;
+        if (key->field < 0)
+            continue;
+        if (key->kind == KEY_TEXT)
+        {
+            item->text = field[key->field];
+            item->text_length = field_length[key->field];
+        }
+        else if (key->kind == KEY_FLOAT)
+            item->key[k] = strtof(field[key->field], NULL);  // float, exactly like the Hospital fields
+        else
+            item->key[k] = (double)atoll(field[key->field]);
+    }
+    return 1;
+}
+
+// compare_sort_items() - Orders two items by the keys of sort_info, then by file row
+static int compare_sort_items(const void *a, const void *b)
+{
+    const SortItem *x = (const SortItem *)a, *y = (const SortItem *)b;
+    for (int k = 0; k < 2; k++)
+    {
+        const SortKey *key = &sort_info->keys[k];
+        if (key->field < 0)
+            break;
+        int result;
+        if (key->kind == KEY_TEXT)  // Same order as strcmp() on the whole name
+        {
+            int shorter = x->text_length < y->text_length ? x->text_length : y->text_length;
+            result = memcmp(x->text, y->text, shorter);
+            if (result == 0)
+                result = x->text_length - y->text_length;
+        }
+        else
+            result = x->key[k] < y->key[k] ? -1 : x->key[k] > y->key[k];
+        if (result != 0)
+            return key->descending ? -result : result;
+    }
+    return x->row < y->row ? -1 : x->row > y->row;
+}
+
+// run_filename() - Name of one temporary run file
+static void run_filename(int run, char *filename, int size)
+{
+    snprintf(filename, size, SORT_RUN_FORMAT, run);
+}
+
+// write_run() - Sorts the items of a full block and writes them to a new run file
+static int write_run(SortItem *items, int count, int run, int64_t *bytes)
+{
+    char filename[64];
+    run_filename(run, filename, sizeof(filename));
+    FILE *fp = stats_fopen(filename, "wb");
+    if (!fp)
+        return 0;
+    qsort(items, count, sizeof(SortItem), compare_sort_items);
+    for (int i = 0; i < count; i++)
+    {
+        *bytes += fprintf(fp, "%lld|", (long long)items[i].row);
+        fwrite(items[i].line, 1, items[i].line_length, fp);
+        fputc('\n', fp);
+        *bytes += items[i].line_length + 1;
+    }
+    fclose(fp);
+    return 1;
+}
+
+// run_reader_next() - Reads the next "row|line" of a run into its head item
+// Returns 0 at the end of the run
+static int run_reader_next(RunReader *r)
+{
+    if (!fgets(r->line, sizeof(r->line), r->fp))
+        return 0;
+    int length = (int)strcspn(r->line, "\r\n");
+    r->line[length] = '\0';
+    char *record = strchr(r->line, '|');
+    if (!record)
+        return 0;
+    record++;
+    sort_item_from_line(sort_info, record, length - (int)(record - r->line), atoll(r->line), &r->item);
+    return 1;
+}
+
+// merge_heap_down() - Restores the merge heap from position i down
+static void merge_heap_down(RunReader **heap, int size, int i)
+{
+    while (1)
+    {
+        int best = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < size && compare_sort_items(&heap[left]->item, &heap[best]->item) < 0)
+            best = left;
+        if (right < size && compare_sort_items(&heap[right]->item, &heap[best]->item) < 0)
+            best = right;
+        if (best == i)
+            return;
+        RunReader *swap = heap[i];
+        heap[i] = heap[best];
+        heap[best] = swap;
+        i = best;
+    }
+}
+
+// merge_runs() - k-way merges runs first..first+count-1 (deleting them)
+// Writes to run file out_run, or hands the lines to emit when out_run < 0
+static int merge_runs(int first, int count, int out_run, size_t budget, SortEmit emit, void *context, int64_t *bytes)
+{
+    char filename[64];
+    FILE *out = NULL;
+    if (out_run >= 0)
+    {
+        run_filename(out_run, filename, sizeof(filename));
+        if (!(out = stats_fopen(filename, "wb")))
+            return 0;
+    }
+
+    // Split the budget into one read buffer per run (plus one for the output)
+    size_t buffer_size = budget / (count + 1);
+    RunReader *readers = (RunReader *)stats_calloc(count, sizeof(RunReader));
+    RunReader **heap = (RunReader **)stats_malloc(count * sizeof(RunReader *));
+    char *buffers = (char *)stats_malloc(buffer_size * (count + 1));
+    if (out)
+        setvbuf(out, buffers + buffer_size * count, _IOFBF, buffer_size);
+    int size = 0, ok = 1;
+    for (int i = 0; i < count; i++)
+    {
+        run_filename(first + i, filename, sizeof(filename));
+        readers[i].fp = stats_fopen(filename, "rb");
+        if (!readers[i].fp)
+        {
+            ok = 0;
+            continue;
+        }
+        setvbuf(readers[i].fp, buffers + buffer_size * i, _IOFBF, buffer_size);
+        if (run_reader_next(&readers[i]))
+            heap[size++] = &readers[i];
+    }
+    for (int i = size / 2 - 1; i >= 0; i--)
+        merge_heap_down(heap, size, i);
+
+    while (size > 0)
+    {
+        RunReader *r = heap[0];
+        if (out)
+        {
+            *bytes += fprintf(out, "%lld|", (long long)r->item.row);
+            fwrite(r->item.line, 1, r->item.line_length, out);
+            fputc('\n', out);
+            *bytes += r->item.line_length + 1;
+        }
+        else
+            emit(r->item.line, context);
+        if (!run_reader_next(r))
+            heap[0] = heap[--size];  // This run is finished
+        merge_heap_down(heap, size, 0);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (readers[i].fp)
+            fclose(readers[i].fp);
+        run_filename(first + i, filename, sizeof(filename));
+        remove(filename);
+    }
+    if (out)
+        fclose(out);
+    free(readers);
+    free(heap);
+    free(buffers);
+    return ok;
+}
+
+// external_sort() - Sorts the file of an order within budget bytes and emits the lines in order
+// Returns 1 on success; result gets the row, run and byte counts
+int external_sort(SortOrder order, size_t budget, SortEmit emit, void *context, ExternalSortResult *result)
+{
+    uint64_t started = stats_start();
+    double start = now_seconds();
+    memset(result, 0, sizeof(*result));
+    if (budget < SORT_MIN_BUDGET)
+        budget = SORT_MIN_BUDGET;
+    budget &= ~(size_t)7;  // Keeps the items at the end of the block aligned
+    sort_info = &sort_orders[order];
+    FILE *fp = stats_fopen(sort_info->file, "r");
+    if (!fp)
+        return 0;
+
+    // Phase 1: fill the block, sort it, write it out as a run, repeat
+    char *block = (char *)stats_malloc(budget);
+    SortItem *items = (SortItem *)(block + budget);  // Items grow down from the end of the block
+    size_t text_used = 0;
+    int count = 0, runs = 0, ok = 1;
+    char line[LINE_SIZE];
+    while (read_line(line, LINE_SIZE, fp))
+    {
+        int length = (int)strcspn(line, "\r\n");
+        size_t free_bytes = (size_t)((char *)(items - count) - (block + text_used));
+        if ((size_t)length + 1 + sizeof(SortItem) > free_bytes)  // Block full: spill a run
+        {
+            if (!write_run(items - count, count, runs++, &result->bytes_spilled))
+            {
+                ok = 0;
+                break;
+            }
+            text_used = 0;
+            count = 0;
+        }
+        char *stored = block + text_used;
+        memcpy(stored, line, length);
+        stored[length] = '\0';
+        SortItem item;
+        if (!sort_item_from_line(sort_info, stored, length, result->rows, &item))
+            continue;  // Same lines skipped as by the normal loaders
+        text_used += length + 1;
+        *(items - ++count) = item;
+        result->rows++;
+    }
+    fclose(fp);
+
+    if (ok && runs == 0)  // Everything fitted in memory: sort and emit directly
+    {
+        qsort(items - count, count, sizeof(SortItem), compare_sort_items);
+        for (int i = 0; i < count; i++)
+            emit((items - count)[i].line, context);
+    }
+    else if (ok)
+    {
+        if (count > 0)
+            ok = write_run(items - count, count, runs++, &result->bytes_spilled);
+        free(block);
+        block = NULL;
+
+        // Phase 2: merge groups of runs until one merge can produce the output
+        int first = 0, next = runs;
+        while (ok && next - first > SORT_MAX_FAN_IN)
+        {
+            ok = merge_runs(first, SORT_MAX_FAN_IN, next, budget, NULL, NULL, &result->bytes_spilled);
+            first += SORT_MAX_FAN_IN;
+            next++;
+            result->merge_passes++;
+        }
+        if (ok)
+            ok = merge_runs(first, next - first, -1, budget, emit, context, &result->bytes_spilled);
+        result->merge_passes++;
+        result->runs = runs;
+    }
+    free(block);
+    result->seconds = now_seconds() - start;
+    stats_record(OP_SORT, started);
+    return ok;
+}
+
+// external_sort_needed() - 1 if a data file is too big to sort in memory within the budget
+int external_sort_needed(const char *filename)
+{
+    return data_file_size(filename) > (int64_t)sort_memory_budget;
+}
+
+// emit_to_file() - Output function: writes each sorted line to a file
+static void emit_to_file(const char *line, void *context)
+{
+    fputs(line, (FILE *)context);
+    fputc('\n', (FILE *)context);
+}
+
+// emit_hospital_row() - Output function: prints each sorted hospital line as a table row
+// The fields are printed straight from the line, so nothing is kept in memory
+static void emit_hospital_row(const char *line, void *context)
+{
+    (void)context;
+    char copy[LINE_SIZE], *f[HOSPITAL_FIELD_MAX];
+    const char *separator = "";
+    int n = 0;
+    snprintf(copy, LINE_SIZE, "%s", line);
+    split_fields(copy, f, HOSPITAL_FIELD_MAX);  // The sort only hands over lines the parser accepts
+    out_color(CYAN);
+    HOSPITAL_FIELDS(COLUMN_FROM_TEXT)
+    out_color(RESET);
+    out_bytes("\n", 1);
+}
+
+// stream_sorted_hospitals() - Sorted hospital listing for files bigger than the memory budget
+// Rows are printed while they come out of the merge (no pager: rows cannot be revisited)
+void stream_sorted_hospitals(SortOrder order, const char *title)
+{
+    ExternalSortResult result;
+    printf(MAGENTA BOLD "\n--- %s ---\n" RESET, title);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    render_out.color = stdout_is_terminal();
+    render_hospital_header();
+    int ok = external_sort(order, sort_memory_budget, emit_hospital_row, NULL, &result);
+    out_text("-------------------------------------------------------------------------------------------------------------------\n");
+    out_flush();
+    if (!ok)
+    {
+        printf(RED "Error sorting %s on disk!\n" RESET, HOSPITAL_FILE);
+        return;
+    }
+    printf(YELLOW "%lld hospitals sorted on disk within %zu MB of memory (%d runs).\n" RESET,
+           (long long)result.rows, sort_memory_budget / (1024 * 1024), result.runs);
+}
+
+// external_sort_to_file() - Sorting menu: writes a sorted copy of a data file under the memory budget
+void external_sort_to_file()
+{
+    printf(MAGENTA BOLD "\n--- External Sort (fixed memory budget) ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    for (int i = 0; i < SORT_ORDER_COUNT; i++)
+        printf(YELLOW "%d. %s\n" RESET, i + 1, sort_orders[i].label);
+    int choice;
+    printf(GREEN "Enter the sort order (1 to %d): " RESET, SORT_ORDER_COUNT);
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > SORT_ORDER_COUNT)
+    {
+        printf(RED "Invalid input!\n" RESET);
+        clear_input_buffer();
+        printf(GREEN "Enter the sort order (1 to %d): " RESET, SORT_ORDER_COUNT);
+    }
+    clear_input_buffer();
+
+    char input[LINE_SIZE];
+    int megabytes;
+    printf(GREEN "Memory budget in MB [%zu]: " RESET, sort_memory_budget / (1024 * 1024));
+    if (fgets(input, LINE_SIZE, stdin) && sscanf(input, "%d", &megabytes) == 1 && megabytes > 0)
+        sort_memory_budget = (size_t)megabytes * 1024 * 1024;
+
+    SortOrder order = (SortOrder)(choice - 1);
+    const char *output = sort_orders[order].patients ? SORTED_PATIENT_FILE : SORTED_HOSPITAL_FILE;
+    FILE *out = stats_fopen(output, "w");
+    if (!out)
+    {
+        printf(RED "Error creating %s!\n" RESET, output);
+        return;
+    }
+    ExternalSortResult result;
+    int ok = external_sort(order, sort_memory_budget, emit_to_file, out, &result);
+    fclose(out);
+    if (!ok)
+    {
+        printf(RED "Error sorting %s (is there room for the temporary run files?)\n" RESET, sort_orders[order].file);
+        return;
+    }
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    printf(GREEN BOLD "%s written to %s\n" RESET, sort_orders[order].label, output);
+    printf(YELLOW "Rows sorted:     %lld\n", (long long)result.rows);
+    printf("Memory budget:   %zu MB\n", sort_memory_budget / (1024 * 1024));
+    if (result.runs == 0)
+        printf("Runs:            none (the file fitted in memory)\n");
+    else
+        printf("Runs:            %d, merged in %d pass%s, %.1f MB written to temporary files\n",
+               result.runs, result.merge_passes, result.merge_passes == 1 ? "" : "es", result.bytes_spilled / (1024.0 * 1024.0));
+    printf("Time:            %.1f ms\n" RESET, result.seconds * 1000.0);
+}
+
+// ===== VIEW CACHE =====
+// Keeps the finished rows of recent listings. Every change of a data file bumps
+// that table's version, so a cached result is used only while the versions it
+// was built from are still current. When the memory budget is full the least
+// recently used result is thrown away.
+
+// Data file of every table (for the size and time check against edits made outside the program)
+static const char *table_files[TABLE_COUNT] = {HOSPITAL_FILE, PATIENT_FILE};
+
+// bump_table_version() - Marks a table as changed, so results built from it are stale
+void bump_table_version(DataTable table)
+{
+    view_cache.version[table]++;
+}
+
+// view_depends_on() - Returns 1 if a view is built from a table
+static int view_depends_on(ViewKind kind, DataTable table)
+{
+    if (kind == VIEW_PATIENTS)
+        return 1;  // Patient rows plus the names of their hospitals
+    return table == TABLE_HOSPITALS;
+}
+
+// view_cache_drop() - Frees one cached result
+static void view_cache_drop(CachedView *view)
+{
+    free(view->memory);
+    view_cache.bytes -= view->bytes;
+    view_cache.count--;
+    memset(view, 0, sizeof(CachedView));
+}
+
+// view_file_changed() - Returns 1 if a table's data file is not the one a result was built from
+// A same-length edit made outside the program keeps the size, so the time is checked too
+static int view_file_changed(CachedView *view, DataTable t)
+{
+    if (view->source_size[t] != data_file_size(table_files[t]))
+        return 1;
+    int64_t time = data_file_time(table_files[t]);
+    if (view->source_time[t] == -1 && time != -1)
+    {
+        view->source_time[t] = time;  // Our own queued lines have been written since, same size
+        return 0;
+    }
+    return view->source_time[t] != time;
+}
+
+// view_cache_find() - Returns the cached result of a query, or NULL if there is none
+CachedView *view_cache_find(ViewKind kind, StrRef city)
+{
+    if (replica.active)  // A replica's tables change without going through the writers
+        return NULL;
+    for (int i = 0; i < VIEW_CACHE_ENTRIES; i++)
+    {
+        CachedView *view = &view_cache.views[i];
+        if (!view->used || view->kind != kind || view->city != city)
+            continue;
+
+        // Still built from the current tables?
+        for (int t = 0; t < TABLE_COUNT; t++)
+        {
+            if (view_depends_on(kind, (DataTable)t) &&
+                (view->version[t] != view_cache.version[t] || view_file_changed(view, (DataTable)t)))
+            {
+                view_cache_drop(view);
+                view_cache.invalidations++;
+                view_cache.misses++;
+                return NULL;
+            }
+        }
+        view->last_used = ++view_cache.clock;
+        view_cache.hits++;
+        return view;
+    }
+    view_cache.misses++;
+    return NULL;
+}
+
+// view_cache_slot() - Makes room for a result of the given size and returns a free slot
+// Returns NULL if the result alone is bigger than the whole budget
+static CachedView *view_cache_slot(ViewKind kind, StrRef city, size_t bytes)
+{
+    if (bytes > VIEW_CACHE_BUDGET)
+        return NULL;
+
+    // Replace an older result of the same query
+    for (int i = 0; i < VIEW_CACHE_ENTRIES; i++)
+    {
+        CachedView *view = &view_cache.views[i];
+        if (view->used && view->kind == kind && view->city == city)
+            view_cache_drop(view);
+    }
+
+    // Evict the least recently used results until the new one fits
+    while (view_cache.count == VIEW_CACHE_ENTRIES || view_cache.bytes + bytes > VIEW_CACHE_BUDGET)
+    {
+        CachedView *oldest = NULL;
+        for (int i = 0; i < VIEW_CACHE_ENTRIES; i++)
+            if (view_cache.views[i].used && (!oldest || view_cache.views[i].last_used < oldest->last_used))
+                oldest = &view_cache.views[i];
+        view_cache_drop(oldest);
+        view_cache.evictions++;
+    }
+
+    for (int i = 0; i < VIEW_CACHE_ENTRIES; i++)
+    {
+        CachedView *view = &view_cache.views[i];
+        if (view->used)
+            continue;
+        view->memory = stats_malloc(bytes ? bytes : 1);
+        if (!view->memory)
+            return NULL;
+        view->used = 1;
+        view->kind = kind;
+        view->city = city;
+        view->bytes = bytes;
+        view->last_used = ++view_cache.clock;
+        for (int t = 0; t < TABLE_COUNT; t++)
+        {
+            view->version[t] = view_cache.version[t];
+            view->source_size[t] = data_file_size(table_files[t]);
+            view->source_time[t] = data_file_time(table_files[t]);
+        }
+        view_cache.count++;
+        view_cache.bytes += bytes;
+        return view;
+    }
+    return NULL;  // Not reached: the loop above freed a slot
+}
+
+// view_cache_store_hospitals() - Caches a hospital listing
+// The rows are copied in display order (order = NULL means file order), so the
+// cached order is simply 0, 1, 2, ... and the arena can be reused afterwards.
+// score (may be NULL) is the per-row score column of the ranked listing.
+CachedView *view_cache_store_hospitals(ViewKind kind, StrRef city, const Hospital *hot,
+                                       const HospitalText *text, const int *order, const float *score, int count)
+{
+    if (replica.active)
+        return NULL;
+    size_t bytes = (size_t)count * (sizeof(Hospital) + sizeof(HospitalText) + sizeof(int) + (score ? sizeof(float) : 0));
+    CachedView *view = view_cache_slot(kind, city, bytes);
+    if (!view)
+        return NULL;
+
+    view->hot = (Hospital *)view->memory;
+    view->text = (HospitalText *)(view->hot + count);
+    view->order = (int *)(view->text + count);
+    view->score = score ? (float *)(view->order + count) : NULL;
+    for (int i = 0; i < count; i++)
+    {
+        int row = order ? order[i] : i;
+        view->hot[i] = hot[row];
+        view->text[i] = text[row];
+        view->order[i] = i;
+        if (score)
+            view->score[i] = score[row];
+    }
+    view->count = count;
+    return view;
+}
+
+// view_cache_invalidate() - Drops every cached result of one listing
+// For changes that are not in a data file (the quality score settings)
+void view_cache_invalidate(ViewKind kind)
+{
+    for (int i = 0; i < VIEW_CACHE_ENTRIES; i++)
+    {
+        CachedView *view = &view_cache.views[i];
+        if (view->used && view->kind == kind)
+        {
+            view_cache_drop(view);
+            view_cache.invalidations++;
+        }
+    }
+}
+
+// view_cache_store_patients() - Caches the patient listing with its hospital names
+CachedView *view_cache_store_patients(const Patient *patients, const StrRef *hospital_names, int count)
+{
+    if (replica.active)
+        return NULL;
+    size_t bytes = (size_t)count * (sizeof(Patient) + sizeof(StrRef));
+    CachedView *view = view_cache_slot(VIEW_PATIENTS, 0, bytes);
+    if (!view)
+        return NULL;
+
+    view->patients = (Patient *)view->memory;
+    view->hospital_names = (StrRef *)(view->patients + count);
+    memcpy(view->patients, patients, count * sizeof(Patient));
+    memcpy(view->hospital_names, hospital_names, count * sizeof(StrRef));
+    view->count = count;
+    return view;
+}
+
+// sorted_view_kind() - Returns the view of a sorted hospital listing (VIEW_COUNT if it has none)
+ViewKind sorted_view_kind(int (*compare)(const void *, const void *))
+{
+    if (compare == compare_by_bed_price)
+        return VIEW_HOSPITALS_BY_PRICE;
+    if (compare == compare_by_available_beds)
+        return VIEW_HOSPITALS_BY_BEDS;
+    if (compare == compare_by_name)
+        return VIEW_HOSPITALS_BY_NAME;
+    return VIEW_COUNT;
+}
+
+// resolve_hospital_names() - Finds the hospital name of every patient with one pass over hospitals.txt
+// (instead of one get_hospital_name_by_id() file scan per patient)
+void resolve_hospital_names(const Patient *patients, int count, StrRef *names)
+{
+    StrRef unknown = intern_string("Unknown");
+    if (replica.active)  // A read replica answers from its own tables
+    {
+        for (int i = 0; i < count; i++)
+            names[i] = intern_string(replica_hospital_name(patients[i].hospital_id));
+        return;
+    }
+
+    uint64_t started = stats_start();
+    IntMap by_id = {0};  // Hospital ID -> interned name (the first line with an ID wins, like the lookups)
+    intmap_init(&by_id, 64);
+    FILE *fp = stats_fopen(HOSPITAL_FILE, "r");
+    if (fp)
+    {
+        char line[LINE_SIZE];
+        while (read_line(line, LINE_SIZE, fp))
+        {
+            Hospital h;
+            HospitalText t;
+            int known;
+            if (parse_hospital_line(line, &h, &t) && !intmap_get(&by_id, h.hospital_id, &known))
+                intmap_put(&by_id, h.hospital_id, (int)t.hospital_name);
+        }
+        fclose(fp);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int name;
+        names[i] = intmap_get(&by_id, patients[i].hospital_id, &name) ? (StrRef)name : unknown;
+    }
+    intmap_free(&by_id);
+    stats_record(OP_LOOKUP, started);
+}
+
+// ===== BACKGROUND PERSISTENCE =====
+// New hospital and patient lines are not written by the front desk itself. They are
+// put in a bounded ring of PERSIST_QUEUE_SIZE requests and a writer thread appends
+// them in batches (one write per file per batch) and then flushes the file to the
+// disk (fsync, or _commit = FlushFileBuffers on Windows). Only then is a request
+// "durable" and its callback called.
+//
+// The ring needs no lock: only the front desk thread adds requests (head) and only
+// the writer thread removes them (tail). When the ring is full the front desk waits
+// for a free slot (back-pressure). Anything that opens a data file first waits until
+// the queued lines of that file are written, so every reader sees its own writes,
+// and data_file_size() already counts the queued lines.
+// Nobody polls: the writer thread sleeps on persistence.queued until a request is
+// added, and every wait for the writer sleeps on persistence.written until a batch
+// is done. persistence.lock is only taken around those sleeps and wake-ups.
+
+// table_of_file() - Data table stored in a file (TABLE_COUNT for other files)
+static DataTable table_of_file(const char *filename)
+{
+    for (int t = 0; t < TABLE_COUNT; t++)
+        if (strcmp(filename, table_files[t]) == 0)
+            return (DataTable)t;
+    return TABLE_COUNT;
+}
+
+// persist_write_lines() - Appends a block of lines to a data file and flushes it to the disk
+// Returns 1 on success. Uses plain fopen because it runs on the writer thread.
+// A failed write is cut off again, so the file never ends in a torn line that the
+// next batch would be glued to.
+static int persist_write_lines(DataTable table, const char *data, size_t length)
+{
+    FILE *fp = fopen(table_files[table], "ab");  // Binary: the patient indexes store byte offsets
+    if (!fp)
+        return 0;
+    file_seek(fp, 0, SEEK_END);  // "ab" may report 0 until the first write
+    int64_t size = file_tell(fp);
+    int ok = size >= 0 && fwrite(data, 1, length, fp) == length && sync_file(fp);
+    if (!ok && size >= 0)
+        truncate_file(fp, size);
+    return fclose(fp) == 0 && ok;
+}
+
+// count_durable_write() - Durable acknowledgement used by the writers of this program
+// context is the DataTable the line belongs to; runs on the writer thread
+void count_durable_write(int64_t seq, int ok, void *context)
+{
+    (void)seq;
+    DataTable table = (DataTable)(intptr_t)context;
+    if (ok)
+        persistence.acked[table]++;
+    else
+        persistence.failed[table]++;
+}
+
+// ack_durable_write() - Durable acknowledgement for a line the front desk waits for
+// context is a DurableAck; the line is counted like count_durable_write() does
+void ack_durable_write(int64_t seq, int ok, void *context)
+{
+    DurableAck *ack = (DurableAck *)context;
+    count_durable_write(seq, ok, (void *)(intptr_t)ack->table);
+    shared_store(&ack->ok, ok);
+    shared_store(&ack->done, 1);  // Last: the front desk may reuse ack as soon as it sees this
+}
+
+// persist_batch() - Writes requests first..last-1, flushes them and calls their callbacks
+static void persist_batch(int64_t first, int64_t last)
+{
+    int ok[TABLE_COUNT];
+    double started = now_seconds();
+    for (int t = 0; t < TABLE_COUNT; t++)
+    {
+        // Collect this file's lines in queue order, then write them in one go
+        persistence.batch.length = 0;
+        int64_t count = 0;
+        for (int64_t seq = first; seq < last; seq++)
+        {
+            PersistRequest *r = &persistence.queue[seq % PERSIST_QUEUE_SIZE];
+            if ((int)r->table != t)
+                continue;
+            text_append(&persistence.batch, r->line, r->length);
+            count++;
+        }
+        ok[t] = count == 0 || persist_write_lines((DataTable)t, persistence.batch.data, persistence.batch.length);
+        if (!ok[t])
+            shared_add(&persistence.failed_batches[t], 1);  // Before pending drops, so readers see it
+        if (count > 0)
+        {
+            persistence.bytes_written += persistence.batch.length;
+            shared_add(&persistence.pending[t], -count);  // Readers of this file may go ahead
+        }
+    }
+
+    double finished = now_seconds();
+    persistence.batches++;
+    persistence.sync_seconds += finished - started;
+    for (int64_t seq = first; seq < last; seq++)
+    {
+        PersistRequest *r = &persistence.queue[seq % PERSIST_QUEUE_SIZE];
+        double waited = finished - r->queued_at;  // From the front desk to the disk
+        persistence.ack_seconds += waited;
+        if (waited > persistence.ack_seconds_max)
+            persistence.ack_seconds_max = waited;
+        if (r->done)
+            r->done(seq, ok[r->table], r->context);
+    }
+    shared_store(&persistence.durable_seq, last - 1);
+}
+
+// persist_wake() - Wakes the threads sleeping on one of the persistence signals
+// Called after the state they wait for has changed
+static void persist_wake(WorkerSignal *signal)
+{
+    lock_acquire(&persistence.lock);
+    signal_wake_all(signal);
+    lock_release(&persistence.lock);
+}
+
+// persistence_writer() - Writer thread: takes whatever is queued and writes it as one batch
+static void persistence_writer(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        int64_t first = persistence.tail;
+        lock_acquire(&persistence.lock);
+        while (shared_load(&persistence.head) == first)
+            signal_wait(&persistence.queued, &persistence.lock);  // Nothing queued
+        lock_release(&persistence.lock);
+        int64_t last = shared_load(&persistence.head);
+        if (last - first > PERSIST_BATCH_MAX)
+            last = first + PERSIST_BATCH_MAX;
+        persist_batch(first, last);
+        shared_store(&persistence.tail, last);  // The slots can be reused now
+        persist_wake(&persistence.written);
+    }
+}
+
+// start_persistence() - Starts the writer thread (without it lines are written synchronously)
+void start_persistence()
+{
+    persistence.head = persistence.tail = 1;  // Request numbers start at 1
+    persistence.durable_seq = 0;
+    lock_init(&persistence.lock);
+    signal_init(&persistence.queued);
+    signal_init(&persistence.written);
+    persistence.writer.task = persistence_writer;
+    persistence.writer.arg = NULL;
+    persistence.started = start_worker(&persistence.writer);
+}
+
+// persist_append() - Queues one line (with its line ending) for the end of a data file
+// done(seq, ok, context) is called on the writer thread once the line is on the disk.
+// Returns the file offset the line will start at.
+int64_t persist_append(DataTable table, const char *line, PersistCallback done, void *context)
+{
+    persist_recover_failures();  // Offsets handed out after a failed write would be shifted
+    int64_t offset = data_file_size(table_files[table]);
+    int length = (int)strlen(line);
+
+    // Back-pressure: wait while the ring is full
+    if (persistence.head - shared_load(&persistence.tail) >= PERSIST_QUEUE_SIZE)
+    {
+        double started = now_seconds();
+        persistence.stalls++;
+        lock_acquire(&persistence.lock);
+        while (persistence.head - shared_load(&persistence.tail) >= PERSIST_QUEUE_SIZE)
+            signal_wait(&persistence.written, &persistence.lock);
+        lock_release(&persistence.lock);
+        persistence.stall_seconds += now_seconds() - started;
+    }
+
+    int64_t seq = persistence.head;
+    PersistRequest *r = &persistence.queue[seq % PERSIST_QUEUE_SIZE];
+    r->table = table;
+    r->length = length < LINE_SIZE ? length : LINE_SIZE - 1;
+    memcpy(r->line, line, r->length);
+    r->queued_at = now_seconds();
+    r->done = done;
+    r->context = context;
+    if (shared_load(&persistence.pending[table]) == 0)
+        persistence.queued_size[table] = offset;  // Nothing queued for this file yet
+    persistence.queued_size[table] += r->length;
+    shared_add(&persistence.pending[table], 1);
+
+    if (!persistence.started)  // No writer thread: write it now
+    {
+        persist_batch(seq, seq + 1);
+        persistence.head = persistence.tail = seq + 1;
+        return offset;
+    }
+    shared_store(&persistence.head, seq + 1);  // Hand the request to the writer thread
+    persist_wake(&persistence.queued);
+    return offset;
+}
+
+// persist_queued_size() - Size a data file will have once its queued lines are written
+// Returns -1 if nothing is queued for it (then the size on disk is current)
+int64_t persist_queued_size(const char *filename)
+{
+    DataTable table = table_of_file(filename);
+    if (table == TABLE_COUNT || shared_load(&persistence.pending[table]) == 0)
+        return -1;
+    return persistence.queued_size[table];
+}
+
+// persist_wait_for_file() - Waits until every queued line of a data file is written
+// Safe to call from any thread
+void persist_wait_for_file(const char *filename)
+{
+    DataTable table = table_of_file(filename);
+    if (table == TABLE_COUNT)
+        return;
+    if (shared_load(&persistence.pending[table]) == 0)
+        return;  // Nothing queued (also the case when the writer thread never started)
+    lock_acquire(&persistence.lock);
+    while (shared_load(&persistence.pending[table]) > 0)
+        signal_wait(&persistence.written, &persistence.lock);
+    lock_release(&persistence.lock);
+}
+
+// persist_flush() - Waits until every queued line is on the disk (called before exit)
+void persist_flush()
+{
+    int64_t last = persistence.head - 1;
+    if (shared_load(&persistence.durable_seq) >= last)
+        return;
+    lock_acquire(&persistence.lock);
+    while (shared_load(&persistence.durable_seq) < last)
+        signal_wait(&persistence.written, &persistence.lock);
+    lock_release(&persistence.lock);
+}
+
+// persist_wait_ack() - Waits for the durable acknowledgement of one line
+// Returns 1 if the line is on the disk. A failure is reported by the caller, so the
+// main menu warning does not count it again.
+int persist_wait_ack(DurableAck *ack)
+{
+    if (!shared_load(&ack->done))
+    {
+        lock_acquire(&persistence.lock);
+        while (!shared_load(&ack->done))
+            signal_wait(&persistence.written, &persistence.lock);
+        lock_release(&persistence.lock);
+    }
+    if (shared_load(&ack->ok))
+        return 1;
+    persistence.failures_reported[ack->table]++;
+    persist_recover_failures();  // Rebuild what was built from the lost line
+    return 0;
+}
+
+// persist_recover_failures() - Undoes what trusted lines that were never written
+// A line is added to the in-memory structures when it is queued: its offset goes
+// into the patient indexes, shard manifest and view cache, its ID into the ID
+// registry, its name into the name index, a hospital into the ranking and the k-d
+// tree, and its record is shipped to the read replicas. If the writer thread then
+// fails to append the batch, all of that describes rows that do not exist (and
+// offsets after them are shifted). The writer only counts the failure; this front
+// desk function waits for the file's other queued lines, then makes every one of
+// those structures rebuild from the real file. Admission events are not affected:
+// they are only logged after the durable acknowledgement.
+void persist_recover_failures()
+{
+    for (int t = 0; t < TABLE_COUNT; t++)
+    {
+        if (shared_load(&persistence.failed_batches[t]) == persistence.failures_handled[t])
+            continue;
+        persist_wait_for_file(table_files[t]);  // Lines queued after the failure are settled too
+        persistence.failures_handled[t] = shared_load(&persistence.failed_batches[t]);
+        persistence.queued_size[t] = 0;  // Taken from the file on disk for the next queued line
+        if (t == TABLE_PATIENTS)
+        {
+            invalidate_patient_indexes();
+            name_index_reset(&patient_names);
+        }
+        else
+        {
+            invalidate_hospital_shards();
+            name_index_reset(&hospital_names);
+            hospital_ranking.built = 0;
+            hospital_locations.built = 0;
+        }
+        forget_id_registry((DataTable)t);  // The lost IDs can be used again
+        bump_table_version((DataTable)t);  // Cached views were built with the lost lines
+        replication_resync();
+    }
+}
+
+// persistence_warnings() - Tells the user about writes that failed since the last call
+void persistence_warnings()
+{
+    persist_recover_failures();
+    for (int t = 0; t < TABLE_COUNT; t++)
+    {
+        int64_t failed = shared_load(&persistence.failed[t]);
+        if (failed > persistence.failures_reported[t])
+        {
+            printf(RED BOLD "Warning: %lld new line(s) could not be saved to %s!\n" RESET,
+                   (long long)(failed - persistence.failures_reported[t]), table_files[t]);
+            persistence.failures_reported[t] = failed;
+        }
+    }
+}
+
+// persistence_status() - System Tools: queue depth, batches and durable acknowledgements
+void persistence_status()
+{
+    int64_t submitted = persistence.head - 1;
+    int64_t durable = shared_load(&persistence.durable_seq);
+    int64_t batches = shared_load(&persistence.batches);
+    printf(MAGENTA BOLD "\n--- Background Persistence ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    if (!persistence.started)
+        printf(RED "The writer thread is not running; lines are written synchronously.\n" RESET);
+    printf(YELLOW "Lines submitted:        %lld\n", (long long)submitted);
+    printf("Lines durable (synced): %lld\n", (long long)durable);
+    printf("Waiting in the queue:   %lld of %d\n", (long long)(submitted - durable), PERSIST_QUEUE_SIZE);
+    printf("Batches written:        %lld (%.1f lines each, %.1f KB in total)\n", (long long)batches,
+           batches ? (double)durable / batches : 0.0, shared_load(&persistence.bytes_written) / 1024.0);
+    printf("Write + sync time:      %.2f ms per batch\n", batches ? persistence.sync_seconds * 1000.0 / batches : 0.0);
+    printf("Time to durable:        %.2f ms average, %.2f ms max\n",
+           durable ? persistence.ack_seconds * 1000.0 / durable : 0.0, persistence.ack_seconds_max * 1000.0);
+    printf("Queue full waits:       %lld (%.2f ms waited)\n" RESET, (long long)persistence.stalls, persistence.stall_seconds * 1000.0);
+    for (int t = 0; t < TABLE_COUNT; t++)
+        printf(CYAN "%-14s %lld acknowledged, %lld failed\n" RESET, table_files[t],
+               (long long)shared_load(&persistence.acked[t]), (long long)shared_load(&persistence.failed[t]));
+}
+
+// ===== ADMISSION EVENT LOG =====
+// Every admission, discharge and transfer is appended, with its time, to an
+// event log that is never rewritten. The log is split into segment files of
+// EVENT_SEGMENT_EVENTS events. Each event is stored compactly as variable-length
+// numbers: the time and the patient ID as the difference from the previous event
+// of the segment, so a typical event takes 6-8 bytes instead of a text line.
+//
+// events.zones keeps a summary ("zone map") of every segment: its first and last
+// time, its smallest and largest hospital ID and its net change of the census.
+// A time range query only decodes segments whose zone overlaps the range and the
+// hospital, and the census before a report starts is added up from the zones.
+// A stale zone (the segment grew after the zone file was saved) is rebuilt on open.
+
+static const char *event_type_names[] = {"", "Admit", "Discharge", "Transfer"};
+
+// write_varint() - Stores v in 7-bit groups (small numbers take one byte), returns the bytes used
+static int write_varint(unsigned char *out, uint64_t v)
+{
+    int n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (unsigned char)(v | 0x80);  // More groups follow
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+// read_varint() - Reads one number written by write_varint(), returns 0 if the data ends early
+static int read_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+    *v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7)
+    {
+        unsigned char byte = *(*p)++;
+        *v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+// zigzag() / unzigzag() - Map signed differences to small unsigned numbers (0, -1, 1, -2 -> 0, 1, 2, 3)
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// event_segment_filename() - File name of one segment
+static void event_segment_filename(int segment, char *filename, int size)
+{
+    snprintf(filename, size, EVENT_SEGMENT_FORMAT, segment);
+}
+
+// encode_event() - Appends one event to out, relative to the previous event of the segment
+// Returns the bytes written (at most EVENT_MAX_BYTES)
+static int encode_event(unsigned char *out, const PatientEvent *e, int64_t *last_time, int *last_patient)
+{
+    int n = write_varint(out, zigzag(e->time - *last_time));
+    out[n++] = (unsigned char)e->type;
+    n += write_varint(out + n, zigzag((int64_t)e->patient_id - *last_patient));
+    n += write_varint(out + n, (uint32_t)e->hospital_id);
+    if (e->type == EVENT_TRANSFER)
+        n += write_varint(out + n, (uint32_t)e->to_hospital_id);
+    *last_time = e->time;
+    *last_patient = e->patient_id;
+    return n;
+}
+
+// decode_segment() - Decodes a whole segment and calls visit() for every event in order
+// Returns the number of events, or -1 if the segment cannot be read. last (may be NULL)
+// receives the final event, which is where the next appended event continues from.
+static int decode_segment(int segment, void (*visit)(const PatientEvent *, void *), void *context, PatientEvent *last)
+{
+    char filename[64];
+    event_segment_filename(segment, filename, sizeof(filename));
+    FILE *fp = stats_fopen(filename, "rb");
+    if (!fp)
+        return -1;
+    file_seek(fp, 0, SEEK_END);
+    int64_t size = file_tell(fp);
+    file_seek(fp, 0, SEEK_SET);
+    unsigned char *data = (unsigned char *)stats_malloc(size > 0 ? size : 1);
+    size = (int64_t)fread(data, 1, size, fp);
+    fclose(fp);
+    stats.bytes_read += size;
+
+    const unsigned char *p = data, *end = data + size;
+    int64_t time = 0;
+    int patient = 0, count = 0;
+    while (p < end)
+    {
+        uint64_t delta_time, type, delta_patient, hospital, to_hospital = 0;
+        if (!read_varint(&p, end, &delta_time) || p >= end)
+            break;  // A half-written last event (the program stopped while writing it)
+        type = *p++;
+        if (!read_varint(&p, end, &delta_patient) || !read_varint(&p, end, &hospital) ||
+            (type == EVENT_TRANSFER && !read_varint(&p, end, &to_hospital)))
+            break;
+        PatientEvent e;
+        time += unzigzag(delta_time);
+        patient += (int)unzigzag(delta_patient);
+        e.time = time;
+        e.type = (EventType)type;
+        e.patient_id = patient;
+        e.hospital_id = (int)hospital;
+        e.to_hospital_id = (int)to_hospital;
+        if (visit)
+            visit(&e, context);
+        if (last)
+            *last = e;
+        count++;
+    }
+    free(data);
+    return count;
+}
+
+// zone_add() - Widens a segment summary to include one event
+static void zone_add(EventZone *z, const PatientEvent *e)
+{
+    int low = e->hospital_id, high = e->hospital_id;
+    if (e->type == EVENT_TRANSFER)
+    {
+        low = e->to_hospital_id < low ? e->to_hospital_id : low;
+        high = e->to_hospital_id > high ? e->to_hospital_id : high;
+    }
+    if (z->count == 0 || e->time < z->min_time)
+        z->min_time = e->time;
+    if (z->count == 0 || e->time > z->max_time)
+        z->max_time = e->time;
+    if (z->count == 0 || low < z->min_hospital)
+        z->min_hospital = low;
+    if (z->count == 0 || high > z->max_hospital)
+        z->max_hospital = high;
+    z->net_census += e->type == EVENT_ADMIT ? 1 : e->type == EVENT_DISCHARGE ? -1 : 0;
+    z->count++;
+}
+
+// zone_visit() - decode_segment() callback that rebuilds a zone
+static void zone_visit(const PatientEvent *e, void *context)
+{
+    zone_add((EventZone *)context, e);
+}
+
+// save_event_zones() - Writes the summary of every segment to EVENT_ZONE_FILE
+// Line format: count|bytes|min_time|max_time|min_hospital|max_hospital|net_census
+static void save_event_zones()
+{
+    FILE *fp = stats_fopen(EVENT_ZONE_FILE, "w");
+    if (!fp)
+        return;
+    for (int s = 0; s < event_log.segment_count; s++)
+    {
+        const EventZone *z = &event_log.zones[s];
+        fprintf(fp, "%d|%lld|%lld|%lld|%d|%d|%lld\n", z->count, (long long)z->bytes, (long long)z->min_time,
+                (long long)z->max_time, z->min_hospital, z->max_hospital, (long long)z->net_census);
+    }
+    fclose(fp);
+}
+
+// event_log_grow() - Makes room for one more segment summary
+static EventZone *event_log_grow()
+{
+    if (event_log.segment_count == event_log.capacity)
+    {
+        event_log.capacity = event_log.capacity ? event_log.capacity * 2 : 16;
+        event_log.zones = (EventZone *)stats_realloc(event_log.zones, event_log.capacity * sizeof(EventZone));
+    }
+    EventZone *z = &event_log.zones[event_log.segment_count++];
+    memset(z, 0, sizeof(EventZone));
+    return z;
+}
+
+// event_log_open() - Loads the segment summaries (rebuilding stale ones) on first use
+void event_log_open()
+{
+    if (event_log.loaded)
+        return;
+    event_log.loaded = 1;
+
+    // Summaries as they were last saved
+    EventZone *saved = NULL;
+    int saved_count = 0, saved_capacity = 0;
+    FILE *fp = stats_fopen(EVENT_ZONE_FILE, "r");
+    if (fp)
     {
-        for (int j = 0; j < n - 1 - i; j++)  // Inner loop
+        char line[LINE_SIZE];
+        EventZone z;
+        long long bytes, min_time, max_time, net;
+        while (read_line(line, LINE_SIZE, fp) &&
+               sscanf(line, "%d|%lld|%lld|%lld|%d|%d|%lld", &z.count, &bytes, &min_time, &max_time,
+                      &z.min_hospital, &z.max_hospital, &net) == 7)
         {
-            // strcmp returns positive if first string comes after second alphabetically
-            if (strcmp(h[j].hospital_name, h[j + 1].hospital_name) > 0)
+            z.bytes = bytes;
+            z.min_time = min_time;
+            z.max_time = max_time;
+            z.net_census = net;
+            if (saved_count == saved_capacity)
             {
-                Hospital temp = h[j];
-                h[j] = h[j + 1];
-                h[j + 1] = temp;
+                saved_capacity = saved_capacity ? saved_capacity * 2 : 16;
+                saved = (EventZone *)stats_realloc(saved, saved_capacity * sizeof(EventZone));
             }
+            saved[saved_count++] = z;
         }
+        fclose(fp);
     }
 
-    // Display sorted hospitals
-    printf(MAGENTA BOLD "\n--- Hospitals Sorted by Name (A to Z) ---\n" RESET);
-   printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
-   printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");
-    printf("%5s | %-50s | %-12s | %5s | %-10s | %7s | %7s\n", "ID", "Hospital Name", "City", "Beds", "Price", "Ratings", "Reviews");
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    for (int i = 0; i < n; i++)
+    // Keep every summary whose segment still has the size it had; decode the others
+    int rebuilt = 0;
+    char filename[64];
+    for (int s = 0;; s++)
     {
-        Hospital x = h[i];
-        printf(CYAN "%5d | %-50s | %-12s | %5d | %10.2f | %7.1f | %7d\n" RESET,
-               x.hospital_id, x.hospital_name, x.city, x.available_beds, x.bed_price, x.rating, x.reviews);
+        event_segment_filename(s, filename, sizeof(filename));
+        int64_t size = data_file_size(filename);
+        if (size == 0)
+            break;  // No more segments
+        EventZone *z = event_log_grow();
+        if (s < saved_count && saved[s].bytes == size)
+            *z = saved[s];
+        else
+        {
+            decode_segment(s, zone_visit, z, NULL);
+            z->bytes = size;
+            rebuilt = 1;
+        }
+    }
+    free(saved);
+    if (rebuilt)
+        save_event_zones();
+
+    // The next event continues the deltas of the last segment
+    if (event_log.segment_count > 0)
+    {
+        PatientEvent last = {0};
+        decode_segment(event_log.segment_count - 1, NULL, NULL, &last);
+        event_log.last_time = last.time;
+        event_log.last_patient = last.patient_id;
     }
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
-    free(h);  // Free allocated memory
 }
 
-// sort_hospitals_by_rating_and_reviews() - Sorts hospitals by rating, then by reviews
-void sort_hospitals_by_rating_and_reviews()
+// location_visit() - decode_segment() callback that follows where every patient is
+static void location_visit(const PatientEvent *e, void *context)
 {
-    // Count total hospitals and check if any exist
-    int n = count_records(HOSPITAL_FILE);
-    if (n == 0)
+    IntMap *location = (IntMap *)context;
+    intmap_put(location, e->patient_id, e->type == EVENT_ADMIT ? e->hospital_id :
+                                        e->type == EVENT_TRANSFER ? e->to_hospital_id : 0);
+}
+
+// event_log_append() - Appends one event to the newest segment (starting a new one when it is full)
+// Every event is synced to the disk. Returns 1 on success; on failure the segment is
+// cut back to its last whole event, because every later event is stored as a
+// difference from the one before and a half-written event would shift them all.
+int event_log_append(const PatientEvent *e)
+{
+    event_log_open();
+    EventZone *z = event_log.segment_count > 0 ? &event_log.zones[event_log.segment_count - 1] : NULL;
+    if (!z || z->count >= EVENT_SEGMENT_EVENTS || event_log.torn)
     {
-        printf(RED "No hospitals found!\n" RESET);
-        return;
+        if (event_log.active)
+        {
+            fclose(event_log.active);
+            event_log.active = NULL;
+            save_event_zones();  // The full segment will not change any more
+        }
+        z = event_log_grow();
+        event_log.last_time = 0;  // Every segment can be decoded on its own
+        event_log.last_patient = 0;
+        event_log.torn = 0;
+    }
+    if (!event_log.active)
+    {
+        char filename[64];
+        event_segment_filename(event_log.segment_count - 1, filename, sizeof(filename));
+        event_log.active = stats_fopen(filename, "ab");
+        if (!event_log.active)
+            return 0;
+    }
+
+    unsigned char record[EVENT_MAX_BYTES];
+    int64_t last_time = event_log.last_time;
+    int last_patient = event_log.last_patient;
+    int n = encode_event(record, e, &event_log.last_time, &event_log.last_patient);
+    if (fwrite(record, 1, n, event_log.active) != (size_t)n || !sync_file(event_log.active))
+    {
+        event_log.last_time = last_time;  // The next event is still a difference from the old last one
+        event_log.last_patient = last_patient;
+        if (!truncate_file(event_log.active, z->bytes))
+            event_log.torn = 1;
+        fclose(event_log.active);  // Reopened (at the real end of the file) by the next event
+        event_log.active = NULL;
+        return 0;
+    }
+    z->bytes += n;
+    zone_add(z, e);
+    if (event_log.locations_ready)
+        location_visit(e, &event_log.location);
+    return 1;
+}
+
+// log_patient_event() - Records an admission, discharge or transfer that happens now
+// Returns 1 once the event is on the disk
+int log_patient_event(EventType type, int patient_id, int hospital_id, int to_hospital_id)
+{
+    PatientEvent e = {(int64_t)time(NULL), type, patient_id, hospital_id, to_hospital_id};
+    return event_log_append(&e);
+}
+
+// patient_location() - Hospital a patient is in now (0 = discharged, -1 = unknown patient)
+// Follows the event log; patients admitted before the log existed are in their patients.txt hospital
+int patient_location(int patient_id)
+{
+    event_log_open();
+    if (!event_log.locations_ready)  // Replay the whole log once
+    {
+        intmap_init(&event_log.location, 1024);
+        for (int s = 0; s < event_log.segment_count; s++)
+            decode_segment(s, location_visit, &event_log.location, NULL);
+        event_log.locations_ready = 1;
     }
+    int hospital;
+    if (intmap_get(&event_log.location, patient_id, &hospital))
+        return hospital;
 
-    // Allocate memory for array to store all hospitals
-    Hospital *h = (Hospital *)malloc(n * sizeof(Hospital));
-    load_hospitals(h, &n);  // Load hospitals from file
+    int64_t offset;
+    Patient p;
+    if (open_patient_indexes() && btree_search(&patient_id_index, patient_id, &offset) && read_patient_at(offset, &p))
+        return p.hospital_id;
+    return -1;
+}
 
-    // Bubble Sort: sort by rating first, then by reviews if ratings are equal
-    for (int i = 0; i < n - 1; i++)  // Outer loop
+// read_event_time() - Prompts for "YYYY-MM-DD" or "YYYY-MM-DD HH:MM" (local time)
+// end_of_day: a date without a time means the end of that day instead of its start
+static int64_t read_event_time(const char *prompt, int end_of_day)
+{
+    char input[LINE_SIZE];
+    while (1)
     {
-        for (int j = 0; j < n - 1 - i; j++)  // Inner loop
+        printf(GREEN "%s" RESET, prompt);
+        if (!fgets(input, LINE_SIZE, stdin))
+            return 0;
+        struct tm when;
+        memset(&when, 0, sizeof(when));
+        int fields = sscanf(input, "%d-%d-%d %d:%d", &when.tm_year, &when.tm_mon, &when.tm_mday, &when.tm_hour, &when.tm_min);
+        if ((fields == 3 || fields == 5) && when.tm_hour >= 0 && when.tm_hour <= 23 && when.tm_min >= 0 && when.tm_min <= 59)
         {
-            // If current rating less than next, or ratings equal and current reviews less, swap
-            if (h[j].rating < h[j + 1].rating ||
-                (h[j].rating == h[j + 1].rating && h[j].reviews < h[j + 1].reviews))
+            int year = when.tm_year - 1900, month = when.tm_mon - 1, day = when.tm_mday;
+            when.tm_year = year;
+            when.tm_mon = month;
+            when.tm_isdst = -1;  // Let mktime() work out daylight saving time
+            time_t t = mktime(&when);
+            // mktime() quietly rolls a day that does not exist (2024-02-31) into the next month
+            if (t != (time_t)-1 && when.tm_year == year && when.tm_mon == month && when.tm_mday == day)
             {
-                Hospital temp = h[j];
-                h[j] = h[j + 1];
-                h[j + 1] = temp;
+                if (fields == 3 && end_of_day)
+                {
+                    when.tm_mday++;  // Midnight after the day
+                    when.tm_hour = when.tm_min = when.tm_sec = 0;
+                    when.tm_isdst = -1;
+                    t = mktime(&when);
+                }
+                if (t != (time_t)-1)
+                    return (int64_t)t;
             }
         }
+        printf(RED "Invalid date! Use YYYY-MM-DD or YYYY-MM-DD HH:MM.\n" RESET);
     }
+}
 
-    // Display sorted hospitals
-    printf(MAGENTA BOLD "\n--- Hospitals Sorted by Rating & Reviews ---\n" RESET);
+// format_event_time() - "YYYY-MM-DD HH:MM:SS" in local time
+static void format_event_time(int64_t t, char *text, int size)
+{
+    time_t seconds = (time_t)t;
+    struct tm *local = localtime(&seconds);
+    if (!local || !strftime(text, size, "%Y-%m-%d %H:%M:%S", local))
+        snprintf(text, size, "%lld", (long long)t);
+}
+
+// zone_matches() - Can a segment hold events of hospital (0 = any) between from and to?
+static int zone_matches(const EventZone *z, int hospital, int64_t from, int64_t to)
+{
+    if (z->count == 0 || z->max_time < from || z->min_time >= to)
+        return 0;
+    return hospital == 0 || (hospital >= z->min_hospital && hospital <= z->max_hospital);
+}
+
+// event_touches() - Is hospital (0 = any) the hospital of an event, or the one it transfers to?
+static int event_touches(const PatientEvent *e, int hospital)
+{
+    return hospital == 0 || e->hospital_id == hospital || (e->type == EVENT_TRANSFER && e->to_hospital_id == hospital);
+}
+
+// record_discharge_or_transfer() - Patient menu: logs a patient leaving or changing hospital
+void record_discharge_or_transfer()
+{
+    int patient_id = read_int("Enter Patient ID: ");
+    int hospital = patient_location(patient_id);
+    if (hospital < 0)
+    {
+        printf(RED "No patient with ID %d.\n" RESET, patient_id);
+        return;
+    }
+    if (hospital == 0)
+    {
+        printf(RED "Patient %d has already been discharged.\n" RESET, patient_id);
+        return;
+    }
+    printf(YELLOW "Patient %d is in %s (ID %d).\n" RESET, patient_id, get_hospital_name_by_id(hospital), hospital);
+    int choice = read_int("1. Discharge   2. Transfer to another hospital\nEnter your choice: ");
+    if (choice == 1)
+    {
+        if (!log_patient_event(EVENT_DISCHARGE, patient_id, hospital, 0))
+            printf(RED "Error: could not save the discharge to the event log!\n" RESET);
+        else
+            printf(GREEN BOLD "Patient %d discharged.\n" RESET, patient_id);
+    }
+    else if (choice == 2)
+    {
+        int to = read_int("Enter the new Hospital ID: ");
+        if (to == hospital || !registry_contains(hospital_id_registry(), to))
+        {
+            printf(RED "Hospital ID %d is not another existing hospital!\n" RESET, to);
+            return;
+        }
+        if (!log_patient_event(EVENT_TRANSFER, patient_id, hospital, to))
+            printf(RED "Error: could not save the transfer to the event log!\n" RESET);
+        else
+            printf(GREEN BOLD "Patient %d transferred to %s (ID %d).\n" RESET, patient_id, get_hospital_name_by_id(to), to);
+    }
+    else
+        printf(RED "Invalid choice!\n" RESET);
+}
+
+// EventQuery structure: one time range query over the event log
+typedef struct
+{
+    int hospital;             // 0 = every hospital
+    int64_t from, to;         // Time range [from, to)
+    PatientEvent *events;     // Matching events (query arena)
+    int count;
+    int capacity;
+    int64_t matched;          // All matches (only the first capacity are kept)
+    int64_t totals[4];        // Matches per event type
+} EventQuery;
+
+// history_visit() - decode_segment() callback of admission_history()
+static void history_visit(const PatientEvent *e, void *context)
+{
+    EventQuery *q = (EventQuery *)context;
+    if (e->time < q->from || e->time >= q->to || !event_touches(e, q->hospital))
+        return;
+    q->matched++;
+    q->totals[e->type]++;
+    if (q->count < q->capacity)
+        q->events[q->count++] = *e;
+}
+
+// render_event_header() / render_event_row() - Columns of the event list
+static void render_event_header()
+{
+    out_text("\n-------------------------------------------------------------------------------------------------------------------\n");
+    out_padded("Time", 19, 1);
+    out_text(" | ");
+    out_padded("Event", 9, 1);
+    out_text(" | ");
+    out_padded("Patient", 8, 0);
+    out_text(" | ");
+    out_padded("Hospital", 8, 0);
+    out_text(" | ");
+    out_padded("To", 8, 0);
+    out_text("\n-------------------------------------------------------------------------------------------------------------------\n");
+}
+
+static void render_event_row(int index, const void *table)
+{
+    const PatientEvent *e = &((const PatientEvent *)table)[index];
+    char when[32];
+    format_event_time(e->time, when, sizeof(when));
+    out_color(CYAN);
+    out_padded(when, 19, 1);
+    out_text(" | ");
+    out_padded(event_type_names[e->type], 9, 1);
+    out_text(" | ");
+    out_int(e->patient_id, 8, 0);
+    out_text(" | ");
+    out_int(e->hospital_id, 8, 0);
+    out_text(" | ");
+    if (e->type == EVENT_TRANSFER)
+        out_int(e->to_hospital_id, 8, 0);
+    else
+        out_padded("", 8, 0);
+    out_color(RESET);
+    out_bytes("\n", 1);
+}
+
+// admission_history() - Patient menu: events of one hospital (or all) in a time range
+void admission_history()
+{
+    EventQuery q;
+    memset(&q, 0, sizeof(q));
+    q.hospital = read_int("Enter Hospital ID (0 = all hospitals): ");
+    q.from = read_event_time("From (YYYY-MM-DD [HH:MM]): ", 0);
+    q.to = read_event_time("To   (YYYY-MM-DD [HH:MM]): ", 1);
+
+    uint64_t started = stats_start();
+    event_log_open();
+    arena_reset(&query_arena);
+    q.capacity = EVENT_LIST_LIMIT;
+    q.events = (PatientEvent *)arena_alloc(&query_arena, q.capacity * sizeof(PatientEvent));
+    int scanned = 0;
+    for (int s = 0; s < event_log.segment_count; s++)
+    {
+        if (!zone_matches(&event_log.zones[s], q.hospital, q.from, q.to))
+            continue;  // The zone map rules this segment out
+        decode_segment(s, history_visit, &q, NULL);
+        scanned++;
+    }
+    stats_record(OP_HISTORY, started);
+    double elapsed = (stats_start() - started) / 1e6;
+
+    printf(MAGENTA BOLD "\n--- Admission History ---\n" RESET);
+    printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
+    if (q.matched == 0)
+        printf(RED "No events in this time range.\n" RESET);
+    else
+        render_table(render_event_header, render_event_row, q.events, q.count);
+    if (q.matched > q.count)
+        printf(YELLOW "(first %d of %lld events shown)\n" RESET, q.count, (long long)q.matched);
+    printf(YELLOW "Admissions: %lld   Discharges: %lld   Transfers: %lld\n", (long long)q.totals[EVENT_ADMIT],
+           (long long)q.totals[EVENT_DISCHARGE], (long long)q.totals[EVENT_TRANSFER]);
+    printf("Segments decoded: %d of %d (the others were skipped by their zone maps), %.2f ms\n" RESET,
+           scanned, event_log.segment_count, elapsed);
+}
+
+// CensusReport structure: per-day counts of daily_census()
+typedef struct
+{
+    int hospital;             // 0 = every hospital
+    int days;
+    int64_t *day_start;       // Local midnight of every day, plus the midnight after the last day
+    int64_t (*day)[4];        // Per day: admitted, discharged, transferred in, transferred out
+    int64_t before;           // Census when the first day starts
+} CensusReport;
+
+// census_change() - How an event changes the census of a hospital (0 = all hospitals)
+// Returns the column of the event in CensusReport.day (-1 if the hospital is not involved)
+static int census_change(const PatientEvent *e, int hospital, int *change)
+{
+    if (e->type == EVENT_ADMIT && (hospital == 0 || e->hospital_id == hospital))
+        return *change = 1, 0;
+    if (e->type == EVENT_DISCHARGE && (hospital == 0 || e->hospital_id == hospital))
+        return *change = -1, 1;
+    if (e->type == EVENT_TRANSFER && hospital != 0 && e->to_hospital_id == hospital)
+        return *change = 1, 2;
+    if (e->type == EVENT_TRANSFER && hospital != 0 && e->hospital_id == hospital)
+        return *change = -1, 3;
+    if (e->type == EVENT_TRANSFER && hospital == 0)
+        return *change = 0, 2;  // Moves within the system: counted as in and out, census unchanged
+    return *change = 0, -1;
+}
+
+// census_visit() - decode_segment() callback of daily_census()
+static void census_visit(const PatientEvent *e, void *context)
+{
+    CensusReport *r = (CensusReport *)context;
+    int change;
+    int column = census_change(e, r->hospital, &change);
+    if (column < 0 || e->time >= r->day_start[r->days])
+        return;
+    if (e->time < r->day_start[0])
+    {
+        r->before += change;
+        return;
+    }
+    int low = 0, high = r->days - 1;  // Binary search for the day of the event
+    while (low < high)
+    {
+        int mid = (low + high + 1) / 2;
+        if (r->day_start[mid] <= e->time)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    r->day[low][column]++;
+    if (e->type == EVENT_TRANSFER && r->hospital == 0)
+        r->day[low][3]++;
+}
+
+// daily_census() - Patient menu: patients in hospital at the end of every day, and the daily throughput
+void daily_census()
+{
+    CensusReport r;
+    memset(&r, 0, sizeof(r));
+    r.hospital = read_int("Enter Hospital ID (0 = all hospitals): ");
+    int64_t from = read_event_time("First day (YYYY-MM-DD): ", 0);
+    int64_t to = read_event_time("Last day  (YYYY-MM-DD): ", 1);
+
+    // Local midnights (days are not always 24 hours long with daylight saving time)
+    uint64_t started = stats_start();
+    arena_reset(&query_arena);
+    r.day_start = (int64_t *)arena_alloc(&query_arena, (EVENT_REPORT_DAYS + 1) * sizeof(int64_t));
+    time_t midnight = (time_t)from;
+    struct tm day = *localtime(&midnight);
+    while (r.days < EVENT_REPORT_DAYS)
+    {
+        day.tm_hour = day.tm_min = day.tm_sec = 0;
+        day.tm_isdst = -1;
+        int64_t start = (int64_t)mktime(&day);
+        if (start >= to)
+            break;
+        r.day_start[r.days++] = start;
+        day.tm_mday++;
+    }
+    if (r.days == 0)
+    {
+        printf(RED "The last day is before the first day!\n" RESET);
+        return;
+    }
+    day.tm_isdst = -1;
+    r.day_start[r.days] = (int64_t)mktime(&day);
+    r.day = (int64_t(*)[4])arena_alloc(&query_arena, r.days * sizeof(*r.day));
+    memset(r.day, 0, r.days * sizeof(*r.day));
+
+    // Segments that end before the first day only count towards the starting census:
+    // for all hospitals their net change is in the zone map, so they are not decoded
+    event_log_open();
+    int scanned = 0;
+    for (int s = 0; s < event_log.segment_count; s++)
+    {
+        const EventZone *z = &event_log.zones[s];
+        if (z->count == 0 || z->min_time >= r.day_start[r.days])
+            continue;
+        if (r.hospital == 0 && z->max_time < r.day_start[0])
+        {
+            r.before += z->net_census;
+            continue;
+        }
+        if (r.hospital != 0 && (r.hospital < z->min_hospital || r.hospital > z->max_hospital))
+            continue;
+        decode_segment(s, census_visit, &r, NULL);
+        scanned++;
+    }
+    stats_record(OP_HISTORY, started);
+    double elapsed = (stats_start() - started) / 1e6;
+
+    printf(MAGENTA BOLD "\n--- Daily Census & Throughput ---\n" RESET);
     printf(BLUE "_________________________________________________________________________________________________________________________\n" RESET);
-    printf("\n\n-------------------------------------------------------------------------------------------------------------------\n");
-    printf("%5s | %-50s | %-12s | %5s | %-10s | %7s | %7s\n", "ID", "Hospital Name", "City", "Beds", "Price", "Ratings", "Reviews");
+    printf("\n%-10s | %10s | %10s | %12s | %12s | %10s\n", "Day", "Admitted", "Discharged", "Transfer in", "Transfer out", "Census");
     printf("-------------------------------------------------------------------------------------------------------------------\n");
-    for (int i = 0; i < n; i++)
+    int64_t census = r.before, peak = r.before, total[4] = {0, 0, 0, 0};
+    for (int d = 0; d < r.days; d++)
     {
-        Hospital x = h[i];
-        printf(CYAN "%5d | %-50s | %-12s | %5d | %10.2f | %7.1f | %7d\n" RESET,
-               x.hospital_id, x.hospital_name, x.city, x.available_beds, x.bed_price, x.rating, x.reviews);
+        char date[16];
+        time_t t = (time_t)r.day_start[d];
+        strftime(date, sizeof(date), "%Y-%m-%d", localtime(&t));
+        census += r.day[d][0] - r.day[d][1] + r.day[d][2] - r.day[d][3];
+        if (census > peak)
+            peak = census;
+        for (int c = 0; c < 4; c++)
+            total[c] += r.day[d][c];
+        printf(CYAN "%-10s | %10lld | %10lld | %12lld | %12lld | %10lld\n" RESET, date, (long long)r.day[d][0],
+               (long long)r.day[d][1], (long long)r.day[d][2], (long long)r.day[d][3], (long long)census);
     }
     printf("-------------------------------------------------------------------------------------------------------------------\n");
-    
-    free(h);  // Free allocated memory
+    printf(YELLOW "Census at the start: %lld   at the end: %lld   peak: %lld\n", (long long)r.before, (long long)census, (long long)peak);
+    printf("Throughput: %.1f admissions and %.1f discharges per day (%d days)\n",
+           (double)total[0] / r.days, (double)total[1] / r.days, r.days);
+    printf("Segments decoded: %d of %d, %.2f ms\n" RESET, scanned, event_log.segment_count, elapsed);
+    printf("(The census starts at 0 when the event log starts: patients admitted before it only count when they leave.)\n");
 }